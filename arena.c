@@ -0,0 +1,100 @@
+/**
+ * Preallocated memory arena
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/**
+ * Rounds a size up to the arena alignment
+ *
+ * @param size size of an allocation
+ * @return space the allocation takes up in an arena
+ */
+size_t arena_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+/**
+ * Allocates the block backing an arena
+ *
+ * @param arena arena to initialize
+ * @param size size of the block, the sum of arena_size() of every allocation that will be made from it
+ */
+void arena_init(struct arena *arena, size_t size) {
+    void *base;
+
+    if (posix_memalign(&base, ARENA_ALIGNMENT, size)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(base, 0, size);
+    arena->base = base;
+    arena->size = size;
+    arena->used = 0;
+}
+
+/**
+ * Frees the block backing an arena, along with every allocation made from it
+ *
+ * @param arena arena to free
+ */
+void arena_free(struct arena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+/**
+ * Takes an aligned, zeroed allocation from an arena, exiting if the arena is exhausted
+ *
+ * @param arena arena to allocate from
+ * @param size size of the allocation in bytes
+ * @return new allocation
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+    void *allocation = arena->base + arena->used;
+
+    if (arena_size(size) > arena->size - arena->used) {
+        fprintf(stderr, "Arena exhausted\n");
+        exit(EXIT_FAILURE);
+    }
+
+    arena->used += arena_size(size);
+
+    return allocation;
+}
+
+#ifdef TEST_MODE
+size_t g_heap_allocations = 0;
+__thread int g_heap_uncounted = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, !g_heap_uncounted, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, !g_heap_uncounted, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, !g_heap_uncounted, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, !g_heap_uncounted, __ATOMIC_RELAXED);
+    return __real_posix_memalign(memptr, alignment, size);
+}
+#endif
@@ -0,0 +1,36 @@
+/**
+ * Preallocated memory arena
+ *
+ * Every working buffer of a pipeline is carved out of one aligned block at startup so no heap allocations are made
+ * while frames are being processed.
+ */
+
+#ifndef MOTION_DETECTOR_ARENA_H
+#define MOTION_DETECTOR_ARENA_H
+
+#include <stddef.h>
+
+// Alignment of every arena allocation, a cache line and a full AVX register
+#define ARENA_ALIGNMENT 64
+
+/**
+ * Bump allocator over a single block of memory
+ */
+struct arena {
+    unsigned char *base;
+    size_t size;
+    size_t used;
+};
+
+void arena_init(struct arena *arena, size_t size);
+void arena_free(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+size_t arena_size(size_t size);
+
+#ifdef TEST_MODE
+// Number of heap allocations made by the program, counted through the linker's --wrap option
+extern size_t g_heap_allocations;
+// Set on threads whose allocations are not the pipeline's, such as the test mode's codec threads, to leave them out
+extern __thread int g_heap_uncounted;
+#endif
+#endif //MOTION_DETECTOR_ARENA_H
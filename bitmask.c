@@ -0,0 +1,145 @@
+/**
+ * Bit-packed binary images
+ */
+
+#include <string.h>
+#include "bitmask.h"
+
+/**
+ * Words needed for a row
+ */
+static int row_words(int width) {
+    return (width + BITMASK_WORD_BITS - 1) / BITMASK_WORD_BITS;
+}
+
+/**
+ * Bits of a word covering pixels [start, end) of a row, clipped to the word
+ *
+ * @param w word
+ * @param start first pixel
+ * @param end pixel after the last one
+ * @return mask of the bits
+ */
+static uint64_t span_bits(int w, int start, int end) {
+    int first = start - w * BITMASK_WORD_BITS;
+    int last = end - w * BITMASK_WORD_BITS;
+    uint64_t bits = first > 0 ? UINT64_MAX << first : UINT64_MAX;
+
+    return last < BITMASK_WORD_BITS ? bits & ~(UINT64_MAX << last) : bits;
+}
+
+/**
+ * Arena space needed by a binary image
+ *
+ * @param width width of the image
+ * @param height height of the image
+ * @return size in bytes
+ */
+size_t bitmask_arena_size(int width, int height) {
+    return arena_size((size_t) row_words(width) * height * sizeof(uint64_t));
+}
+
+/**
+ * Initializes a binary image with every pixel clear
+ *
+ * @param mask binary image to initialize
+ * @param width width of the image
+ * @param height height of the image
+ * @param arena arena to allocate the bits from
+ */
+void bitmask_init(struct bitmask *mask, int width, int height, struct arena *arena) {
+    mask->width = width;
+    mask->height = height;
+    mask->words = row_words(width);
+    mask->bits = arena_alloc(arena, (size_t) mask->words * height * sizeof(uint64_t));
+    bitmask_clear(mask);
+}
+
+/**
+ * Clears every pixel of a binary image
+ *
+ * @param mask binary image
+ */
+void bitmask_clear(struct bitmask *mask) {
+    memset(mask->bits, 0, (size_t) mask->words * mask->height * sizeof(uint64_t));
+}
+
+/**
+ * Clears pixels [start, end) of a row
+ *
+ * @param row words of the row
+ * @param start first pixel
+ * @param end pixel after the last one
+ */
+void bitmask_clear_span(uint64_t *row, int start, int end) {
+    for (int w = start / BITMASK_WORD_BITS; w * BITMASK_WORD_BITS < end; w++) {
+        row[w] &= ~span_bits(w, start, end);
+    }
+}
+
+/**
+ * Sets pixels [start, end) of a row
+ *
+ * @param row words of the row
+ * @param start first pixel
+ * @param end pixel after the last one, at most the width of the image
+ */
+void bitmask_set_span(uint64_t *row, int start, int end) {
+    for (int w = start / BITMASK_WORD_BITS; w * BITMASK_WORD_BITS < end; w++) {
+        row[w] |= span_bits(w, start, end);
+    }
+}
+
+/**
+ * Packs pixels [start, end) of a row of bytes into a row of a binary image
+ *
+ * Only the top bit of each byte is looked at, which is all a motion image of STILL_PIXEL and MOTION_PIXEL values needs.
+ * Eight bytes are packed at a time by multiplying their top bits into a single byte.
+ *
+ * @param bits words of the row
+ * @param row bytes of the row, indexed from the start of the row
+ * @param start first pixel
+ * @param end pixel after the last one, at most the width of the image
+ */
+void bitmask_pack_span(uint64_t *bits, const uchar *row, int start, int end) {
+    int i = start;
+
+    bitmask_clear_span(bits, start, end);
+
+    for (; i + 8 <= end; i += 8) {
+        uint64_t bytes;
+        uint64_t packed;
+        int shift = i % BITMASK_WORD_BITS;
+
+        memcpy(&bytes, row + i, sizeof(bytes));
+        packed = ((bytes & 0x8080808080808080ULL) * 0x0002040810204081ULL) >> 56;
+        bits[i / BITMASK_WORD_BITS] |= packed << shift;
+
+        // The eight pixels may straddle two words
+        if (shift > BITMASK_WORD_BITS - 8) {
+            bits[i / BITMASK_WORD_BITS + 1] |= packed >> (BITMASK_WORD_BITS - shift);
+        }
+    }
+
+    for (; i < end; i++) {
+        bits[i / BITMASK_WORD_BITS] |= (uint64_t) (row[i] >> 7) << (i % BITMASK_WORD_BITS);
+    }
+}
+
+/**
+ * Unpacks a binary image into one byte per pixel
+ *
+ * @param mask binary image
+ * @param dest width * height bytes to fill
+ * @param value byte written for set pixels, clear ones are written as 0
+ */
+void bitmask_unpack(const struct bitmask *mask, uchar *dest, uchar value) {
+    for (int j = 0; j < mask->height; j++) {
+        const uint64_t *row = bitmask_row(mask, j);
+        uchar *dest_row = dest + (size_t) j * mask->width;
+
+        for (int i = 0; i < mask->width; i++) {
+            dest_row[i] = (row[i / BITMASK_WORD_BITS] >> (i % BITMASK_WORD_BITS)) & 1 ? value : 0;
+        }
+    }
+}
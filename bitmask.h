@@ -0,0 +1,115 @@
+/**
+ * Bit-packed binary images
+ *
+ * One bit per pixel, 64 pixels to a word, with the first pixel of a row in the lowest bit of its first word. Each row
+ * starts on a word of its own and the bits past the end of a row are always clear, so whole words can be scanned and
+ * combined without masking them. Rows are worked on through bitmask_row(), so bands can fill their own rows of a
+ * shared image.
+ */
+
+#ifndef MOTION_DETECTOR_BITMASK_H
+#define MOTION_DETECTOR_BITMASK_H
+
+#include <stdint.h>
+#include "image_manipulation.h"
+#include "arena.h"
+
+// Pixels held by each word of a row
+#define BITMASK_WORD_BITS 64
+
+/**
+ * Binary image, one bit per pixel
+ */
+struct bitmask {
+    int width;
+    int height;
+    // Words per row
+    int words;
+    uint64_t *bits;
+};
+
+size_t bitmask_arena_size(int width, int height);
+void bitmask_init(struct bitmask *mask, int width, int height, struct arena *arena);
+void bitmask_clear(struct bitmask *mask);
+void bitmask_clear_span(uint64_t *row, int start, int end);
+void bitmask_set_span(uint64_t *row, int start, int end);
+void bitmask_pack_span(uint64_t *bits, const uchar *row, int start, int end);
+void bitmask_unpack(const struct bitmask *mask, uchar *dest, uchar value);
+
+/**
+ * Words of a row
+ *
+ * @param mask binary image
+ * @param j row
+ * @return first word of the row
+ */
+static inline uint64_t *bitmask_row(const struct bitmask *mask, int j) {
+    return mask->bits + (size_t) j * mask->words;
+}
+
+/**
+ * Reads a pixel
+ *
+ * @param mask binary image
+ * @param i column
+ * @param j row
+ * @return 1 if the pixel is set, 0 otherwise
+ */
+static inline int bitmask_get(const struct bitmask *mask, int i, int j) {
+    return (int) (bitmask_row(mask, j)[i / BITMASK_WORD_BITS] >> (i % BITMASK_WORD_BITS)) & 1;
+}
+
+/**
+ * First set pixel of a row at or after a given one
+ *
+ * @param row words of the row
+ * @param from first pixel to look at
+ * @param width width of the row
+ * @return column of the pixel, width if there is none
+ */
+static inline int bitmask_next_set(const uint64_t *row, int from, int width) {
+    int words = (width + BITMASK_WORD_BITS - 1) / BITMASK_WORD_BITS;
+    int w = from / BITMASK_WORD_BITS;
+    uint64_t word;
+
+    if (from >= width) {
+        return width;
+    }
+
+    for (word = row[w] & (UINT64_MAX << (from % BITMASK_WORD_BITS)); !word; word = row[w]) {
+        if (++w == words) {
+            return width;
+        }
+    }
+
+    return w * BITMASK_WORD_BITS + __builtin_ctzll(word);
+}
+
+/**
+ * First clear pixel of a row at or after a given one
+ *
+ * @param row words of the row
+ * @param from first pixel to look at
+ * @param width width of the row
+ * @return column of the pixel, width if there is none
+ */
+static inline int bitmask_next_clear(const uint64_t *row, int from, int width) {
+    int words = (width + BITMASK_WORD_BITS - 1) / BITMASK_WORD_BITS;
+    int w = from / BITMASK_WORD_BITS;
+    uint64_t word;
+
+    if (from >= width) {
+        return width;
+    }
+
+    for (word = ~row[w] & (UINT64_MAX << (from % BITMASK_WORD_BITS)); !word; word = ~row[w]) {
+        if (++w == words) {
+            return width;
+        }
+    }
+
+    // The clear bits past the end of the row end any run there
+    w = w * BITMASK_WORD_BITS + __builtin_ctzll(word);
+    return w < width ? w : width;
+}
+#endif //MOTION_DETECTOR_BITMASK_H
@@ -0,0 +1,518 @@
+/**
+ * Connected components of the motion image
+ *
+ * Labeling follows the run-based union-find scheme: each run of a row either joins the components of the runs of the
+ * previous row it touches or starts a new one, and a component is finished as soon as a row goes by without touching
+ * it. Components are recycled once finished, so a band only needs room for two rows of them.
+ */
+
+#include "blobs.h"
+
+/**
+ * Most runs a row of the image can hold, motion pixels every other pixel
+ */
+static int max_runs(int width) {
+    return (width + 1) / 2;
+}
+
+/**
+ * Most live components of a band, those of the previous row plus the ones started on the current row
+ */
+static int max_components(int width) {
+    return 2 * max_runs(width) + 1;
+}
+
+/**
+ * Arena space needed to label motion images
+ *
+ * @param width width of the motion images
+ * @param num_bands number of bands each image is labeled in
+ * @return size in bytes
+ */
+size_t blob_labeler_arena_size(int width, int num_bands) {
+    size_t runs = arena_size(sizeof(struct blob_run) * max_runs(width));
+    size_t components = arena_size(sizeof(struct blob_component) * max_components(width)) +
+                        2 * arena_size(sizeof(int) * max_components(width));
+    size_t seams = (size_t) num_bands * 2 * max_runs(width);
+
+    return arena_size(sizeof(struct blob_band) * num_bands) +
+           num_bands * (4 * runs + components + arena_size(sizeof(struct blob) * MAX_BLOBS)) +
+           arena_size(sizeof(int) * seams) + arena_size(sizeof(struct blob_stats) * seams) +
+           arena_size(sizeof(struct blob) * MAX_BLOBS);
+}
+
+/**
+ * Initializes connected components labeling
+ *
+ * @param labeler labeler to initialize
+ * @param width width of the motion images
+ * @param height height of the motion images
+ * @param num_bands number of bands each image is labeled in
+ * @param arena arena to allocate the labeler's buffers from
+ */
+void blob_labeler_init(struct blob_labeler *labeler, int width, int height, int num_bands, struct arena *arena) {
+    size_t seams = (size_t) num_bands * 2 * max_runs(width);
+
+    labeler->width = width;
+    labeler->height = height;
+    labeler->num_bands = num_bands;
+    labeler->bands = arena_alloc(arena, sizeof(struct blob_band) * num_bands);
+
+    for (int b = 0; b < num_bands; b++) {
+        struct blob_band *band = &labeler->bands[b];
+
+        band->prev_runs = arena_alloc(arena, sizeof(struct blob_run) * max_runs(width));
+        band->cur_runs = arena_alloc(arena, sizeof(struct blob_run) * max_runs(width));
+        band->top_runs = arena_alloc(arena, sizeof(struct blob_run) * max_runs(width));
+        band->bottom_runs = arena_alloc(arena, sizeof(struct blob_run) * max_runs(width));
+        band->components = arena_alloc(arena, sizeof(struct blob_component) * max_components(width));
+        band->free_components = arena_alloc(arena, sizeof(int) * max_components(width));
+        band->merged = arena_alloc(arena, sizeof(int) * max_components(width));
+        band->blobs = arena_alloc(arena, sizeof(struct blob) * MAX_BLOBS);
+        band->seam_base = b * 2 * max_runs(width);
+        band->num_seams = 0;
+        band->num_blobs = 0;
+        band->dropped = 0;
+    }
+
+    labeler->seam_parent = arena_alloc(arena, sizeof(int) * seams);
+    labeler->seam_stats = arena_alloc(arena, sizeof(struct blob_stats) * seams);
+    labeler->blobs = arena_alloc(arena, sizeof(struct blob) * MAX_BLOBS);
+    labeler->num_blobs = 0;
+    labeler->dropped = 0;
+}
+
+/**
+ * Resets component statistics
+ */
+static void stats_init(struct blob_stats *stats) {
+    stats->min_x = INT32_MAX;
+    stats->max_x = -1;
+    stats->min_y = INT32_MAX;
+    stats->max_y = -1;
+    stats->area = 0;
+    stats->sum_x = 0;
+    stats->sum_y = 0;
+}
+
+/**
+ * Adds a run of pixels start to end of row j to component statistics
+ */
+static void stats_add_run(struct blob_stats *stats, int start, int end, int j) {
+    int length = end - start + 1;
+
+    stats->min_x = start < stats->min_x ? start : stats->min_x;
+    stats->max_x = end > stats->max_x ? end : stats->max_x;
+    stats->min_y = j < stats->min_y ? j : stats->min_y;
+    stats->max_y = j > stats->max_y ? j : stats->max_y;
+    stats->area += length;
+    stats->sum_x += (int64_t) (start + end) * length / 2;
+    stats->sum_y += (int64_t) j * length;
+}
+
+/**
+ * Adds the statistics of one component to another's
+ */
+static void stats_merge(struct blob_stats *stats, const struct blob_stats *other) {
+    stats->min_x = other->min_x < stats->min_x ? other->min_x : stats->min_x;
+    stats->max_x = other->max_x > stats->max_x ? other->max_x : stats->max_x;
+    stats->min_y = other->min_y < stats->min_y ? other->min_y : stats->min_y;
+    stats->max_y = other->max_y > stats->max_y ? other->max_y : stats->max_y;
+    stats->area += other->area;
+    stats->sum_x += other->sum_x;
+    stats->sum_y += other->sum_y;
+}
+
+/**
+ * Reports a finished component as a blob if it is large enough
+ *
+ * @param stats statistics of the component
+ * @param blobs blobs found so far
+ * @param num_blobs number of blobs found so far, incremented
+ * @param dropped number of blobs dropped past MAX_BLOBS, incremented
+ */
+static void add_blob(const struct blob_stats *stats, struct blob *blobs, int *num_blobs, int *dropped) {
+    struct blob *blob;
+
+    if (stats->area < MIN_BLOB_AREA) {
+        return;
+    }
+
+    if (*num_blobs == MAX_BLOBS) {
+        (*dropped)++;
+        return;
+    }
+
+    blob = &blobs[(*num_blobs)++];
+    blob->x = stats->min_x;
+    blob->y = stats->min_y;
+    blob->w = stats->max_x - stats->min_x + 1;
+    blob->h = stats->max_y - stats->min_y + 1;
+    blob->area = stats->area;
+    blob->cx = (float) ((double) stats->sum_x / stats->area);
+    blob->cy = (float) ((double) stats->sum_y / stats->area);
+}
+
+/**
+ * Finds the root of a seam node, halving the path to it
+ */
+static int seam_find(int *parent, int n) {
+    while (parent[n] != n) {
+        parent[n] = parent[parent[n]];
+        n = parent[n];
+    }
+
+    return n;
+}
+
+/**
+ * Joins the components of two seam nodes
+ */
+static void seam_union(struct blob_labeler *labeler, int a, int b) {
+    a = seam_find(labeler->seam_parent, a);
+    b = seam_find(labeler->seam_parent, b);
+
+    if (a != b) {
+        labeler->seam_parent[b] = a;
+        stats_merge(&labeler->seam_stats[a], &labeler->seam_stats[b]);
+    }
+}
+
+/**
+ * Creates a seam node owned by a band
+ */
+static int new_seam(struct blob_labeler *labeler, struct blob_band *band) {
+    int n = band->seam_base + band->num_seams++;
+
+    labeler->seam_parent[n] = n;
+    stats_init(&labeler->seam_stats[n]);
+
+    return n;
+}
+
+/**
+ * Finds the root of a component, halving the path to it
+ */
+static int find_component(struct blob_component *components, int c) {
+    while (components[c].parent != c) {
+        components[c].parent = components[components[c].parent].parent;
+        c = components[c].parent;
+    }
+
+    return c;
+}
+
+/**
+ * Starts a component on row j
+ */
+static int new_component(struct blob_band *band, int j) {
+    int c = band->free_components[--band->num_free];
+    struct blob_component *component = &band->components[c];
+
+    component->parent = c;
+    component->seam = -1;
+    component->last_row = j;
+    stats_init(&component->stats);
+
+    return c;
+}
+
+/**
+ * Merges the component rooted at b into the one rooted at a
+ */
+static void union_components(struct blob_labeler *labeler, struct blob_band *band, int a, int b) {
+    struct blob_component *root = &band->components[a];
+    struct blob_component *child = &band->components[b];
+
+    child->parent = a;
+    stats_merge(&root->stats, &child->stats);
+
+    if (child->seam >= 0) {
+        if (root->seam >= 0) {
+            seam_union(labeler, root->seam, child->seam);
+        } else {
+            root->seam = child->seam;
+        }
+    }
+
+    band->merged[band->num_merged++] = b;
+}
+
+/**
+ * Reports a component that can not grow any further
+ *
+ * Components touching a seam are folded into their seam node and only reported once the seams are joined.
+ */
+static void finish_component(struct blob_labeler *labeler, struct blob_band *band, int c) {
+    struct blob_component *component = &band->components[c];
+
+    if (component->seam >= 0) {
+        stats_merge(&labeler->seam_stats[seam_find(labeler->seam_parent, component->seam)], &component->stats);
+    } else {
+        add_blob(&component->stats, band->blobs, &band->num_blobs, &band->dropped);
+    }
+
+    component->last_row = -1;
+}
+
+/**
+ * Finds the runs of motion pixels in a row
+ *
+ * Still pixels and then motion pixels are skipped a word of 64 pixels at a time.
+ *
+ * @param row bit-packed row of the motion image
+ * @param width width of the row
+ * @param runs runs found, in order
+ * @return number of runs
+ */
+static int find_runs(const uint64_t *row, int width, struct blob_run *runs) {
+    int num_runs = 0;
+
+    for (int i = bitmask_next_set(row, 0, width); i < width; i = bitmask_next_set(row, i, width)) {
+        runs[num_runs].start = i;
+        i = bitmask_next_clear(row, i, width);
+        runs[num_runs++].end = i - 1;
+    }
+
+    return num_runs;
+}
+
+/**
+ * Gets a band ready to label its rows of a new motion image
+ *
+ * @param labeler labeler
+ * @param band index of the band
+ * @param first_row first row of the band
+ * @param last_row row after the last row of the band
+ */
+void blob_labeler_begin_band(struct blob_labeler *labeler, int band, int first_row, int last_row) {
+    struct blob_band *state = &labeler->bands[band];
+
+    state->first_row = first_row;
+    state->last_row = last_row;
+    state->num_prev = 0;
+    state->num_cur = 0;
+    state->num_merged = 0;
+    state->num_top = 0;
+    state->num_bottom = 0;
+    state->num_seams = 0;
+    state->num_blobs = 0;
+    state->dropped = 0;
+    state->num_free = max_components(labeler->width);
+
+    for (int c = 0; c < state->num_free; c++) {
+        state->free_components[c] = c;
+    }
+}
+
+/**
+ * Labels the next row of a band
+ *
+ * Rows have to be added in order, from the first row of the band to its last.
+ *
+ * @param labeler labeler
+ * @param band index of the band
+ * @param j row of the motion image
+ * @param row bit-packed motion pixels of the row
+ */
+void blob_labeler_add_row(struct blob_labeler *labeler, int band, int j, const uint64_t *row) {
+    struct blob_band *state = &labeler->bands[band];
+    struct blob_component *components = state->components;
+    struct blob_run *prev = state->prev_runs;
+    struct blob_run *cur = state->cur_runs;
+    int num_prev = state->num_prev;
+    int num_cur = find_runs(row, labeler->width, cur);
+    // The first row of every band but the top one lies on a seam
+    int on_seam = j == state->first_row && j > 0;
+    int p = 0;
+
+    for (int r = 0; r < num_cur; r++) {
+        struct blob_run *run = &cur[r];
+        int label = -1;
+
+        // Skip the runs of the previous row that end before this one can touch them
+        while (p < num_prev && prev[p].end < run->start - 1) {
+            p++;
+        }
+
+        // Join every run of the previous row touching this one, diagonally included
+        for (int q = p; q < num_prev && prev[q].start <= run->end + 1; q++) {
+            int root = find_component(components, prev[q].label);
+
+            if (label < 0) {
+                label = root;
+            } else if (root != label) {
+                union_components(labeler, state, label, root);
+            }
+        }
+
+        if (label < 0) {
+            label = new_component(state, j);
+
+            if (on_seam) {
+                components[label].seam = new_seam(labeler, state);
+                state->top_runs[state->num_top].start = run->start;
+                state->top_runs[state->num_top].end = run->end;
+                state->top_runs[state->num_top++].label = components[label].seam;
+            }
+        }
+
+        stats_add_run(&components[label].stats, run->start, run->end, j);
+        run->label = label;
+    }
+
+    // Point every run of the row straight at its component
+    for (int r = 0; r < num_cur; r++) {
+        cur[r].label = find_component(components, cur[r].label);
+        components[cur[r].label].last_row = j;
+    }
+
+    // Components of the previous row that this row did not touch are finished
+    for (int q = 0; q < num_prev; q++) {
+        int c = find_component(components, prev[q].label);
+
+        if (components[c].last_row >= 0 && components[c].last_row < j) {
+            finish_component(labeler, state, c);
+            state->free_components[state->num_free++] = c;
+        }
+    }
+
+    // No run refers to the merged components any more
+    for (int m = 0; m < state->num_merged; m++) {
+        state->free_components[state->num_free++] = state->merged[m];
+    }
+
+    state->num_merged = 0;
+    state->prev_runs = cur;
+    state->cur_runs = prev;
+    state->num_prev = num_cur;
+}
+
+/**
+ * Finishes every component still open at the end of a band
+ *
+ * Those on the last row of the image are reported, the others are kept on the seam with the next band.
+ *
+ * @param labeler labeler
+ * @param band index of the band
+ */
+void blob_labeler_end_band(struct blob_labeler *labeler, int band) {
+    struct blob_band *state = &labeler->bands[band];
+    struct blob_component *components = state->components;
+    int on_seam = state->last_row < labeler->height;
+
+    for (int q = 0; q < state->num_prev; q++) {
+        struct blob_run *run = &state->prev_runs[q];
+        struct blob_component *component = &components[run->label];
+
+        if (component->last_row >= 0) {
+            if (on_seam && component->seam < 0) {
+                component->seam = new_seam(labeler, state);
+            }
+
+            finish_component(labeler, state, run->label);
+        }
+
+        if (on_seam) {
+            state->bottom_runs[state->num_bottom].start = run->start;
+            state->bottom_runs[state->num_bottom].end = run->end;
+            state->bottom_runs[state->num_bottom++].label = component->seam;
+        }
+    }
+}
+
+/**
+ * Checks if a blob comes before another, by the top then the left of their bounding boxes, then by area and size
+ */
+static int blob_before(const struct blob *a, const struct blob *b) {
+    if (a->y != b->y) {
+        return a->y < b->y;
+    } else if (a->x != b->x) {
+        return a->x < b->x;
+    } else if (a->area != b->area) {
+        return a->area < b->area;
+    } else if (a->w != b->w) {
+        return a->w < b->w;
+    }
+
+    return a->h < b->h;
+}
+
+/**
+ * Sorts blobs in place, by insertion as they mostly come out finished row by row, close to sorted already
+ *
+ * @param blobs blobs to sort
+ * @param num_blobs number of blobs
+ */
+static void sort_blobs(struct blob *blobs, int num_blobs) {
+    for (int i = 1; i < num_blobs; i++) {
+        struct blob blob = blobs[i];
+        int k = i;
+
+        while (k > 0 && blob_before(&blob, &blobs[k - 1])) {
+            blobs[k] = blobs[k - 1];
+            k--;
+        }
+
+        blobs[k] = blob;
+    }
+}
+
+/**
+ * Joins the components cut by band seams and gathers the blobs of every band
+ *
+ * Called once every band has been labeled, leaves the blobs of the image in labeler->blobs. Blobs come out of each
+ * band in the order they were finished and the seam blobs come last, so they are sorted by position to keep the order,
+ * and the track IDs the tracker hands out in that order, the same whatever the number of bands.
+ *
+ * @param labeler labeler
+ */
+void blob_labeler_finish(struct blob_labeler *labeler) {
+    labeler->num_blobs = 0;
+    labeler->dropped = 0;
+
+    // Join the last row of each band with the first row of the next
+    for (int b = 1; b < labeler->num_bands; b++) {
+        const struct blob_band *above = &labeler->bands[b - 1];
+        const struct blob_band *below = &labeler->bands[b];
+        int p = 0;
+
+        for (int r = 0; r < below->num_top; r++) {
+            const struct blob_run *run = &below->top_runs[r];
+
+            while (p < above->num_bottom && above->bottom_runs[p].end < run->start - 1) {
+                p++;
+            }
+
+            for (int q = p; q < above->num_bottom && above->bottom_runs[q].start <= run->end + 1; q++) {
+                seam_union(labeler, above->bottom_runs[q].label, run->label);
+            }
+        }
+    }
+
+    for (int b = 0; b < labeler->num_bands; b++) {
+        const struct blob_band *band = &labeler->bands[b];
+
+        for (int k = 0; k < band->num_blobs; k++) {
+            if (labeler->num_blobs == MAX_BLOBS) {
+                labeler->dropped++;
+            } else {
+                labeler->blobs[labeler->num_blobs++] = band->blobs[k];
+            }
+        }
+
+        labeler->dropped += band->dropped;
+    }
+
+    for (int b = 0; b < labeler->num_bands; b++) {
+        const struct blob_band *band = &labeler->bands[b];
+
+        for (int n = band->seam_base; n < band->seam_base + band->num_seams; n++) {
+            if (labeler->seam_parent[n] == n) {
+                add_blob(&labeler->seam_stats[n], labeler->blobs, &labeler->num_blobs, &labeler->dropped);
+            }
+        }
+    }
+
+    sort_blobs(labeler->blobs, labeler->num_blobs);
+}
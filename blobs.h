@@ -0,0 +1,135 @@
+/**
+ * Connected components of the motion image
+ *
+ * Motion pixels are labeled as each row of the motion image is produced, with a union-find over the runs of motion
+ * pixels in a row, so the image never has to be read again. Components are 8-connected and are reported as blobs once
+ * no pixel of the next row touches them, so only two rows of runs are ever kept.
+ *
+ * Each band of rows is labeled on its own, in parallel. The components cut by the seam between two bands are kept
+ * aside and joined once every band is done. Blobs are then sorted by position, so they are reported in the same order
+ * whatever the number of bands.
+ */
+
+#ifndef MOTION_DETECTOR_BLOBS_H
+#define MOTION_DETECTOR_BLOBS_H
+
+#include <stdint.h>
+#include "image_manipulation.h"
+#include "arena.h"
+#include "bitmask.h"
+
+// Most blobs reported for a frame, further ones are counted but dropped
+#define MAX_BLOBS 1024
+// Fewest motion pixels a component needs to be reported as a blob
+#define MIN_BLOB_AREA 100
+
+/**
+ * A connected component of motion pixels
+ */
+struct blob {
+    // Bounding box, in pixels of the motion image
+    int x;
+    int y;
+    int w;
+    int h;
+    // Number of motion pixels
+    int area;
+    // Centroid of the motion pixels
+    float cx;
+    float cy;
+};
+
+/**
+ * Statistics of a component, summed as its runs are labeled
+ */
+struct blob_stats {
+    int min_x;
+    int max_x;
+    int min_y;
+    int max_y;
+    int area;
+    int64_t sum_x;
+    int64_t sum_y;
+};
+
+/**
+ * Horizontal run of motion pixels
+ */
+struct blob_run {
+    int start;
+    // Last pixel of the run
+    int end;
+    // Component of the run, or seam node for the runs on the edges of a band
+    int label;
+};
+
+/**
+ * Union-find node of a component that may still grow
+ */
+struct blob_component {
+    int parent;
+    // Seam node of the component if it touches a band seam, -1 otherwise
+    int seam;
+    // Last row with a run of the component, -1 once the component has been reported
+    int last_row;
+    struct blob_stats stats;
+};
+
+/**
+ * Labeling state of a band of rows
+ */
+struct blob_band {
+    int first_row;
+    // Row after the last row of the band
+    int last_row;
+    // Runs of the previous and of the current row
+    struct blob_run *prev_runs;
+    struct blob_run *cur_runs;
+    int num_prev;
+    int num_cur;
+    // Component pool, components are recycled through a free list once no run refers to them
+    struct blob_component *components;
+    int *free_components;
+    int num_free;
+    // Components merged into another one during the current row, freed once the row is done
+    int *merged;
+    int num_merged;
+    // Runs of the first and last rows of the band, labeled with their seam node
+    struct blob_run *top_runs;
+    int num_top;
+    struct blob_run *bottom_runs;
+    int num_bottom;
+    // Seam nodes owned by the band start at seam_base
+    int seam_base;
+    int num_seams;
+    // Blobs that do not touch a seam
+    struct blob *blobs;
+    int num_blobs;
+    int dropped;
+} __attribute__((aligned(ARENA_ALIGNMENT)));
+
+/**
+ * Connected components labeling of a motion image
+ */
+struct blob_labeler {
+    int width;
+    int height;
+    int num_bands;
+    struct blob_band *bands;
+    // Union-find over the components touching a seam, statistics kept on the roots. Each band owns a slice of it.
+    int *seam_parent;
+    struct blob_stats *seam_stats;
+    // Blobs of the last frame
+    struct blob *blobs;
+    int num_blobs;
+    // Blobs of the last frame dropped past MAX_BLOBS
+    int dropped;
+};
+
+size_t blob_labeler_arena_size(int width, int num_bands);
+void blob_labeler_init(struct blob_labeler *labeler, int width, int height, int num_bands, struct arena *arena);
+void blob_labeler_begin_band(struct blob_labeler *labeler, int band, int first_row, int last_row);
+void blob_labeler_add_row(struct blob_labeler *labeler, int band, int j, const uint64_t *row);
+void blob_labeler_end_band(struct blob_labeler *labeler, int band);
+void blob_labeler_finish(struct blob_labeler *labeler);
+#endif //MOTION_DETECTOR_BLOBS_H
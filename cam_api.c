@@ -123,11 +123,20 @@ void init_mmap(struct webcam_info * cam_info) {
         if (MAP_FAILED == cam_info->buffers[cam_info->num_of_buffers].start)
             exit(EXIT_FAILURE);
     }
+
+    cam_info->frames_in_flight = 0;
+    cam_info->max_in_flight = cam_info->num_of_buffers > MIN_QUEUED_BUFFERS ?
+                              cam_info->num_of_buffers - MIN_QUEUED_BUFFERS : 1;
+    cam_info->frames_captured = 0;
+    cam_info->frames_dropped = 0;
 }
 
 /**
  * Initializes video capture device
  *
+ * Requests cam_info->width x cam_info->height YUYV frames. The driver may pick a different size, so the negotiated
+ * size and row stride are written back to cam_info.
+ *
  * @param cam_info camera info structure
  */
 void init_device(struct webcam_info *cam_info) {
@@ -182,8 +191,8 @@ void init_device(struct webcam_info *cam_info) {
     CLEAR(fmt);
 
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width       = WIDTH;
-    fmt.fmt.pix.height      = HEIGHT;
+    fmt.fmt.pix.width       = cam_info->width;
+    fmt.fmt.pix.height      = cam_info->height;
     fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
     fmt.fmt.pix.field       = V4L2_FIELD_NONE;
 
@@ -191,6 +200,11 @@ void init_device(struct webcam_info *cam_info) {
         exit(-1);
     }
 
+    if (fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+        fprintf(stderr, "%s does not support YUYV\n", cam_info->dev_name);
+        exit(EXIT_FAILURE);
+    }
+
     /* Buggy driver paranoia. */
     min = fmt.fmt.pix.width * 2;
     if (fmt.fmt.pix.bytesperline < min)
@@ -199,6 +213,15 @@ void init_device(struct webcam_info *cam_info) {
     if (fmt.fmt.pix.sizeimage < min)
         fmt.fmt.pix.sizeimage = min;
 
+    if (fmt.fmt.pix.width != (__u32) cam_info->width || fmt.fmt.pix.height != (__u32) cam_info->height) {
+        fprintf(stderr, "%s does not support %dx%d, using %ux%u\n", cam_info->dev_name, cam_info->width,
+                cam_info->height, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    }
+
+    cam_info->width = (int) fmt.fmt.pix.width;
+    cam_info->height = (int) fmt.fmt.pix.height;
+    cam_info->bytesperline = (int) fmt.fmt.pix.bytesperline;
+
     init_mmap(cam_info);
 }
 
@@ -238,13 +261,24 @@ void stop_capturing(struct webcam_info *cam_info) {
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     if (-1 == ioctl(cam_info->fd, VIDIOC_STREAMOFF, &type))
         exit(-1);
+
+    // Stopping the stream takes every buffer back from both the driver and processing
+    for (int i = 0; i < cam_info->num_of_buffers; i++) {
+        cam_info->buffers[i].in_flight = 0;
+    }
+
+    cam_info->frames_in_flight = 0;
 }
 
 /**
  * Read a frame from the camera
  *
+ * The buffer stays dequeued so the driver cannot write into it while it is being processed. It must be given back
+ * with release_frame once processing is done with it. If processing already holds max_in_flight buffers, the frame is
+ * dropped and its buffer requeued straight away.
+ *
  * @param cam_info camera info structure
- * @return error
+ * @return index of the buffer holding the frame, -1 if there is no frame to process
  */
 int read_frame(struct webcam_info *cam_info) {
     struct v4l2_buffer buf;
@@ -256,7 +290,7 @@ int read_frame(struct webcam_info *cam_info) {
     if (-1 == ioctl(cam_info->fd, VIDIOC_DQBUF, &buf)) {
         switch (errno) {
             case EAGAIN:
-                return 0;
+                return -1;
 
             case EIO:
                 /* Could ignore EIO, see spec. */
@@ -269,18 +303,58 @@ int read_frame(struct webcam_info *cam_info) {
     }
 
     assert(buf.index < cam_info->num_of_buffers);
+    cam_info->frames_captured++;
 
-    if (-1 == ioctl(cam_info->fd, VIDIOC_QBUF, &buf))
-        exit(EXIT_FAILURE);
+    // Processing has fallen behind, requeue the new frame instead of recycling a buffer that is still being read
+    if (__atomic_load_n(&cam_info->frames_in_flight, __ATOMIC_ACQUIRE) >= cam_info->max_in_flight) {
+        cam_info->frames_dropped++;
+
+        if (-1 == xioctl(cam_info->fd, VIDIOC_QBUF, &buf))
+            exit(EXIT_FAILURE);
+
+        return -1;
+    }
+
+    cam_info->buffers[buf.index].in_flight = 1;
+    __atomic_add_fetch(&cam_info->frames_in_flight, 1, __ATOMIC_ACQ_REL);
 
     return buf.index;
 }
 
+/**
+ * Gives a buffer returned by get_next_frame back to the driver once processing is done with it
+ *
+ * @param cam_info camera info structure
+ * @param index index of the buffer
+ */
+void release_frame(struct webcam_info *cam_info, int index) {
+    struct v4l2_buffer buf;
+
+    assert(index >= 0 && index < cam_info->num_of_buffers);
+
+    if (!cam_info->buffers[index].in_flight) {
+        fprintf(stderr, "Buffer %d released while not in flight\n", index);
+        return;
+    }
+
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+
+    cam_info->buffers[index].in_flight = 0;
+
+    if (-1 == xioctl(cam_info->fd, VIDIOC_QBUF, &buf))
+        exit(EXIT_FAILURE);
+
+    __atomic_sub_fetch(&cam_info->frames_in_flight, 1, __ATOMIC_ACQ_REL);
+}
+
 /**
  * Gets the next frame from the video
  *
  * @param cam_info camera info structure
- * @return
+ * @return index of the buffer holding the frame, -1 if there is no frame to process
  */
 int get_next_frame(struct webcam_info *cam_info) {
     fd_set fds;
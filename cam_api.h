@@ -2,17 +2,20 @@
 
 #ifndef MOTION_DETECTOR_CAM_API_H
 #define MOTION_DETECTOR_CAM_API_H
-#define WIDTH 320
-#define HEIGHT 240
 
 #include <sys/types.h>
 
+// Buffers always left queued with the driver so it can keep capturing while frames are being processed
+#define MIN_QUEUED_BUFFERS 2
+
 /**
  * A struct for storing frame data
  */
 struct buffer {
     void   *start;
     size_t  length;
+    // Set while the buffer is dequeued and owned by processing
+    int in_flight;
 };
 
 /**
@@ -23,6 +26,19 @@ struct webcam_info {
     int fd;
     struct buffer *buffers;
     int num_of_buffers;
+    // Requested resolution before init_device, resolution negotiated with the driver after
+    int width;
+    int height;
+    // Bytes between the start of two rows of a frame
+    int bytesperline;
+    // Buffers handed to processing and not yet released, updated from both the capture and processing threads
+    int frames_in_flight;
+    // Most buffers processing may hold at once
+    int max_in_flight;
+    // Frames dequeued from the driver
+    unsigned long frames_captured;
+    // Frames handed straight back to the driver because processing was holding max_in_flight buffers
+    unsigned long frames_dropped;
 };
 
 
@@ -35,4 +51,5 @@ void close_device(struct webcam_info *);
 void deallocate_buffers(struct webcam_info *);
 int read_frame(struct webcam_info *);
 int get_next_frame(struct webcam_info *);
+void release_frame(struct webcam_info *, int);
 #endif //MOTION_DETECTOR_CAM_API_H
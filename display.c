@@ -0,0 +1,185 @@
+/**
+ * SDL display of the motion detector's output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "display.h"
+
+/**
+ * Opens the display window
+ *
+ * @param display display to initialize
+ * @param width width of the frames
+ * @param height height of the frames
+ */
+void display_init(struct display *display, int width, int height) {
+    display->width = width;
+    display->height = height;
+    display->pitch = width * 2;
+    display->buffer = malloc((size_t) display->pitch * height);
+    display->current_frame = malloc((size_t) width * height * 3);
+    display->view = WEBCAM;
+    display->change_window = 0;
+
+    // Start SDL
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        fprintf(stderr, "Unable to initialize SDL: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    // Create SDL Window and Render, at twice the size of the frames
+    display->win = SDL_CreateWindow("Motion Detector", 0, 0, width * DISPLAY_SCALE, height * DISPLAY_SCALE, 0);
+    display->renderer = SDL_CreateRenderer(display->win, -1, SDL_RENDERER_ACCELERATED);
+    display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_YUY2, SDL_TEXTUREACCESS_STREAMING, width,
+                                         height);
+}
+
+/**
+ * Closes the display window
+ *
+ * @param display display to free
+ */
+void display_free(struct display *display) {
+    SDL_DestroyTexture(display->texture);
+    SDL_DestroyRenderer(display->renderer);
+    SDL_DestroyWindow(display->win);
+    SDL_Quit();
+    free(display->current_frame);
+    free(display->buffer);
+}
+
+/**
+ * Handles every pending window event without blocking
+ *
+ * @param display display
+ * @return 0 once the user has closed the window, 1 otherwise
+ */
+int display_poll_events(struct display *display) {
+    SDL_Event e;
+    int running = 1;
+
+    while (SDL_PollEvent(&e)) {
+        switch (e.type) {
+            case SDL_QUIT:
+                running = 0;
+                break;
+            case SDL_KEYDOWN:
+                // On keypress
+                switch (e.key.keysym.sym) {
+                    case SDLK_v:
+                        display->view = (display->view + 1) % 4;
+                        display->change_window = 1;
+                        break;
+                    case SDLK_c:
+                        display->view = COLOR_MAP;
+                        display->change_window = 1;
+                }
+                break;
+        }
+    }
+
+    return running;
+}
+
+/**
+ * Draws the current view of a processed frame
+ *
+ * @param display display
+ * @param pipeline pipeline that processed the frame
+ * @param raw_frame YUYV frame from the camera
+ * @param stride bytes between the start of two rows of raw_frame
+ */
+void display_show(struct display *display, const struct pipeline *pipeline, const uchar *raw_frame, int stride) {
+    int width = display->width;
+    int height = display->height;
+    uchar *display_buffer = display->buffer;
+    SDL_Rect rect;
+
+    // Display current view
+    switch (display->view) {
+        case MOTION_OUTPUT:
+            // Motion image output
+            snprintf(display->window_name, 40, "Motion Detector: Motion Image");
+            // The color map scratch frame holds the unpacked motion image
+            bitmask_unpack(&pipeline->motion_image, display->current_frame, MOTION_PIXEL);
+            gray_to_yuyv(display->current_frame, display_buffer, width, height);
+            break;
+        case BG_MODEL:
+            // Background model view
+            snprintf(display->window_name, 40, "Motion Detector: Background Model");
+            // Read a row at a time from whatever storage the model uses, the color map scratch frame holds the row
+            for (int j = 0; j < height; j++) {
+                uchar *row[3] = {display->current_frame, display->current_frame + width,
+                                 display->current_frame + 2 * width};
+
+                motion_engine_background_row(&pipeline->engine, j, row);
+                yuv_rows_to_yuyv((const uchar *const *) row, display_buffer + (size_t) j * display->pitch, width);
+            }
+            break;
+        default:
+        case WEBCAM:
+            // Video from webcam
+            snprintf(display->window_name, 40, "Motion Detector");
+            // Camera rows may be padded past the end of the image
+            for (int j = 0; j < height; j++) {
+                memcpy(display_buffer + (size_t) j * display->pitch, raw_frame + (size_t) j * stride, display->pitch);
+            }
+            break;
+        case MOTION_MASK:
+            // Motion mask view
+            snprintf(display->window_name, 40, "Motion Detector: Motion Mask");
+            for (int i = 0; i < width; i++) {
+                for (int j = 0; j < height; j++) {
+                    uchar pixel_val[3];
+                    uchar mask_value = *(pipeline->engine.mask + i + j * width) * 255;
+                    pixel_val[0] = mask_value;
+                    pixel_val[1] = 127;
+                    pixel_val[2] = 127;
+
+                    yuyv_set_pixel_value(display_buffer, i, j, width, pixel_val);
+                }
+            }
+            break;
+        case COLOR_MAP:
+            //Debug color ma
+            snprintf(display->window_name, 40, "Motion Detector: YUYV Color Space");
+            for (int i = 0; i < width; i++) {
+                for (int j = 0; j < height; j++) {
+                    uchar pixel_val[3];
+                    pixel_val[0] = 0;
+                    pixel_val[1] = (i / (float) (width)) * 255;
+                    pixel_val[2] = 255 - (j / (float) height) * 255;
+
+                    yuv_set_pixel_value(display->current_frame, i, j, width, pixel_val);
+                }
+            }
+            yuv_to_yuyv(display->current_frame, display_buffer, width, height);
+    }
+
+    // Update SDL window with output current_frame
+    SDL_UpdateTexture(display->texture, NULL, display_buffer, display->pitch);
+    // Copy texture to render
+    SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+    // Draw a rectangle around each blob, scaled up to the window
+    SDL_SetRenderDrawColor(display->renderer, 0, 255, 0, SDL_ALPHA_OPAQUE);
+    for (int k = 0; k < pipeline->labeler.num_blobs; k++) {
+        const struct blob *blob = &pipeline->labeler.blobs[k];
+
+        rect.x = blob->x * DISPLAY_SCALE;
+        rect.y = blob->y * DISPLAY_SCALE;
+        rect.w = blob->w * DISPLAY_SCALE;
+        rect.h = blob->h * DISPLAY_SCALE;
+        SDL_RenderDrawRect(display->renderer, &rect);
+    }
+
+    // Update display
+    SDL_RenderPresent(display->renderer);
+
+    if (display->change_window) {
+        // update window title
+        SDL_SetWindowTitle(display->win, display->window_name);
+        display->change_window = 0;
+    }
+}
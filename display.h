@@ -0,0 +1,48 @@
+/**
+ * SDL display of the motion detector's output
+ *
+ * An optional consumer of processed frames. It shows the camera, the motion image or the detector's internal state
+ * with a box drawn around each blob of motion.
+ */
+
+#ifndef MOTION_DETECTOR_DISPLAY_H
+#define MOTION_DETECTOR_DISPLAY_H
+
+#include <SDL2/SDL.h>
+#include "pipeline.h"
+
+// Most milliseconds to wait for a frame before handling window events
+#define DISPLAY_POLL_MS 10
+
+// Size of the window relative to the frames
+#define DISPLAY_SCALE 2
+
+// Application views
+enum view {
+    WEBCAM, MOTION_OUTPUT, BG_MODEL, MOTION_MASK, COLOR_MAP
+};
+
+/**
+ * Window, renderer and buffers of the display
+ */
+struct display {
+    int width;
+    int height;
+    SDL_Window *win;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    // YUYV image uploaded to the texture, pitch bytes per row
+    uchar *buffer;
+    int pitch;
+    // Scratch YUV frame for the color map view
+    uchar *current_frame;
+    enum view view;
+    char window_name[50];
+    int change_window;
+};
+
+void display_init(struct display *display, int width, int height);
+void display_free(struct display *display);
+int display_poll_events(struct display *display);
+void display_show(struct display *display, const struct pipeline *pipeline, const uchar *raw_frame, int stride);
+#endif //MOTION_DETECTOR_DISPLAY_H
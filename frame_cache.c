@@ -0,0 +1,223 @@
+/**
+ * Raw frame cache
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frame_cache.h"
+
+// Frames start on a page of their own
+#define FRAME_CACHE_ALIGNMENT 4096
+
+/**
+ * Rounds a file offset up to the start of the next page
+ */
+static size_t page_align(size_t offset) {
+    return (offset + FRAME_CACHE_ALIGNMENT - 1) / FRAME_CACHE_ALIGNMENT * FRAME_CACHE_ALIGNMENT;
+}
+
+/**
+ * Reports a cache file that can not be used and exits
+ *
+ * @param path path of the file
+ * @param message what is wrong with it
+ */
+static void frame_cache_error(const char *path, const char *message) {
+    fprintf(stderr, "Bad frame cache %s: %s\n", path, message);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Maps a cache file
+ *
+ * @param cache cache to map the file into
+ * @param path path of the file
+ * @param fd open file
+ * @param size size of the file
+ * @param writable 1 to map it for writing, 0 to map it read only
+ */
+static void map_file(struct frame_cache *cache, const char *path, int fd, size_t size, int writable) {
+    void *map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map frame cache %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    cache->map = map;
+    cache->map_size = size;
+    cache->writable = writable;
+}
+
+/**
+ * Creates a cache file sized for a sequence of frames, to be filled through frame_cache_frame()
+ *
+ * The file only becomes a valid cache once frame_cache_close() is called.
+ *
+ * @param cache cache to create
+ * @param path path of the file, replaced if it exists
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param first_frame number of the first frame
+ * @param num_frames number of frames
+ * @param source files the frames are decoded from
+ */
+void frame_cache_create(struct frame_cache *cache, const char *path, int width, int height, int first_frame,
+                        int num_frames, const struct frame_cache_source *source) {
+    struct frame_cache_header *header;
+    uint64_t *offsets;
+    size_t frame_size = (size_t) width * height * 3;
+    size_t first_offset = page_align(sizeof(*header) + sizeof(uint64_t) * num_frames);
+    size_t size = first_offset + page_align(frame_size) * num_frames;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0 || ftruncate(fd, (off_t) size)) {
+        fprintf(stderr, "Failed to create frame cache %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    map_file(cache, path, fd, size, 1);
+    close(fd);
+
+    header = (struct frame_cache_header *) cache->map;
+    header->version = FRAME_CACHE_VERSION;
+    header->width = width;
+    header->height = height;
+    header->bytes_per_pixel = 3;
+    header->first_frame = first_frame;
+    header->num_frames = num_frames;
+    header->frame_size = frame_size;
+    header->source = *source;
+
+    offsets = (uint64_t *) (header + 1);
+
+    for (int i = 0; i < num_frames; i++) {
+        offsets[i] = first_offset + page_align(frame_size) * i;
+    }
+
+    cache->width = width;
+    cache->height = height;
+    cache->first_frame = first_frame;
+    cache->num_frames = num_frames;
+    cache->source = *source;
+    cache->offsets = offsets;
+}
+
+/**
+ * Maps an existing cache file to read frames from
+ *
+ * The mapping is read ahead sequentially, the order frames are replayed in. A file that exists but is not a complete
+ * cache is reported and the process exits.
+ *
+ * @param cache cache to open
+ * @param path path of the file
+ * @return 1 if the cache was opened, 0 if there is no such file
+ */
+int frame_cache_open(struct frame_cache *cache, const char *path) {
+    const struct frame_cache_header *header;
+    struct stat file_stat;
+    size_t index_end;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+
+        fprintf(stderr, "Failed to open frame cache %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (fstat(fd, &file_stat) || (size_t) file_stat.st_size < sizeof(*header)) {
+        frame_cache_error(path, "too short for a header");
+    }
+
+    map_file(cache, path, fd, file_stat.st_size, 0);
+    close(fd);
+
+    header = (const struct frame_cache_header *) cache->map;
+    index_end = sizeof(*header) + sizeof(uint64_t) * (size_t) header->num_frames;
+
+    if (memcmp(header->magic, FRAME_CACHE_MAGIC, sizeof(header->magic)) != 0) {
+        frame_cache_error(path, "not a frame cache, or one that was not finished");
+    } else if (header->version != FRAME_CACHE_VERSION) {
+        frame_cache_error(path, "unsupported version");
+    } else if (header->bytes_per_pixel != 3 || header->width == 0 || header->height == 0 ||
+               header->frame_size != (uint64_t) header->width * header->height * 3) {
+        frame_cache_error(path, "frames are not YUV");
+    } else if (index_end > cache->map_size) {
+        frame_cache_error(path, "index runs past the end of the file");
+    }
+
+    cache->width = (int) header->width;
+    cache->height = (int) header->height;
+    cache->first_frame = (int) header->first_frame;
+    cache->num_frames = (int) header->num_frames;
+    cache->source = header->source;
+    cache->offsets = (const uint64_t *) (header + 1);
+
+    for (int i = 0; i < cache->num_frames; i++) {
+        if (cache->offsets[i] < index_end || cache->offsets[i] > cache->map_size ||
+            cache->map_size - cache->offsets[i] < header->frame_size) {
+            frame_cache_error(path, "frame runs past the end of the file");
+        }
+    }
+
+    madvise(cache->map, cache->map_size, MADV_SEQUENTIAL);
+
+    return 1;
+}
+
+/**
+ * Frame held by a cache
+ *
+ * @param cache cache
+ * @param frame number of the frame
+ * @return the frame, 3 bytes per pixel, read only unless the cache is being created, NULL if the cache does not hold
+ *         the frame
+ */
+uchar *frame_cache_frame(const struct frame_cache *cache, int frame) {
+    if (frame < cache->first_frame || frame - cache->first_frame >= cache->num_frames) {
+        return NULL;
+    }
+
+    return cache->map + cache->offsets[frame - cache->first_frame];
+}
+
+/**
+ * Checks if a cache holds a range of frames
+ *
+ * @param cache cache
+ * @param first_frame first frame of the range
+ * @param end_frame frame after the last one of the range
+ * @return 1 if every frame of the range is held, 0 otherwise
+ */
+int frame_cache_holds(const struct frame_cache *cache, int first_frame, int end_frame) {
+    return first_frame >= cache->first_frame && end_frame <= cache->first_frame + cache->num_frames;
+}
+
+/**
+ * Unmaps a cache, marking a cache being created as complete first
+ *
+ * @param cache cache to close
+ */
+void frame_cache_close(struct frame_cache *cache) {
+    if (cache->writable) {
+        memcpy(((struct frame_cache_header *) cache->map)->magic, FRAME_CACHE_MAGIC,
+               sizeof(((struct frame_cache_header *) cache->map)->magic));
+
+        if (msync(cache->map, cache->map_size, MS_SYNC)) {
+            fprintf(stderr, "Failed to write frame cache: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    munmap(cache->map, cache->map_size);
+    cache->map = NULL;
+}
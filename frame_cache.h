@@ -0,0 +1,70 @@
+/**
+ * Raw frame cache
+ *
+ * A sequence of decoded YUV frames packed into a single file, so replaying a data set again maps the frames instead of
+ * decoding them. The file starts with a header and an index of where each frame starts, and every frame starts on a
+ * page of its own. The file is mapped whole and frames are handed out as pointers into the mapping. The header also
+ * records the files the frames were decoded from, so a cache left behind by input that has changed since can be told.
+ */
+
+#ifndef MOTION_DETECTOR_FRAME_CACHE_H
+#define MOTION_DETECTOR_FRAME_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "image_manipulation.h"
+
+// Written last, so a file left behind by a conversion that did not finish is never taken for a cache
+#define FRAME_CACHE_MAGIC "MDFRAMES"
+#define FRAME_CACHE_VERSION 2
+
+/**
+ * Files the frames of a cache were decoded from
+ */
+struct frame_cache_source {
+    // Newest modification time of the files, in nanoseconds since the epoch
+    uint64_t newest_mtime;
+    // Sum of the sizes of the files
+    uint64_t total_size;
+};
+
+/**
+ * Start of a cache file, followed by the offset of each frame as a uint64_t
+ */
+struct frame_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    // Bytes per pixel of every frame, 3 for YUV
+    uint32_t bytes_per_pixel;
+    // Number of the first frame held, and how many frames follow it
+    uint32_t first_frame;
+    uint32_t num_frames;
+    uint64_t frame_size;
+    struct frame_cache_source source;
+};
+
+/**
+ * Mapped cache file
+ */
+struct frame_cache {
+    int width;
+    int height;
+    int first_frame;
+    int num_frames;
+    struct frame_cache_source source;
+    // Whether the cache is being filled, and the header is written when it is closed
+    int writable;
+    uchar *map;
+    size_t map_size;
+    const uint64_t *offsets;
+};
+
+void frame_cache_create(struct frame_cache *cache, const char *path, int width, int height, int first_frame,
+                        int num_frames, const struct frame_cache_source *source);
+int frame_cache_open(struct frame_cache *cache, const char *path);
+uchar *frame_cache_frame(const struct frame_cache *cache, int frame);
+int frame_cache_holds(const struct frame_cache *cache, int first_frame, int end_frame);
+void frame_cache_close(struct frame_cache *cache);
+#endif //MOTION_DETECTOR_FRAME_CACHE_H
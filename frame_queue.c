@@ -0,0 +1,171 @@
+/**
+ * Lock-free single producer, single consumer queue of captured frames
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "frame_queue.h"
+
+/**
+ * Sleeps until *addr no longer holds value, the timeout expires or a wakeup is sent
+ *
+ * @param addr futex word
+ * @param value value *addr is expected to hold
+ * @param timeout_ms most milliseconds to sleep for, negative to sleep until woken
+ */
+static void futex_wait(unsigned int *addr, unsigned int value, int timeout_ms) {
+    struct timespec timeout;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long) (timeout_ms % 1000) * 1000000;
+
+    // Spurious wakeups and EINTR are fine, every caller rechecks the queue
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+/**
+ * Wakes the thread sleeping on a futex word
+ *
+ * @param addr futex word
+ */
+static void futex_wake(unsigned int *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Initializes an empty queue
+ *
+ * @param queue queue to initialize
+ */
+void frame_queue_init(struct frame_queue *queue) {
+    memset(queue, 0, sizeof(*queue));
+}
+
+/**
+ * Wakes the consumer if it is asleep
+ *
+ * @param queue queue
+ */
+static void wake_consumer(struct frame_queue *queue) {
+    __atomic_add_fetch(&queue->signal, 1, __ATOMIC_SEQ_CST);
+
+    // Sequentially consistent with the consumer setting waiting and then rechecking the queue, so either the consumer
+    // sees the update or we see it waiting
+    if (__atomic_load_n(&queue->waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(&queue->signal);
+    }
+}
+
+/**
+ * Adds a frame to the queue, called from the producer thread only
+ *
+ * @param queue queue
+ * @param frame frame to add
+ * @return 1 if the frame was queued, 0 if the queue is full
+ */
+int frame_queue_push(struct frame_queue *queue, const struct frame_desc *frame) {
+    unsigned int head = queue->head;
+
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) >= FRAME_QUEUE_SIZE) {
+        return 0;
+    }
+
+    queue->slots[head % FRAME_QUEUE_SIZE] = *frame;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_SEQ_CST);
+    wake_consumer(queue);
+
+    return 1;
+}
+
+/**
+ * Marks the end of the stream, called from the producer thread once it has pushed its last frame
+ *
+ * @param queue queue
+ */
+void frame_queue_close(struct frame_queue *queue) {
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    wake_consumer(queue);
+}
+
+/**
+ * Checks whether the producer has closed the queue
+ *
+ * @param queue queue
+ * @return 1 if no more frames will be pushed
+ */
+int frame_queue_is_closed(struct frame_queue *queue) {
+    return __atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Waits for a frame to be queued, called from the consumer thread only
+ *
+ * @param queue queue
+ * @param timeout_ms most milliseconds to wait for, negative to wait until a frame arrives or the queue is closed
+ * @return 1 if a frame is queued, 0 on timeout or if the queue is closed and empty
+ */
+int frame_queue_wait(struct frame_queue *queue, int timeout_ms) {
+    unsigned int tail = queue->tail;
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    unsigned int signal;
+
+    if (head != tail) {
+        return 1;
+    }
+
+    if (frame_queue_is_closed(queue)) {
+        return 0;
+    }
+
+    // Anything the producer does after this point changes signal, so the futex wait below returns straight away
+    signal = __atomic_load_n(&queue->signal, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&queue->waiting, 1, __ATOMIC_SEQ_CST);
+
+    // Recheck after announcing the wait, a frame pushed before that would not have woken us
+    head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST);
+
+    if (head == tail && !frame_queue_is_closed(queue)) {
+        futex_wait(&queue->signal, signal, timeout_ms);
+        head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    }
+
+    __atomic_store_n(&queue->waiting, 0, __ATOMIC_RELAXED);
+
+    return head != tail;
+}
+
+/**
+ * Takes the newest queued frame, skipping every older one, called from the consumer thread only
+ *
+ * When processing falls behind there is no point working through a backlog of stale frames, so each frame that is
+ * skipped over is passed to drop_fn for its buffer to be given back.
+ *
+ * @param queue queue
+ * @param frame set to the newest frame
+ * @param drop_fn called for each frame skipped, may be NULL
+ * @param context context passed to drop_fn
+ * @return 1 if a frame was taken, 0 if the queue is empty
+ */
+int frame_queue_pop_latest(struct frame_queue *queue, struct frame_desc *frame, frame_drop_fn drop_fn, void *context) {
+    unsigned int tail = queue->tail;
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return 0;
+    }
+
+    for (; tail + 1 != head; tail++) {
+        if (drop_fn) {
+            drop_fn(context, &queue->slots[tail % FRAME_QUEUE_SIZE]);
+        }
+        queue->skipped++;
+    }
+
+    *frame = queue->slots[tail % FRAME_QUEUE_SIZE];
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
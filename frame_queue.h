@@ -0,0 +1,60 @@
+/**
+ * Lock-free single producer, single consumer queue of captured frames
+ *
+ * Hands frame buffers from the capture thread to the processing loop. Pushing and popping never take a lock. A
+ * consumer with nothing to do sleeps on a futex instead of spinning, and only pays for the wakeup syscall when it is
+ * actually asleep.
+ */
+
+#ifndef MOTION_DETECTOR_FRAME_QUEUE_H
+#define MOTION_DETECTOR_FRAME_QUEUE_H
+
+// Number of slots in the queue, a power of two at least as large as the number of capture buffers
+#define FRAME_QUEUE_SIZE 32
+
+/**
+ * A captured frame waiting to be processed
+ */
+struct frame_desc {
+    // Index of the capture buffer holding the frame
+    int index;
+    // Position of the frame in the capture stream
+    unsigned long sequence;
+    // Capture time, in seconds since the epoch
+    double timestamp;
+};
+
+/**
+ * Called for each frame skipped over by frame_queue_pop_latest
+ *
+ * @param context context passed to frame_queue_pop_latest
+ * @param frame skipped frame
+ */
+typedef void (*frame_drop_fn)(void *context, const struct frame_desc *frame);
+
+/**
+ * Ring of frame descriptors, the producer and consumer ends kept on separate cache lines
+ */
+struct frame_queue {
+    struct frame_desc slots[FRAME_QUEUE_SIZE];
+    // Number of frames pushed, only written by the producer
+    unsigned int head __attribute__((aligned(64)));
+    // Set once the producer will push no more frames
+    int closed;
+    // Futex word the consumer sleeps on, bumped by the producer after every push and on close
+    unsigned int signal;
+    // Number of frames popped, only written by the consumer
+    unsigned int tail __attribute__((aligned(64)));
+    // Set while the consumer is asleep, or about to be, waiting for head to move
+    int waiting;
+    // Frames skipped by the consumer to get to the latest one
+    unsigned long skipped;
+};
+
+void frame_queue_init(struct frame_queue *queue);
+int frame_queue_push(struct frame_queue *queue, const struct frame_desc *frame);
+void frame_queue_close(struct frame_queue *queue);
+int frame_queue_wait(struct frame_queue *queue, int timeout_ms);
+int frame_queue_pop_latest(struct frame_queue *queue, struct frame_desc *frame, frame_drop_fn drop_fn, void *context);
+int frame_queue_is_closed(struct frame_queue *queue);
+#endif //MOTION_DETECTOR_FRAME_QUEUE_H
@@ -2,8 +2,28 @@
 // Created by joey on 4/13/20.
 //
 
+#include <string.h>
 #include "image_manipulation.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+// Fixed point RGB to YCbCr coefficients and rounding of libjpeg's JFIF conversion, scaled by 2^16
+#define RGB_SCALE_BITS 16
+#define Y_R 19595
+#define Y_G 38470
+#define Y_B 7471
+#define CB_R -11059
+#define CB_G -21709
+#define CR_G -27439
+#define CR_B -5329
+// B in Cb and R in Cr are weighted by a half
+#define CHROMA_HALF 32768
+#define Y_ROUND (1 << (RGB_SCALE_BITS - 1))
+#define CHROMA_ROUND ((128 << RGB_SCALE_BITS) + (1 << (RGB_SCALE_BITS - 1)) - 1)
+
 /**
  * Gets a pixel Column i and Row j of a YUYV image
  * @param image the YUYV image to access
@@ -195,4 +215,124 @@ void bg_model_to_yuyv(const float *src, uchar *dest, int src_width, int src_heig
             *(dest + dest_i + 3 + j * src_width * 2) = (v1 + v2) / 2;
         }
     }
-}
\ No newline at end of file
+}
+/**
+ * Converts a single channel image to a grey YUYV image
+ * @param src single channel image
+ * @param dest output YUYV image
+ * @param src_width width of the src image
+ * @param src_height height of the src image
+ */
+void gray_to_yuyv(const uchar *src, uchar *dest, int src_width, int src_height) {
+    for (int j = 0; j < src_height; j++) {
+        const uchar *src_row = src + j * src_width;
+        uchar *dest_row = dest + j * src_width * 2;
+
+        for (int i = 0; i < src_width; i++) {
+            dest_row[i * 2] = src_row[i];
+            dest_row[i * 2 + 1] = 127;
+        }
+    }
+}
+
+/**
+ * Converts one row of separate Y, U and V values to a YUYV row
+ * @param src Y, U and V rows
+ * @param dest output YUYV row
+ * @param width width of the row
+ */
+void yuv_rows_to_yuyv(const uchar *const *src, uchar *dest, int width) {
+    const uchar *y = src[0];
+    const uchar *u = src[1];
+    const uchar *v = src[2];
+
+    for (int i = 0; i < width; i += 2) {
+        dest[i * 2] = y[i];
+        dest[i * 2 + 2] = y[i + 1];
+        dest[i * 2 + 1] = (u[i] + u[i + 1]) / 2;
+        dest[i * 2 + 3] = (v[i] + v[i + 1]) / 2;
+    }
+}
+
+/**
+ * Converts one RGB pixel to YCbCr
+ * @param src R, G and B values
+ * @param dest Y, U and V values, may be src
+ */
+static void rgb_to_yuv_pixel(const uchar *src, uchar *dest) {
+    int r = src[0];
+    int g = src[1];
+    int b = src[2];
+
+    dest[0] = (uchar) ((Y_R * r + Y_G * g + Y_B * b + Y_ROUND) >> RGB_SCALE_BITS);
+    dest[1] = (uchar) ((CB_R * r + CB_G * g + CHROMA_HALF * b + CHROMA_ROUND) >> RGB_SCALE_BITS);
+    dest[2] = (uchar) ((CHROMA_HALF * r + CR_G * g + CR_B * b + CHROMA_ROUND) >> RGB_SCALE_BITS);
+}
+
+#ifdef HAVE_X86_KERNELS
+// Two 16 bit weights for a multiply-add, the first for the low half of each 32 bit lane
+#define WEIGHT_PAIR(low, high) _mm_set1_epi32((int) ((unsigned) (high) << 16 | ((unsigned) (low) & 0xffff)))
+
+/**
+ * Converts four RGB pixels to YCbCr
+ *
+ * Each pixel is spread over a 32 bit lane, once as R and B in its 16 bit halves and once as G alone, so every product
+ * is a multiply-add of 16 bit values. The weights that do not fit in 16 bits are applied in two halves.
+ *
+ * @param src 16 bytes starting at the first pixel
+ * @param dest 12 bytes to store the Y, U and V values in, may overlap src
+ */
+__attribute__((target("sse2")))
+static void rgb_to_yuv_sse2(const uchar *src, uchar *dest) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *) src);
+    __m128i pixels = _mm_unpacklo_epi64(_mm_unpacklo_epi32(bytes, _mm_srli_si128(bytes, 3)),
+                                        _mm_unpacklo_epi32(_mm_srli_si128(bytes, 6), _mm_srli_si128(bytes, 9)));
+    __m128i rb = _mm_and_si128(pixels, _mm_set1_epi32(0x00ff00ff));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8), _mm_set1_epi32(0xff));
+    __m128i y, u, v, yuv, pairs;
+    int last;
+
+    y = _mm_add_epi32(_mm_madd_epi16(rb, WEIGHT_PAIR(Y_R, Y_B)),
+                      _mm_slli_epi32(_mm_madd_epi16(g, WEIGHT_PAIR(Y_G / 2, 0)), 1));
+    u = _mm_add_epi32(_mm_madd_epi16(rb, WEIGHT_PAIR(CB_R, CHROMA_HALF / 2)),
+                      _mm_madd_epi16(rb, WEIGHT_PAIR(0, CHROMA_HALF / 2)));
+    u = _mm_add_epi32(u, _mm_madd_epi16(g, WEIGHT_PAIR(CB_G, 0)));
+    v = _mm_add_epi32(_mm_madd_epi16(rb, WEIGHT_PAIR(CHROMA_HALF / 2, CR_B)),
+                      _mm_madd_epi16(rb, WEIGHT_PAIR(CHROMA_HALF / 2, 0)));
+    v = _mm_add_epi32(v, _mm_madd_epi16(g, WEIGHT_PAIR(CR_G, 0)));
+
+    y = _mm_srli_epi32(_mm_add_epi32(y, _mm_set1_epi32(Y_ROUND)), RGB_SCALE_BITS);
+    u = _mm_srli_epi32(_mm_add_epi32(u, _mm_set1_epi32(CHROMA_ROUND)), RGB_SCALE_BITS);
+    v = _mm_srli_epi32(_mm_add_epi32(v, _mm_set1_epi32(CHROMA_ROUND)), RGB_SCALE_BITS);
+
+    // Three bytes in each lane, packed into 6 byte pairs of lanes and then into 12 bytes
+    yuv = _mm_or_si128(y, _mm_or_si128(_mm_slli_epi32(u, 8), _mm_slli_epi32(v, 16)));
+    pairs = _mm_or_si128(_mm_and_si128(yuv, _mm_set_epi32(0, -1, 0, -1)), _mm_slli_epi64(_mm_srli_epi64(yuv, 32), 24));
+    pairs = _mm_or_si128(_mm_move_epi64(pairs), _mm_slli_si128(_mm_srli_si128(pairs, 8), 6));
+
+    _mm_storel_epi64((__m128i *) dest, pairs);
+    last = _mm_cvtsi128_si32(_mm_srli_si128(pairs, 8));
+    memcpy(dest + 8, &last, sizeof(last));
+}
+#endif
+
+/**
+ * Converts one row of RGB pixels to YUV, with the coefficients and rounding libjpeg uses for the YCbCr of JFIF files
+ * @param src RGB row
+ * @param dest output YUV row, may be src
+ * @param width width of the row
+ */
+void rgb_to_yuv_row(const uchar *src, uchar *dest, int width) {
+    int i = 0;
+
+#ifdef HAVE_X86_KERNELS
+    // The 16 byte load reaches into the pixel after the four converted
+    for (; i + 6 <= width; i += 4) {
+        rgb_to_yuv_sse2(src + i * 3, dest + i * 3);
+    }
+#endif
+
+    for (; i < width; i++) {
+        rgb_to_yuv_pixel(src + i * 3, dest + i * 3);
+    }
+}
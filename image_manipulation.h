@@ -15,4 +15,7 @@ void bg_model_set_pixel_value(float *image, int i, int j, int width, const float
 void yuyv_to_yuv(const uchar *src, uchar *dest, int width, int height);
 void yuv_to_yuyv(const uchar *src, uchar *dest, int src_width, int src_height);
 void bg_model_to_yuyv(const float *src, uchar *dest, int src_width, int src_height);
+void gray_to_yuyv(const uchar *src, uchar *dest, int src_width, int src_height);
+void yuv_rows_to_yuyv(const uchar *const *src, uchar *dest, int width);
+void rgb_to_yuv_row(const uchar *src, uchar *dest, int width);
 #endif //MOTION_DETECTOR_IMAGE_MANIPULATION_H
@@ -1,8 +1,17 @@
 #include "libattopng.h"
 #include <stdlib.h>
 #include <string.h>
+#ifdef LIBATTOPNG_ZLIB
+#include <zlib.h>
+#endif
 
 #define LIBATTOPNG_ADLER_BASE 65521
+/* largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits, so sums are reduced once per n bytes */
+#define LIBATTOPNG_ADLER_NMAX 5552
+/* largest stored deflate block */
+#define LIBATTOPNG_STORED_MAX 65535
+/* signature, IHDR, IDAT and IEND chunk framing */
+#define LIBATTOPNG_MASK_OVERHEAD (8 + 25 + 12 + 12)
 
 static const uint32_t libattopng_crc32[256] = {
         0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3, 0x0edb8832,
@@ -270,12 +279,12 @@ char *libattopng_get_data(libattopng_t *png, size_t *len) {
     if (!png) {
         return NULL;
     }
-    if (png->out) {
-        /* delete old output if any */
+    if (!png->out || png->out_capacity < png->capacity + 4096 * 8) {
+        /* delete old output if any, otherwise it is reused */
         free(png->out);
+        png->out_capacity = png->capacity + 4096 * 8;
+        png->out = (char *) calloc(png->out_capacity, 1);
     }
-    png->out_capacity = png->capacity + 4096 * 8;
-    png->out = (char *) calloc(png->out_capacity, 1);
     png->out_pos = 0;
     if (!png->out) {
         return NULL;
@@ -402,3 +411,283 @@ void libattopng_destroy(libattopng_t *png) {
     png->data = NULL;
     free(png);
 }
+
+/* ------------------------------------------------------------------------ */
+static uint32_t libattopng_adler(const unsigned char *data, size_t len, uint32_t adler) {
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    size_t n;
+    while (len > 0) {
+        n = len < LIBATTOPNG_ADLER_NMAX ? len : LIBATTOPNG_ADLER_NMAX;
+        len -= n;
+        for (; n >= 8; n -= 8, data += 8) {
+            s1 += data[0]; s2 += s1;
+            s1 += data[1]; s2 += s1;
+            s1 += data[2]; s2 += s1;
+            s1 += data[3]; s2 += s1;
+            s1 += data[4]; s2 += s1;
+            s1 += data[5]; s2 += s1;
+            s1 += data[6]; s2 += s1;
+            s1 += data[7]; s2 += s1;
+        }
+        for (; n > 0; n--, data++) {
+            s1 += *data;
+            s2 += s1;
+        }
+        s1 %= LIBATTOPNG_ADLER_BASE;
+        s2 %= LIBATTOPNG_ADLER_BASE;
+    }
+    return (s2 << 16) | s1;
+}
+
+/* ------------------------------------------------------------------------ */
+static uint32_t libattopng_mask_crc(const libattopng_mask_t *mask, const unsigned char *data, size_t len,
+                                    uint32_t crc) {
+    const uint32_t (*table)[256] = mask->crc_table;
+    uint32_t lo, hi;
+    /* slicing by 8, eight table lookups per 8 bytes instead of a dependent lookup per byte (little endian) */
+    for (; len >= 8; len -= 8, data += 8) {
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = table[7][lo & 255] ^ table[6][(lo >> 8) & 255] ^ table[5][(lo >> 16) & 255] ^ table[4][lo >> 24] ^
+              table[3][hi & 255] ^ table[2][(hi >> 8) & 255] ^ table[1][(hi >> 16) & 255] ^ table[0][hi >> 24];
+    }
+    for (; len > 0; len--, data++) {
+        crc = table[0][(crc ^ *data) & 255] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+/* ------------------------------------------------------------------------ */
+static void libattopng_mask_uint32(libattopng_mask_t *mask, uint32_t val) {
+    unsigned char *out = (unsigned char *) mask->out + mask->out_pos;
+    out[0] = (unsigned char) (val >> 24);
+    out[1] = (unsigned char) (val >> 16);
+    out[2] = (unsigned char) (val >> 8);
+    out[3] = (unsigned char) val;
+    mask->out_pos += 4;
+}
+
+/* ------------------------------------------------------------------------ */
+static void libattopng_mask_chunk(libattopng_mask_t *mask, const char *name, const unsigned char *data, size_t len) {
+    /* the chunk's data must already be in place right after its length and name */
+    size_t start = mask->out_pos;
+    libattopng_mask_uint32(mask, (uint32_t) len);
+    memcpy(mask->out + mask->out_pos, name, 4);
+    mask->out_pos += 4;
+    if (data) {
+        memcpy(mask->out + mask->out_pos, data, len);
+    }
+    mask->out_pos += len;
+    libattopng_mask_uint32(mask, ~libattopng_mask_crc(mask, (unsigned char *) mask->out + start + 4, len + 4,
+                                                      0xffffffff));
+}
+
+/* ------------------------------------------------------------------------ */
+static size_t libattopng_mask_stored(libattopng_mask_t *mask, unsigned char *out) {
+    size_t raw_size = mask->height * (mask->row_bytes + 1);
+    size_t pos = 0, offset, block;
+    uint32_t adler = libattopng_adler(mask->raw, raw_size, 1);
+    out[pos++] = 0x78; /* zlib header, no compression */
+    out[pos++] = 0x01;
+    for (offset = 0; offset < raw_size; offset += block) {
+        block = raw_size - offset < LIBATTOPNG_STORED_MAX ? raw_size - offset : LIBATTOPNG_STORED_MAX;
+        out[pos++] = offset + block == raw_size; /* last block */
+        out[pos++] = (unsigned char) block;
+        out[pos++] = (unsigned char) (block >> 8);
+        out[pos++] = (unsigned char) ~block;
+        out[pos++] = (unsigned char) (~block >> 8);
+        memcpy(out + pos, mask->raw + offset, block);
+        pos += block;
+    }
+    out[pos++] = (unsigned char) (adler >> 24);
+    out[pos++] = (unsigned char) (adler >> 16);
+    out[pos++] = (unsigned char) (adler >> 8);
+    out[pos++] = (unsigned char) adler;
+    return pos;
+}
+
+/* ------------------------------------------------------------------------ */
+libattopng_mask_t *libattopng_mask_new(size_t width, size_t height, int bit_depth, int level) {
+    libattopng_mask_t *mask;
+    size_t raw_size, stored_size, i, k;
+    if ((bit_depth != 1 && bit_depth != 8) || width == 0 || height == 0 || SIZE_MAX / 2 / (width + 1) < height) {
+        return NULL;
+    }
+    mask = (libattopng_mask_t *) calloc(sizeof(libattopng_mask_t), 1);
+    if (!mask) {
+        return NULL;
+    }
+    mask->width = width;
+    mask->height = height;
+    mask->bit_depth = bit_depth;
+    mask->row_bytes = bit_depth == 1 ? (width + 7) / 8 : width;
+    raw_size = height * (mask->row_bytes + 1);
+    stored_size = 2 + raw_size + 5 * (raw_size / LIBATTOPNG_STORED_MAX + 1) + 4;
+    mask->out_capacity = LIBATTOPNG_MASK_OVERHEAD + stored_size;
+
+#ifdef LIBATTOPNG_ZLIB
+    mask->level = level < 0 ? 0 : level > 9 ? 9 : level;
+    if (mask->level > 0) {
+        z_stream *stream = (z_stream *) calloc(sizeof(z_stream), 1);
+        if (!stream || deflateInit(stream, mask->level) != Z_OK) {
+            free(stream);
+            free(mask);
+            return NULL;
+        }
+        mask->zstream = stream;
+        if (LIBATTOPNG_MASK_OVERHEAD + deflateBound(stream, raw_size) > mask->out_capacity) {
+            mask->out_capacity = LIBATTOPNG_MASK_OVERHEAD + deflateBound(stream, raw_size);
+        }
+    }
+#else
+    (void) level;
+    mask->level = 0;
+#endif
+
+    for (i = 0; i < 256; i++) {
+        mask->crc_table[0][i] = libattopng_crc32[i];
+    }
+    for (k = 1; k < 8; k++) {
+        for (i = 0; i < 256; i++) {
+            uint32_t crc = mask->crc_table[k - 1][i];
+            mask->crc_table[k][i] = (crc >> 8) ^ mask->crc_table[0][crc & 255];
+        }
+    }
+
+    /* every row starts out as filter type 0 and all pixels clear */
+    mask->raw = (unsigned char *) calloc(raw_size, 1);
+    mask->out = (char *) malloc(mask->out_capacity);
+    if (!mask->raw || !mask->out) {
+        libattopng_mask_destroy(mask);
+        return NULL;
+    }
+    return mask;
+}
+
+/* ------------------------------------------------------------------------ */
+void libattopng_mask_set_row(libattopng_mask_t *mask, size_t y, const uint64_t *bits) {
+    unsigned char *row;
+    size_t w, bytes;
+    uint64_t word;
+    if (!mask || y >= mask->height) {
+        return;
+    }
+    row = mask->raw + y * (mask->row_bytes + 1) + 1;
+    for (w = 0; w * 64 < mask->width; w++) {
+        word = bits[w];
+        if (mask->bit_depth == 1) {
+            /* PNG packs the first pixel in the highest bit of each byte */
+            word = ((word >> 1) & 0x5555555555555555ULL) | ((word & 0x5555555555555555ULL) << 1);
+            word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+            word = ((word >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((word & 0x0f0f0f0f0f0f0f0fULL) << 4);
+            bytes = mask->row_bytes - w * 8 < 8 ? mask->row_bytes - w * 8 : 8;
+            memcpy(row + w * 8, &word, bytes);
+        } else {
+            size_t b;
+            for (b = 0; b < 8 && w * 64 + b * 8 < mask->width; b++) {
+                /* spread the 8 bits of a byte to the top bits of 8 bytes, then fill each byte from its top bit */
+                uint64_t spread = (((word >> (b * 8)) & 255) * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+                spread = ((spread + 0x7f7f7f7f7f7f7f7fULL) | spread) & 0x8080808080808080ULL;
+                spread = (spread >> 7) * 255;
+                bytes = mask->width - (w * 64 + b * 8) < 8 ? mask->width - (w * 64 + b * 8) : 8;
+                memcpy(row + w * 64 + b * 8, &spread, bytes);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+char *libattopng_mask_get_data(libattopng_mask_t *mask, size_t *len) {
+    unsigned char header[13];
+    unsigned char *idat;
+    size_t idat_len;
+    if (!mask) {
+        return NULL;
+    }
+    mask->out_pos = 0;
+    memcpy(mask->out, "\211PNG\r\n\032\n", 8);
+    mask->out_pos += 8;
+
+    /* IHDR */
+    header[0] = (unsigned char) (mask->width >> 24);
+    header[1] = (unsigned char) (mask->width >> 16);
+    header[2] = (unsigned char) (mask->width >> 8);
+    header[3] = (unsigned char) mask->width;
+    header[4] = (unsigned char) (mask->height >> 24);
+    header[5] = (unsigned char) (mask->height >> 16);
+    header[6] = (unsigned char) (mask->height >> 8);
+    header[7] = (unsigned char) mask->height;
+    header[8] = (unsigned char) mask->bit_depth;
+    header[9] = PNG_GRAYSCALE;
+    header[10] = 0; /* compression */
+    header[11] = 0; /* filter */
+    header[12] = 0; /* interlace method */
+    libattopng_mask_chunk(mask, "IHDR", header, 13);
+
+    /* data, compressed straight into place after the chunk's length and name */
+    idat = (unsigned char *) mask->out + mask->out_pos + 8;
+#ifdef LIBATTOPNG_ZLIB
+    if (mask->zstream) {
+        z_stream *stream = (z_stream *) mask->zstream;
+        deflateReset(stream);
+        stream->next_in = mask->raw;
+        stream->avail_in = (uInt) (mask->height * (mask->row_bytes + 1));
+        stream->next_out = idat;
+        stream->avail_out = (uInt) (mask->out_capacity - LIBATTOPNG_MASK_OVERHEAD);
+        if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+            return NULL;
+        }
+        idat_len = stream->total_out;
+    } else
+#endif
+    {
+        idat_len = libattopng_mask_stored(mask, idat);
+    }
+    libattopng_mask_chunk(mask, "IDAT", NULL, idat_len);
+
+    /* end of image */
+    libattopng_mask_chunk(mask, "IEND", NULL, 0);
+
+    if (len) {
+        *len = mask->out_pos;
+    }
+    return mask->out;
+}
+
+/* ------------------------------------------------------------------------ */
+int libattopng_mask_save(libattopng_mask_t *mask, const char *filename) {
+    size_t len;
+    FILE* f;
+    char *data = libattopng_mask_get_data(mask, &len);
+    if (!data) {
+        return 1;
+    }
+    f = fopen(filename, "wb");
+    if (!f) {
+        return 1;
+    }
+    if (fwrite(data, len, 1, f) != 1) {
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+void libattopng_mask_destroy(libattopng_mask_t *mask) {
+    if (!mask) {
+        return;
+    }
+#ifdef LIBATTOPNG_ZLIB
+    if (mask->zstream) {
+        deflateEnd((z_stream *) mask->zstream);
+        free(mask->zstream);
+    }
+#endif
+    free(mask->raw);
+    free(mask->out);
+    free(mask);
+}
@@ -206,6 +206,99 @@ char *libattopng_get_data(libattopng_t *png, size_t *len);
 int libattopng_save(libattopng_t *png, const char *filename);
 
 
+/**
+ * @brief Reference to a binary mask PNG
+ *
+ * Writes grayscale PNGs of masks given as whole rows of bits. The scanlines and the output stream are allocated once
+ * and reused for every image written. The members should never be used directly.
+ */
+typedef struct {
+    size_t width;                /**< Image width */
+    size_t height;               /**< Image height */
+    int bit_depth;               /**< 1 or 8 bits per pixel */
+    int level;                   /**< Deflate level, 0 for stored blocks */
+    size_t row_bytes;            /**< Bytes of a scanline, without its filter type */
+    unsigned char *raw;          /**< Scanlines, each led by its filter type */
+
+    char *out;                   /**< Buffer to store final PNG */
+    size_t out_pos;              /**< Current size of output buffer */
+    size_t out_capacity;         /**< Capacity of output buffer */
+    uint32_t crc_table[8][256];  /**< Tables for the CRC32 checksum, 8 bytes at a time */
+    void *zstream;               /**< Deflate stream, NULL for stored blocks */
+} libattopng_mask_t;
+
+
+/**
+ * @function libattopng_mask_new
+ *
+ * @brief Create a new, all clear mask PNG to be used with the other libattopng_mask functions.
+ *
+ * @param width     The width of the image in pixels
+ * @param height    The height of the image in pixels
+ * @param bit_depth 1 for 1bit grayscale, 8 for 8bit grayscale with set pixels at 255
+ * @param level     Deflate level from 1 (fastest) to 9, or 0 to write stored blocks. Images are always written as
+ *                  stored blocks unless the library is built with LIBATTOPNG_ZLIB and linked with zlib.
+ * @return reference to a mask PNG or NULL on error.
+ *          Possible errors are:
+ *              - Out of memory
+ *              - Bit depth other than 1 or 8
+ *              - Width and height combined exceed the maximum integer size
+ * @note It's the callers responsibility to free the data structure.
+ *       See @ref libattopng_mask_destroy
+ */
+libattopng_mask_t *libattopng_mask_new(size_t width, size_t height, int bit_depth, int level);
+
+
+/**
+ * @function libattopng_mask_destroy
+ *
+ * @brief Destroys the reference to a mask PNG and free all associated memory.
+ *
+ * @param mask Reference to the image
+ */
+void libattopng_mask_destroy(libattopng_mask_t *mask);
+
+
+/**
+ * @function libattopng_mask_set_row
+ *
+ * @brief Sets every pixel of a row
+ *
+ * @param mask Reference to the image
+ * @param y    Y coordinate
+ * @param bits The row as 64bit words, 64 pixels to a word with the first pixel in the lowest bit of the first word.
+ *             Bits past the width of the image must be clear.
+ * @note If the row is not within the bounds of the image, the function does nothing.
+ */
+void libattopng_mask_set_row(libattopng_mask_t *mask, size_t y, const uint64_t *bits);
+
+
+/**
+ * @function libattopng_mask_get_data
+ *
+ * @brief Returns the mask as PNG data stream
+ *
+ * @param mask Reference to the image
+ * @param len  The length of the data stream is written to this output parameter
+ * @return A reference to the PNG output stream, or NULL if deflating failed
+ * @note The data stream is overwritten by the next call and free'd when calling \ref libattopng_mask_destroy. It
+ *       must not be free'd by the caller
+ */
+char *libattopng_mask_get_data(libattopng_mask_t *mask, size_t *len);
+
+
+/**
+ * @function libattopng_mask_save
+ *
+ * @brief Saves the mask as a PNG file
+ *
+ * @param mask     Reference to the image
+ * @param filename Name of the file
+ * @return 0 on success, 1 on error
+ */
+int libattopng_mask_save(libattopng_mask_t *mask, const char *filename);
+
+
 #ifdef __cplusplus
 }
 #endif
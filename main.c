@@ -10,76 +10,375 @@
 #include <errno.h>
 #include <string.h>
 #include <math.h>
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_video.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
 #include "cam_api.h"
+#include "frame_queue.h"
 #include "image_manipulation.h"
+#include "motion_events.h"
+#include "pipeline.h"
 #include "lib/quick_select/quick_select.h"
 #include "lib/libattopng/libattopng.h"
+#if !defined(TEST_MODE) && !defined(HEADLESS)
+#include "display.h"
+#endif
 #ifdef TEST_MODE
 #include <jpeglib.h>
-#include <unistd.h>
 #include <sys/stat.h>
-#include <time.h>
+#include "frame_cache.h"
+#include "scoring.h"
 #endif
 
 // Model Parameters
-#define BG_MODEL_SIZE 10
-#define THRESHOLD 225
 #define FILTER_SIZE 3
 
-// SDL Events
-#define NEW_FRAME_EVENT (SDL_USEREVENT+1)
-#define EXIT_EVENT (SDL_USEREVENT+2)
+// Resolution requested from the camera when none is given
+#define DEFAULT_WIDTH 320
+#define DEFAULT_HEIGHT 240
+
+#ifdef TEST_MODE
+// Size of the squares tiling the blob benchmark's motion image and of the gaps between them
+#define BENCHMARK_BLOB_SIZE 12
+#define BENCHMARK_BLOB_GAP 4
+
+// Frame rate the data set's frames are taken to be captured at
+#define TEST_FRAME_RATE 30.0
 
-// Color constants
-const uchar YUV_BLACK[] = {0, 127, 127};
-const uchar YUV_WHITE[] = {255, 127, 127};
+// Frames each codec thread may have in flight, the rings between the stages hold this many frames per thread
+#define REPLAY_FRAMES_PER_THREAD 2
 
-// Application views
-enum view {
-    WEBCAM, MOTION_OUTPUT, BG_MODEL, MOTION_MASK, COLOR_MAP
+// Decoded frames of the data set, replayed instead of the JPEGs when they hold every frame asked for
+#define FRAME_CACHE_FILE "frames.yuv"
+
+// Events of the second pipeline run to check that the bands do not change the events
+#define CHECK_EVENTS_FILE "results/events_check.jsonl"
+
+/**
+ * A decoded input frame waiting to be detected
+ */
+struct replay_input {
+    // Frame held by the slot, and whether it has been decoded
+    int frame;
+    int ready;
+    // Frame as YUV, either decoded into the slot's own buffer or mapped from the frame cache
+    const uchar *yuv;
+    uchar *decoded;
+    // Frame repacked to YUYV for the luma modes
+    uchar *yuyv;
+    // Whether the frame is scored, and its ground truth if it is
+    int scored;
+    struct ground_truth truth;
 };
 
-// Global webcam info struct
-struct webcam_info g_cam_info;
+/**
+ * A detected motion image waiting to be written
+ */
+struct replay_output {
+    // Set from the time the frame is detected until its PNG has been written
+    int busy;
+    struct bitmask motion_image;
+};
 
-// Flag to exit processing thread
+/**
+ * How a replay reads its frames and what it does with their motion images
+ */
+struct replay_options {
+    // Whether the luma modes need the frames repacked to YUYV
+    int yuyv;
+    // Bit depth and deflate level of the motion image PNGs, no PNGs are written at a depth of 0
+    int png_depth;
+    int png_level;
+    // Frames to map instead of decoding, NULL to decode the JPEGs
+    const struct frame_cache *cache;
+    // First and last frame whose ground truth is loaded for scoring, 0 to score none
+    int score_first;
+    int score_last;
+    // Number of decoding threads, and of encoding threads
+    int num_threads;
+};
+
+/**
+ * Replay of a data set, decoding and encoding frames on their own threads while detection runs on the main thread
+ *
+ * Frames are decoded into a ring of input slots by any number of threads, detected in order, and their motion images
+ * copied to a ring of output slots for any number of threads to write. A full ring holds back the stage filling it.
+ */
+struct replay {
+    int width;
+    int height;
+    // Frame after the last one to replay
+    int num_frames;
+    struct replay_options options;
+    // Slots of each ring
+    int num_slots;
+    struct replay_input *inputs;
+    struct replay_output *outputs;
+    struct arena arena;
+    // Next frame to decode, next frame to write, and frame after the last one detected
+    int next_decode;
+    int next_encode;
+    int detected;
+    pthread_t decoders[MAX_WORKER_THREADS];
+    pthread_t encoders[MAX_WORKER_THREADS];
+    // Guards everything above, signalled whenever a slot changes hands
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+#endif
+
+#ifndef TEST_MODE
+// Most cameras a single process can open
+#define MAX_CAMERAS 16
+
+/**
+ * Capture and detection state of one camera
+ */
+struct camera {
+    // Index of the camera, in the order given on the command line
+    int id;
+    struct webcam_info cam_info;
+    // Frames handed from the capture thread to the processing loop
+    struct frame_queue queue;
+    struct pipeline pipeline;
+    pthread_t capture_thread;
+    pthread_t process_thread;
+#ifndef HEADLESS
+    // Window showing the camera's output, NULL if it has none
+    struct display *display;
+#endif
+    // Stream motion events are written to, shared between cameras
+    FILE *events;
+    int bg_setup;
+    // Frames run through detection, frames with motion, and seconds spent detecting
+    unsigned long frames_processed;
+    unsigned long motion_events;
+    double process_time;
+};
+
+// Flag to stop every camera
 int g_process_thread_exit = 0;
 
 /**
- * Thread to process new video from the webcam
- * @param ptr Pointer to data used by this function
- * @return 0
+ * Thread to capture new video from a webcam
+ * @param ptr camera to capture from
+ * @return NULL
  */
-int process_webcam_video(void *ptr) {
-    g_process_thread_exit = 0;
+void *capture_webcam_video(void *ptr) {
+    struct camera *camera = ptr;
+    unsigned long sequence = 0;
 
     // While the thread is not exiting
-    while (!g_process_thread_exit) {
-        SDL_Event event;
-        event.type = NEW_FRAME_EVENT;
+    while (!__atomic_load_n(&g_process_thread_exit, __ATOMIC_ACQUIRE)) {
+        struct frame_desc frame;
+        struct timespec now;
 
         // Get the next frame from the camera
-        int ndx = get_next_frame(&g_cam_info);
+        frame.index = get_next_frame(&camera->cam_info);
+        frame.sequence = sequence++;
+        clock_gettime(CLOCK_REALTIME, &now);
+        frame.timestamp = (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+
+        // If that frame is valid, send it to the processing loop
+        if (frame.index >= 0 && !frame_queue_push(&camera->queue, &frame)) {
+            // The processing loop never sees the frame if the queue is full, so give the buffer back here
+            release_frame(&camera->cam_info, frame.index);
+        }
+    }
+
+    // On exit, wake the processing loop so it can shut down
+    frame_queue_close(&camera->queue);
+
+    return NULL;
+}
+
+/**
+ * Gives back the buffer of a frame the processing loop skipped to get to a newer one
+ * @param context camera info structure
+ * @param frame skipped frame
+ */
+void skip_frame(void *context, const struct frame_desc *frame) {
+    release_frame(context, frame->index);
+}
+
+/**
+ * Waits for the next frame of a camera and runs it through detection
+ * @param camera camera to process
+ * @param timeout_ms most milliseconds to wait for a frame, negative to wait until one arrives
+ * @return 0 once the camera has stopped capturing and every frame has been processed, 1 otherwise
+ */
+int process_next_frame(struct camera *camera, int timeout_ms) {
+    struct frame_desc frame;
+    struct timespec start;
+    struct timespec end;
+    uchar *current_raw_frame;
+
+    if (!frame_queue_wait(&camera->queue, timeout_ms)) {
+        return !frame_queue_is_closed(&camera->queue);
+    }
+
+    // Only the newest frame is worth processing, older ones are handed straight back to the driver
+    frame_queue_pop_latest(&camera->queue, &frame, skip_frame, &camera->cam_info);
+    current_raw_frame = camera->cam_info.buffers[frame.index].start;
+
+    // If the background bootstrapping has not been preformed
+    if (!camera->bg_setup) {
+        // Update background model and background buffer
+        camera->bg_setup = pipeline_bootstrap(&camera->pipeline, current_raw_frame);
+    } else {
+        // Preform motion detection operations
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pipeline_process(&camera->pipeline, current_raw_frame, frame.timestamp);
+        clock_gettime(CLOCK_MONOTONIC, &end);
 
-        // If that frame is valid, send it to the main thread
-        if (ndx > 0) {
-            event.user.code = ndx;
-            SDL_PushEvent(&event);
+        camera->process_time += (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+        camera->frames_processed++;
+
+        if (camera->pipeline.labeler.num_blobs > 0) {
+            emit_motion_event(camera->events, camera->id, &camera->pipeline.tracker, frame.timestamp);
+            camera->motion_events++;
+        }
+
+#ifndef HEADLESS
+        if (camera->display) {
+            display_show(camera->display, &camera->pipeline, current_raw_frame, camera->cam_info.bytesperline);
         }
+#endif
     }
 
-    // On exit, push EXIT_EVENT thread
-    SDL_Event event;
-    event.type = EXIT_EVENT;
-    SDL_PushEvent(&event);
+    // Done reading the frame, let the driver capture into it again
+    release_frame(&camera->cam_info, frame.index);
 
-    return 0;
+    return 1;
 }
 
 /**
- * Uses a convolution and median filter so smooth the Y channel of the src image
+ * Thread to process the video of a camera without a window
+ * @param ptr camera to process
+ * @return NULL
+ */
+void *process_webcam_video(void *ptr) {
+    struct camera *camera = ptr;
+
+    // Sleep until a frame arrives
+    while (process_next_frame(camera, -1));
+
+    return NULL;
+}
+
+/**
+ * Prints the capture and detection stats of a camera
+ * @param camera camera
+ */
+void print_camera_stats(const struct camera *camera) {
+    unsigned long frames = camera->frames_processed > 0 ? camera->frames_processed : 1;
+
+    fprintf(stderr, "Camera %d (%s, %dx%d): captured %lu frames, dropped %lu, skipped %lu, processed %lu, "
+                    "%lu with motion, %.3f ms per frame\n", camera->id, camera->cam_info.dev_name,
+            camera->cam_info.width, camera->cam_info.height, camera->cam_info.frames_captured,
+            camera->cam_info.frames_dropped, camera->queue.skipped, camera->frames_processed, camera->motion_events,
+            camera->process_time * 1000 / frames);
+    scheduler_print_stats(&camera->pipeline.scheduler, stderr);
+    pyramid_print_stats(&camera->pipeline.engine.pyramid, stderr);
+    tracker_print_stats(&camera->pipeline.tracker, stderr);
+    pipeline_print_band_times(&camera->pipeline, stderr);
+}
+
+/**
+ * Signal handler that asks the capture threads to stop
+ * @param sig signal number
+ */
+void stop_capture(int sig) {
+    (void) sig;
+    __atomic_store_n(&g_process_thread_exit, 1, __ATOMIC_RELEASE);
+}
+#endif
+
+/**
+ * Parses the name of a background model given on the command line
+ *
+ * @param name "boxcar" or "ema"
+ * @return background model
+ */
+enum background_model parse_background_model(const char *name) {
+    if (strcmp(name, "boxcar") == 0) {
+        return BG_BOXCAR;
+    } else if (strcmp(name, "ema") == 0) {
+        return BG_EMA;
+    }
+
+    fprintf(stderr, "Unknown background model %s, expected boxcar or ema\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Parses the name of a background model storage given on the command line
+ *
+ * @param name "float", "fixed" or "half"
+ * @return model storage
+ */
+enum model_storage parse_model_storage(const char *name) {
+    if (strcmp(name, "float") == 0) {
+        return STORAGE_FLOAT;
+    } else if (strcmp(name, "fixed") == 0) {
+        return STORAGE_FIXED;
+    } else if (strcmp(name, "half") == 0) {
+        return STORAGE_FIXED_HALF_CHROMA;
+    }
+
+    fprintf(stderr, "Unknown model storage %s, expected float, fixed or half\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Parses the name of a channel mode given on the command line
+ *
+ * @param name "yuv", "luma" or "luma-chroma"
+ * @return channel mode
+ */
+enum channel_mode parse_channel_mode(const char *name) {
+    if (strcmp(name, "yuv") == 0) {
+        return CHANNELS_YUV;
+    } else if (strcmp(name, "luma") == 0) {
+        return CHANNELS_LUMA;
+    } else if (strcmp(name, "luma-chroma") == 0) {
+        return CHANNELS_LUMA_CHROMA;
+    }
+
+    fprintf(stderr, "Unknown channel mode %s, expected yuv, luma or luma-chroma\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Parses the budgets of the motion gated scheduler given on the command line
+ *
+ * @param budgets "interval[,sample_step[,wake_samples[,idle_after]]]", budgets left out take their defaults
+ * @param schedule set to the budgets
+ */
+void parse_schedule(const char *budgets, struct schedule_config *schedule) {
+    int count;
+
+    schedule->sample_step = 0;
+    schedule->wake_samples = 0;
+    schedule->idle_after = 0;
+    count = sscanf(budgets, "%d,%d,%d,%d", &schedule->idle_interval, &schedule->sample_step, &schedule->wake_samples,
+                   &schedule->idle_after);
+
+    if (count < 1 || schedule->idle_interval <= 0 || schedule->sample_step < 0 || schedule->wake_samples < 0 ||
+        schedule->idle_after < 0) {
+        fprintf(stderr, "Invalid scheduler budgets %s, expected interval[,sample_step[,wake_samples[,idle_after]]]\n",
+                budgets);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Uses a convolution and median filter so smooth a single channel motion image
+ *
+ * Pixels outside of the image are treated as copies of the nearest edge pixel. This is the original implementation,
+ * kept for the reference detect_motion. The smoothing stage in smoothing.c produces the same output.
  *
  * @param src source src to smooth
  * @param width width of the src
@@ -95,7 +394,7 @@ void smooth_image(const unsigned char *src, int width, int height, int filter_si
     int L = (filter_size - 1) / 2;
 
     // Allocate kernel and neighborhood values
-    kernel = (double *) malloc(sizeof(double) * width * height);
+    kernel = (double *) malloc(sizeof(double) * filter_size * filter_size);
     neighborhood_values = (double *) malloc(sizeof(double) * filter_size * filter_size);
 
     // Generate smoothing kernel
@@ -106,28 +405,25 @@ void smooth_image(const unsigned char *src, int width, int height, int filter_si
     }
 
     // Filter image
-    for (int i = 0; i < width; i++) {
-        for (int j = 0; j < height; j++) {
-            uchar output_pixel[3];
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
             double median;
             double smoothed_value = 0.0;
 
             // Smooth pixel
-            for (int k = -half_w; k <= half_w; k++) {
-                for (int l = -half_w; l <= half_w; l++) {
-                    int ii = i + k;
-                    int jj = j + l;
-
-                    // If the pixel requested is in bounds
-                    if (((ii < width) && (ii >= 0)) && ((jj < height) && (jj >= 0))) {
-                        // Get Y channel value
-                        uchar pixel_value = *(src + ii * 3 + jj * width * 3);
-                        // Get filter value
-                        double filter_val = *(kernel + (filter_size * (k + half_w) + l + half_w));
-                        // Smooth value
-                        smoothed_value += filter_val * (double) pixel_value;
-                        *(neighborhood_values + (l + half_w) + (k + half_w) * filter_size) = pixel_value;
-                    }
+            for (int l = -half_w; l <= half_w; l++) {
+                // Clamp the requested row to the image
+                int jj = j + l < 0 ? 0 : (j + l >= height ? height - 1 : j + l);
+
+                for (int k = -half_w; k <= half_w; k++) {
+                    // Clamp the requested column to the image
+                    int ii = i + k < 0 ? 0 : (i + k >= width ? width - 1 : i + k);
+                    uchar pixel_value = *(src + ii + jj * width);
+                    // Get filter value
+                    double filter_val = *(kernel + (filter_size * (k + half_w) + l + half_w));
+                    // Smooth value
+                    smoothed_value += filter_val * (double) pixel_value;
+                    *(neighborhood_values + (l + half_w) + (k + half_w) * filter_size) = pixel_value;
                 }
             }
 
@@ -136,17 +432,10 @@ void smooth_image(const unsigned char *src, int width, int height, int filter_si
 
             // Threshold median
             if (median > 240.0) {
-                output_pixel[0] = 255;
-
+                *(dest + i + j * width) = MOTION_PIXEL;
             } else {
-                output_pixel[0] = 0;
+                *(dest + i + j * width) = STILL_PIXEL;
             }
-
-            output_pixel[1] = 127;
-            output_pixel[2] = 127;
-
-            // Set output pixel of smoothed image
-            yuv_set_pixel_value(dest, i, j, width, output_pixel);
         }
     }
 
@@ -155,71 +444,6 @@ void smooth_image(const unsigned char *src, int width, int height, int filter_si
     free(kernel);
 }
 
-/**
- * Find the box of motion in the image
- *
- * @param image black and white motion image
- * @param rect SDL rect to populate
- * @param width width of the motion image
- * @param height height of motion image
- */
-void find_motion_box(const uchar *image, SDL_Rect *rect, int width, int height) {
-    int min_x = width;
-    int min_y = height;
-    int max_x = 0;
-    int max_y = 0;
-    int rect_height;
-    int rect_width;
-    int pixel_count = 0;
-    int area;
-    uchar pixel_value[3];
-
-    // Look for motion box
-    for (int i = 0; i < width; i += 2) {
-        for (int j = 0; j < height; j++) {
-            // Get pixel
-            yuv_get_pixel_value(image, i, j, width, pixel_value);
-
-            // Threshold pixel
-            if (pixel_value[0] > 200) {
-                // Determine if this pixel is the max or min row pixel
-                if (i < min_x) {
-                    min_x = i;
-                } else if (i > max_x) {
-                    max_x = i;
-                }
-                // Determine if this pixel is the max or min column pixel
-                if (j < min_y) {
-                    min_y = j;
-                } else if (j > max_y) {
-                    max_y = j;
-                }
-                pixel_count++;
-            }
-        }
-    }
-
-    // Find width and height of the rectangle
-    rect_width = (max_x - min_x) * 2;
-    rect_height = (max_y - min_y) * 2;
-    area = rect_height * rect_width;
-
-    // If the rectangle is too small or contains too few motion pixels
-    if (area < 10 || pixel_count < 200) {
-        // Draw a 0 sized rectangle
-        rect->x = 0;
-        rect->y = 0;
-        rect->w = 0;
-        rect->h = 0;
-    } else {
-        // Draw rectangle around motion
-        rect->x = min_x * 2;
-        rect->y = min_y * 2;
-        rect->w = rect_width;
-        rect->h = rect_height;
-    }
-}
-
 /**
  * Finds the magnitude of a 3 entry array
  *
@@ -241,20 +465,25 @@ double magnitude(float *array) {
 /**
  * Detects if motion has occurred between by differencing and filtering the new frame with a background model
  *
+ * This is the original column-major implementation over interleaved buffers. It is kept as the reference the
+ * motion engine is verified against in test mode.
+ *
  * @param new_frame new frame from the video service
  * @param background_buffer background buffer containing
  * @param background_model background model of the scene
  * @param mask motion mask of the image
- * @param output motion image output
+ * @param output single channel motion image output
  * @param bg_model_ndx Index of the oldest frame in the background model
+ * @param width width of the frames
+ * @param height height of the frames
  * @return
  */
 int
 detect_motion(const uchar *new_frame, uchar **background_buffer, float *background_model, float *mask, uchar *output,
-              int *bg_model_ndx, int filter_size) {
+              int *bg_model_ndx, int filter_size, int width, int height) {
     int i;
     int j;
-    uchar *pre_smoothed_output_image = malloc(WIDTH * HEIGHT * 3);
+    uchar *pre_smoothed_output_image = malloc((size_t) width * height);
     uchar new_value[3];
     float bg_value[3];
     float normalized_pixel[3];
@@ -265,25 +494,25 @@ detect_motion(const uchar *new_frame, uchar **background_buffer, float *backgrou
     float new_mask_value;
 
     // Find each motion pixel
-    for (i = 0; i < WIDTH; i++) {
-        for (j = 0; j < HEIGHT; j++) {
+    for (i = 0; i < width; i++) {
+        for (j = 0; j < height; j++) {
             pixel_mag = 0;
 
             // Get pixel of the new frame
 #ifndef TEST_MODE
-            yuyv_get_pixel_value(new_frame, i, j, WIDTH, new_value);
+            yuyv_get_pixel_value(new_frame, i, j, width, new_value);
 #else
-            yuv_get_pixel_value(new_frame, i, j, WIDTH, new_value);
+            yuv_get_pixel_value(new_frame, i, j, width, new_value);
 #endif
             // Get bg model pixel
-            bg_model_get_pixel_value(background_model, i, j, WIDTH, bg_value);
+            bg_model_get_pixel_value(background_model, i, j, width, bg_value);
             // Get the oldest pixel of the background buffer
-            yuv_get_pixel_value(background_buffer[*bg_model_ndx], i, j, WIDTH, oldest_bg_model);
+            yuv_get_pixel_value(background_buffer[*bg_model_ndx], i, j, width, oldest_bg_model);
 
             // For each channel
             for (int k = 0; k < 3; k++) {
                 new_out_value = (((float) new_value[k] - 127.0f) - (bg_value[k] - 127.0f)) + 127;
-                new_out_value = new_out_value * *(mask + i + j);
+                new_out_value = new_out_value * *(mask + i + j * width);
 
                 normalized_pixel[k] = new_out_value;
             }
@@ -294,14 +523,14 @@ detect_motion(const uchar *new_frame, uchar **background_buffer, float *backgrou
             // Threshold magnitude
             if ((int) pixel_mag < THRESHOLD) {
                 // If the pixel magnitude is below the threshold, its not a motion pixel. Set pixel to black
-                yuv_set_pixel_value(pre_smoothed_output_image, i, j, WIDTH, YUV_BLACK);
+                *(pre_smoothed_output_image + i + j * width) = STILL_PIXEL;
                 // Increase the motion mask to make this pixel more sensitive to motion
-                new_mask_value = *(mask + i + j * WIDTH) + 0.05f;
+                new_mask_value = *(mask + i + j * width) + 0.05f;
             } else {
                 // If the pixel magnitude is above the threshold, its a motion pixel. Set pixel to white
-                yuv_set_pixel_value(pre_smoothed_output_image, i, j, WIDTH, YUV_WHITE);
+                *(pre_smoothed_output_image + i + j * width) = MOTION_PIXEL;
                 // Decrease the motion mask to make this pixel less sensitive to motion
-                new_mask_value = *(mask + i + j * WIDTH) - 0.2f;
+                new_mask_value = *(mask + i + j * width) - 0.2f;
             }
 
             // Update background model by adding in new frame and removing oldest frame from the model
@@ -311,9 +540,9 @@ detect_motion(const uchar *new_frame, uchar **background_buffer, float *backgrou
             }
 
             // Overwrite oldest frame in the buffer with new frame
-            yuv_set_pixel_value(background_buffer[*bg_model_ndx], i, j, WIDTH, new_value);
+            yuv_set_pixel_value(background_buffer[*bg_model_ndx], i, j, width, new_value);
             // Update pixel in background model
-            bg_model_set_pixel_value(background_model, i, j, WIDTH, new_bg_model);
+            bg_model_set_pixel_value(background_model, i, j, width, new_bg_model);
 
             // Saturate mask value
             if (new_mask_value < 0.0) {
@@ -323,7 +552,7 @@ detect_motion(const uchar *new_frame, uchar **background_buffer, float *backgrou
             }
 
             // Update mask
-            *(mask + i + j * WIDTH) = new_mask_value;
+            *(mask + i + j * width) = new_mask_value;
 
         }
     }
@@ -332,7 +561,7 @@ detect_motion(const uchar *new_frame, uchar **background_buffer, float *backgrou
     *bg_model_ndx = (*bg_model_ndx + 1) % BG_MODEL_SIZE;
 
     // Smooth motion image
-    smooth_image(pre_smoothed_output_image, WIDTH, HEIGHT, filter_size, output);
+    smooth_image(pre_smoothed_output_image, width, height, filter_size, output);
 
     // Free allocated buffer
     free(pre_smoothed_output_image);
@@ -341,246 +570,235 @@ detect_motion(const uchar *new_frame, uchar **background_buffer, float *backgrou
 
 #ifndef TEST_MODE
 /**
- * Opens webcam interface and SDL to display motion output to the user
+ * Opens webcam interfaces and SDL to display motion output to the user
+ *
+ * Every camera gets its own capture thread, processing loop and detection state, while all of them share one worker
+ * pool. A motion event is written as a line of JSON for every frame with motion in it. Only the first camera is shown
+ * in the window, and headless builds never display anything.
+ *
  * @param argc number of args
- * @param argv arg values
+ * @param argv arg values: one or more V4L devices, each optionally followed by the resolution to request from it as
+ *             WIDTHxHEIGHT. Passing -n runs without a window, -e fd writes motion events to fd instead of stdout and
+ *             -m boxcar|ema picks the background model, -s float|fixed|half how it is stored,
+ *             -c yuv|luma|luma-chroma which channels are differenced and -r file the region of interest of every
+ *             camera.
  * @return exit code
  */
 int main(int argc, char *argv[]) {
-    SDL_Window *win = NULL;
-    SDL_Renderer *renderer = NULL;
-    SDL_Surface *img = NULL;
-    SDL_Event e;
-    SDL_Rect rect;
-    uchar *background_buffer[BG_MODEL_SIZE];
-    int bg_model_ndx = 0;
-    int pitch = WIDTH * 2;
-    int bg_setup = 0;
-    uchar *current_raw_frame;
-    uchar *current_frame = malloc(WIDTH * HEIGHT * 3);
-    float *background_model = malloc(WIDTH * HEIGHT * 3 * sizeof(float));
-    uchar *motion_image = malloc(WIDTH * HEIGHT * 3);
-    uchar *display_buffer = malloc(WIDTH * HEIGHT * 2);
-    int view = 0;
-    float *mask = malloc(WIDTH * HEIGHT * sizeof(float));
-    char window_name[50];
-    int change_window = 0;
+#ifndef HEADLESS
+    struct display display;
+    int show_display = 1;
+#else
+    int show_display = 0;
+#endif
+    static struct camera cameras[MAX_CAMERAS];
+    int num_cameras = 0;
+    struct worker_pool pool;
+    FILE *events = stdout;
+    struct engine_config config = {BG_BOXCAR, STORAGE_FLOAT, CHANNELS_YUV, NULL, 0};
+    struct schedule_config *schedule = NULL;
+    struct schedule_config schedule_budgets;
+    const char *roi_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ne:m:s:c:r:i:p:")) != -1) {
+        switch (opt) {
+            case 'n':
+                show_display = 0;
+                break;
+            case 'e':
+                events = fdopen(atoi(optarg), "w");
+
+                if (!events) {
+                    fprintf(stderr, "Cannot write events to fd %s: %s\n", optarg, strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                config.model = parse_background_model(optarg);
+                break;
+            case 's':
+                config.storage = parse_model_storage(optarg);
+                break;
+            case 'c':
+                config.channels = parse_channel_mode(optarg);
+                break;
+            case 'r':
+                roi_path = optarg;
+                break;
+            case 'i':
+                parse_schedule(optarg, &schedule_budgets);
+                schedule = &schedule_budgets;
+                break;
+            case 'p':
+                config.pyramid_factor = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n] [-e fd] [-m boxcar|ema] [-s float|fixed|half] "
+                                "[-c yuv|luma|luma-chroma] [-r roi_file] [-i idle_budgets] [-p 2|4] "
+                                "device [WIDTHxHEIGHT] [device [WIDTHxHEIGHT]]...\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
 
-    // Setup g_cam_info struct
-    g_cam_info.fd = -1;
-    g_cam_info.dev_name = argv[1];
+    // Setup a camera for each device, a resolution applies to the device before it
+    for (int i = optind; i < argc; i++) {
+        struct camera *camera;
+        int width;
+        int height;
 
-    // Initialize background model buffer
-    for (int i = 0; i < BG_MODEL_SIZE; i++) {
-        background_buffer[i] = malloc(WIDTH * HEIGHT * 3);
-    }
+        if (sscanf(argv[i], "%dx%d", &width, &height) == 2) {
+            if (num_cameras == 0 || width <= 0 || height <= 0) {
+                fprintf(stderr, "Invalid resolution %s, expected device WIDTHxHEIGHT\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+
+            cameras[num_cameras - 1].cam_info.width = width;
+            cameras[num_cameras - 1].cam_info.height = height;
+            continue;
+        }
 
-    // Fill motion mask with 1.0
-    for (int i = 0; i < WIDTH; i++) {
-        for (int j = 0; j < HEIGHT; j++) {
-            *(mask + i + j * WIDTH) = 1.0f;
+        if (num_cameras == MAX_CAMERAS) {
+            fprintf(stderr, "Too many cameras, at most %d are supported\n", MAX_CAMERAS);
+            exit(EXIT_FAILURE);
         }
+
+        camera = &cameras[num_cameras];
+        camera->id = num_cameras++;
+        camera->cam_info.fd = -1;
+        camera->cam_info.dev_name = argv[i];
+        camera->cam_info.width = DEFAULT_WIDTH;
+        camera->cam_info.height = DEFAULT_HEIGHT;
+        camera->events = events;
     }
 
-    // Setup webcam for video capture
-    open_device(&g_cam_info);
-    init_device(&g_cam_info);
-    start_capturing(&g_cam_info);
-    printf("Opened webcam!\n");
+    if (num_cameras == 0) {
+        fprintf(stderr, "Usage: %s [-n] [-e fd] [-m boxcar|ema] [-s float|fixed|half] [-c yuv|luma|luma-chroma] "
+                        "[-r roi_file] [-i idle_budgets] [-p 2|4] device [WIDTHxHEIGHT] [device [WIDTHxHEIGHT]]...\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // One pool for every camera, so the thread count does not grow with the number of cameras
+    worker_pool_init(&pool, worker_pool_default_threads());
+
+    for (int i = 0; i < num_cameras; i++) {
+        struct webcam_info *cam_info = &cameras[i].cam_info;
+        struct engine_config camera_config = config;
+        uchar *roi_mask = NULL;
+
+        // Setup webcam for video capture
+        open_device(cam_info);
+        init_device(cam_info);
+        start_capturing(cam_info);
+        // Status goes to stderr, stdout may be carrying events
+        fprintf(stderr, "Opened %s at %dx%d!\n", cam_info->dev_name, cam_info->width, cam_info->height);
+
+        // Setup motion detection state, at the resolution the driver picked
+        if (roi_path) {
+            roi_mask = roi_load(roi_path, cam_info->width, cam_info->height);
+            camera_config.roi_mask = roi_mask;
+        }
 
-    // Start SDL
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        fprintf(stderr, "Unable to initialize SDL: %s", strerror(errno));
-        return 1;
+        pipeline_init(&cameras[i].pipeline, cam_info->width, cam_info->height, cam_info->bytesperline, FRAME_YUYV,
+                      &camera_config, schedule, FILTER_SIZE, &pool);
+        free(roi_mask);
+        frame_queue_init(&cameras[i].queue);
     }
 
-    // Create SDL Window and Render
-    win = SDL_CreateWindow("Motion Detector", 0, 0, WIDTH * 2, HEIGHT * 2, 0);
-    renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+#ifndef HEADLESS
+    if (show_display) {
+        display_init(&display, cameras[0].cam_info.width, cameras[0].cam_info.height);
+        cameras[0].display = &display;
+    }
+#endif
 
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YUY2, SDL_TEXTUREACCESS_STREAMING, WIDTH,
-                                             HEIGHT);
+    if (!show_display) {
+        // Nothing to close the window with, so stop on a signal instead
+        signal(SIGINT, stop_capture);
+        signal(SIGTERM, stop_capture);
+    }
 
-    // Start updating video
-    SDL_CreateThread(process_webcam_video, NULL, NULL);
+    // Start capturing and processing video, the windowed camera is processed on this thread since SDL needs it
+    for (int i = 0; i < num_cameras; i++) {
+        if (pthread_create(&cameras[i].capture_thread, NULL, capture_webcam_video, &cameras[i]) ||
+            ((i > 0 || !show_display) &&
+             pthread_create(&cameras[i].process_thread, NULL, process_webcam_video, &cameras[i]))) {
+            fprintf(stderr, "Unable to start camera threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
+#ifndef HEADLESS
     // Main loop
-    while (1) {
-        // If there is a new SDL Event
-        if (SDL_PollEvent(&e)) {
-            // Process event
-            switch (e.type) {
-                // On exit, shutdown the camera thread
-                case SDL_QUIT:
-                    g_process_thread_exit = 1;
-                    break;
-                case EXIT_EVENT:
-                    // After camera thread has shutdown, goto cleanup
-                    goto cleanup;
-                case SDL_KEYDOWN:
-                    // On keypress
-                    switch (e.key.keysym.sym) {
-                        case SDLK_v:
-                            view = (view + 1) % 4;
-                            change_window = 1;
-                            break;
-                        case SDLK_c:
-                            view = COLOR_MAP;
-                            change_window = 1;
-                    }
-                    break;
-                case NEW_FRAME_EVENT:
-                    // On new frame
-                    current_raw_frame = g_cam_info.buffers[e.user.code].start;
-
-                    // If the background bootstrapping has not been preformed
-                    if (!bg_setup) {
-                        // Update background model and background buffer
-                        for (int i = 0; i < WIDTH; i++) {
-                            for (int j = 0; j < HEIGHT; j++) {
-                                float bg_model_pixel[3];
-                                uchar current_frame_pixel[3];
-                                bg_model_get_pixel_value(background_model, i, j, WIDTH, bg_model_pixel);
-                                yuyv_get_pixel_value(current_raw_frame, i, j, WIDTH, current_frame_pixel);
-
-                                bg_model_pixel[0] = (bg_model_pixel[0] +
-                                                     (float) current_frame_pixel[0] / BG_MODEL_SIZE);
-                                bg_model_pixel[1] = (bg_model_pixel[1] +
-                                                     (float) (current_frame_pixel[1]) / BG_MODEL_SIZE);
-                                bg_model_pixel[2] = (bg_model_pixel[2] +
-                                                     (float) (current_frame_pixel[2]) / BG_MODEL_SIZE);
-                                yuv_set_pixel_value(background_buffer[bg_model_ndx], i, j, WIDTH, current_frame_pixel);
-                                bg_model_set_pixel_value(background_model, i, j, WIDTH, bg_model_pixel);
-                            }
-                        }
-
-                        bg_model_ndx++;
-
-                        if (bg_model_ndx >= BG_MODEL_SIZE) {
-                            bg_model_ndx = 0;
-                            bg_setup = 1;
-                        }
-                    } else {
-                        // Lock texture for access
-                        SDL_LockTexture(texture, NULL, (void **) &display_buffer, &pitch);
-
-                        // Preform motion detection operations
-                        detect_motion(current_raw_frame, background_buffer, background_model, mask, motion_image,
-                                      &bg_model_ndx, FILTER_SIZE);
-
-                        // Find motion box from the motion image
-
-                        find_motion_box(motion_image, &rect, WIDTH, HEIGHT);
-                        // Display current view
-                        switch (view) {
-                            case MOTION_OUTPUT:
-                                // Motion image output
-                                snprintf(window_name, 40, "Motion Detector: Motion Image");
-                                yuv_to_yuyv(motion_image, display_buffer, WIDTH, HEIGHT);
-                                break;
-                            case BG_MODEL:
-                                // Background model view
-                                snprintf(window_name, 40, "Motion Detector: Background Model");
-                                bg_model_to_yuyv(background_model, display_buffer, WIDTH, HEIGHT);
-                                break;
-                            default:
-                            case WEBCAM:
-                                // Video from webcam
-                                snprintf(window_name, 40, "Motion Detector");
-                                memcpy(display_buffer, current_raw_frame, WIDTH * HEIGHT * 2);
-                                break;
-                            case MOTION_MASK:
-                                // Motion mask view
-                                snprintf(window_name, 40, "Motion Detector: Motion Mask");
-                                for (int i = 0; i < WIDTH; i++) {
-                                    for (int j = 0; j < HEIGHT; j++) {
-                                        uchar pixel_val[3];
-                                        uchar mask_value = *(mask + i + j * WIDTH) * 255;
-                                        pixel_val[0] = mask_value;
-                                        pixel_val[1] = 127;
-                                        pixel_val[2] = 127;
-
-                                        yuyv_set_pixel_value(display_buffer, i, j, WIDTH, pixel_val);
-                                    }
-                                }
-                                break;
-                            case COLOR_MAP:
-                                //Debug color ma
-                                snprintf(window_name, 40, "Motion Detector: YUYV Color Space");
-                                for (int i = 0; i < WIDTH; i++) {
-                                    for (int j = 0; j < HEIGHT; j++) {
-                                        uchar pixel_val[3];
-                                        pixel_val[0] = 0;
-                                        pixel_val[1] = (i / (float) (WIDTH)) * 255;
-                                        pixel_val[2] = 255 - (j / (float) HEIGHT) * 255;
-
-                                        yuv_set_pixel_value(current_frame, i, j, WIDTH, pixel_val);
-                                    }
-                                }
-                                yuv_to_yuyv(current_frame, display_buffer, WIDTH, HEIGHT);
-                        }
-
-
-                        // Update SDL window with output current_frame
-                        SDL_UnlockTexture(texture);
-                        // Copy texture to render
-                        SDL_RenderCopy(renderer, texture, NULL, NULL);
-                        // Draw motion rectangle
-                        SDL_SetRenderDrawColor(renderer, 0, 255, 0, SDL_ALPHA_OPAQUE);
-                        SDL_RenderDrawRect(renderer, &rect);
-
-                        // Update display
-                        SDL_RenderPresent(renderer);
-
-                        if (change_window) {
-                            // update window title
-                            SDL_SetWindowTitle(win, window_name);
-                            change_window = 0;
-                        }
-
-                    }
-                    break;
+    if (show_display) {
+        while (1) {
+            // On exit, shutdown the camera threads
+            if (!display_poll_events(&display)) {
+                __atomic_store_n(&g_process_thread_exit, 1, __ATOMIC_RELEASE);
+            }
+
+            // Wake up now and then to keep the window responsive, after camera thread has shutdown, goto cleanup
+            if (!process_next_frame(&cameras[0], DISPLAY_POLL_MS)) {
+                break;
             }
+        }
+    }
+#endif
+
+    // Cleanup SDL and camera interfaces
+    for (int i = 0; i < num_cameras; i++) {
+        pthread_join(cameras[i].capture_thread, NULL);
 
+        if (i > 0 || !show_display) {
+            pthread_join(cameras[i].process_thread, NULL);
         }
     }
 
-    // Cleanup SDL and camera interface
-    cleanup:
-    SDL_FreeSurface(img);
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(win);
-    stop_capturing(&g_cam_info);
-    deallocate_buffers(&g_cam_info);
-    close_device(&g_cam_info);
-    free(motion_image);
+#ifndef HEADLESS
+    if (show_display) {
+        display_free(&display);
+    }
+#endif
 
-    for (int i = 0; i < BG_MODEL_SIZE; i++) {
-        free(background_buffer[i]);
+    for (int i = 0; i < num_cameras; i++) {
+        stop_capturing(&cameras[i].cam_info);
+        print_camera_stats(&cameras[i]);
+        deallocate_buffers(&cameras[i].cam_info);
+        close_device(&cameras[i].cam_info);
+        pipeline_free(&cameras[i].pipeline);
     }
 
+    worker_pool_free(&pool);
+    fclose(events);
+
     return 0;
 }
 #endif
 
 #ifdef TEST_MODE
-int bytes_per_pixel = 3;   /* or 1 for GRACYSCALE images */
-int color_space = JCS_RGB;
+// Most rows libjpeg hands out at once, its largest vertical sampling factor
+#define JPEG_MAX_ROWS 4
 
 /**
- * Reads a jpeg file from disk
+ * Reads a jpeg file from disk as YUV
+ *
+ * YCbCr files, as nearly all are, are decoded straight into the frame with no color conversion. Any other file is
+ * decoded as RGB into the frame and converted in place a few rows at a time, while the rows are still in cache.
+ *
  * @param filename file location of jpeg
- * @param raw_image image buffer to store image atain
- * @return
+ * @param yuv_image frame to fill, 3 bytes per pixel
+ * @param width width of the frame
+ * @param height height of the frame
+ * @return 1 on success, -1 if the file can not be read or is not the size of the frame
  */
-int read_jpeg_file(char *filename, uchar *raw_image) {
+int read_jpeg_file(char *filename, uchar *yuv_image, int width, int height) {
     struct jpeg_decompress_struct c_info;
     struct jpeg_error_mgr j_err;
-    JSAMPROW row_pointer[1];
+    JSAMPROW rows[JPEG_MAX_ROWS];
     FILE *image_file = fopen(filename, "rb");
-    unsigned long location = 0;
-    int i;
+    size_t stride = (size_t) width * 3;
+    int converted;
 
     // Check if ile opened
     if (!image_file) {
@@ -597,79 +815,695 @@ int read_jpeg_file(char *filename, uchar *raw_image) {
 
     jpeg_read_header(&c_info, TRUE);
 
+    // libjpeg only hands out YCbCr for files stored as YCbCr
+    converted = c_info.jpeg_color_space != JCS_YCbCr;
+    c_info.out_color_space = converted ? JCS_RGB : JCS_YCbCr;
+
     jpeg_start_decompress(&c_info);
 
-    row_pointer[0] = (unsigned char *) malloc(c_info.output_width * c_info.num_components);
+    if ((int) c_info.output_width != width || (int) c_info.output_height != height || c_info.output_components != 3) {
+        printf("Jpeg file %s is not a %dx%d color image\n", filename, width, height);
+        jpeg_destroy_decompress(&c_info);
+        fclose(image_file);
+        return -1;
+    }
 
     // Read JPEG file in
-    while (c_info.output_scanline < c_info.image_height) {
-        jpeg_read_scanlines(&c_info, row_pointer, 1);
-        for (i = 0; i < c_info.image_width * c_info.num_components; i++)
-            raw_image[location++] = row_pointer[0][i];
+    while (c_info.output_scanline < c_info.output_height) {
+        int first = (int) c_info.output_scanline;
+        int num_rows = c_info.rec_outbuf_height < JPEG_MAX_ROWS ? c_info.rec_outbuf_height : JPEG_MAX_ROWS;
+
+        num_rows = num_rows < height - first ? num_rows : height - first;
+
+        for (int k = 0; k < num_rows; k++) {
+            rows[k] = yuv_image + (size_t) (first + k) * stride;
+        }
+
+        num_rows = (int) jpeg_read_scanlines(&c_info, rows, num_rows);
+
+        for (int k = 0; converted && k < num_rows; k++) {
+            rgb_to_yuv_row(rows[k], rows[k], width);
+        }
     }
 
     // Cleanup
     jpeg_finish_decompress(&c_info);
     jpeg_destroy_decompress(&c_info);
-    free(row_pointer[0]);
     fclose(image_file);
 
     return 1;
 }
 
-#define RGBA(r, g, b, a) ((r) | ((g) << 8) | ((b) << 16) | ((a) << 24))
+/**
+ * Reads the size of a jpeg file without decoding it
+ * @param filename file location of jpeg
+ * @param width set to the width of the image
+ * @param height set to the height of the image
+ * @return 1 on success, -1 if the file could not be opened
+ */
+int read_jpeg_size(char *filename, int *width, int *height) {
+    struct jpeg_decompress_struct c_info;
+    struct jpeg_error_mgr j_err;
+    FILE *image_file = fopen(filename, "rb");
+
+    if (!image_file) {
+        printf("Error opening jpeg file %s\n!", filename);
+        return -1;
+    }
+
+    c_info.err = jpeg_std_error(&j_err);
+    jpeg_create_decompress(&c_info);
+    jpeg_stdio_src(&c_info, image_file);
+    jpeg_read_header(&c_info, TRUE);
+
+    *width = (int) c_info.image_width;
+    *height = (int) c_info.image_height;
+
+    jpeg_destroy_decompress(&c_info);
+    fclose(image_file);
+
+    return 1;
+}
+
+/**
+ * Finds the newest modification time and the total size of the JPEGs a range of frames is decoded from
+ *
+ * @param first_frame first frame of the range
+ * @param num_frames number of frames
+ * @param source set to the time and size found
+ * @return 1 on success, -1 if a JPEG can not be found
+ */
+int read_input_source(int first_frame, int num_frames, struct frame_cache_source *source) {
+    char in_filename[100];
+    struct stat file_stat;
+
+    source->newest_mtime = 0;
+    source->total_size = 0;
+
+    for (int ndx = first_frame; ndx < first_frame + num_frames; ndx++) {
+        uint64_t mtime;
+
+        snprintf(in_filename, 70, "input/in%06d.jpg", ndx);
+
+        if (stat(in_filename, &file_stat)) {
+            return -1;
+        }
+
+        mtime = (uint64_t) file_stat.st_mtim.tv_sec * 1000000000 + (uint64_t) file_stat.st_mtim.tv_nsec;
+        source->newest_mtime = mtime > source->newest_mtime ? mtime : source->newest_mtime;
+        source->total_size += (uint64_t) file_stat.st_size;
+    }
+
+    return 1;
+}
+
+/**
+ * Checks that the JPEGs a frame cache was packed from have not changed since, so its frames are still theirs
+ *
+ * @param cache cache
+ * @return 1 if they are the same, 0 if they changed or some are gone
+ */
+int cache_matches_input(const struct frame_cache *cache) {
+    struct frame_cache_source source;
+
+    return read_input_source(cache->first_frame, cache->num_frames, &source) == 1 &&
+           source.newest_mtime == cache->source.newest_mtime && source.total_size == cache->source.total_size;
+}
+
+/**
+ * Decodes the frames of the data set once and packs them into the frame cache
+ *
+ * @param number_of_frames frame after the last one to pack
+ */
+void pack_frames(int number_of_frames) {
+    struct frame_cache cache;
+    struct frame_cache_source source;
+    char in_filename[100];
+    int width;
+    int height;
+
+    if (read_jpeg_size("input/in000001.jpg", &width, &height) != 1) {
+        exit(-1);
+    }
+
+    if (read_input_source(1, number_of_frames - 1, &source) != 1) {
+        fprintf(stderr, "Failed to find the input JPEGs of frames 1 to %d\n", number_of_frames - 1);
+        exit(-1);
+    }
+
+    // Frames are decoded straight into the file
+    frame_cache_create(&cache, FRAME_CACHE_FILE, width, height, 1, number_of_frames - 1, &source);
+
+    for (int ndx = 1; ndx < number_of_frames; ndx++) {
+        snprintf(in_filename, 70, "input/in%06d.jpg", ndx);
+
+        if (read_jpeg_file(in_filename, frame_cache_frame(&cache, ndx), width, height) != 1) {
+            exit(-1);
+        }
+    }
+
+    frame_cache_close(&cache);
+    printf("Packed %d %dx%d frames into %s\n", number_of_frames - 1, width, height, FRAME_CACHE_FILE);
+}
 
 /**
- * Writes raw image data to a PNG file
+ * Writes a motion image to a PNG file
  *
  * Taken from: https://github.com/misc0110/libattopng
+ * @param png PNG image to reuse for every frame
  * @param filename File location to save to
- * @param image raw imageuffer
+ * @param image bit-packed motion image
  * @return
  */
-int write_png_file(char *filename, uchar *image) {
-    libattopng_t *png = libattopng_new(WIDTH, HEIGHT, PNG_RGBA);
+int write_png_file(libattopng_mask_t *png, char *filename, const struct bitmask *image) {
+    // Motion pixels are set, and come out as MOTION_PIXEL at 8 bits and STILL_PIXEL otherwise
+    for (int j = 0; j < image->height; j++) {
+        libattopng_mask_set_row(png, j, bitmask_row(image, j));
+    }
 
-    // Get the greyscale value of each pixel and save it as RG
-    for (int i = 0; i < WIDTH; i++) {
-        for (int j = 0; j < HEIGHT; j++) {
-            uchar value = *(image + i * 3 + j * WIDTH * 3);
+    // Write image to disk
+    if(libattopng_mask_save(png, filename)) {
+        fprintf(stderr, "Failed to save png\n");
+        exit(-1);
+    }
 
-            libattopng_set_pixel(png, i, j, RGBA(value, value, value, 255));
+    return 0;
+}
+
+/**
+ * Compares the state of the motion engine with the state of the reference detect_motion implementation
+ *
+ * @param engine motion engine
+ * @param motion_image smoothed motion image produced from the engine
+ * @param background_model reference background model
+ * @param mask reference motion mask
+ * @param reference_image smoothed motion image produced by the reference
+ * @return number of pixels that differ
+ */
+int compare_with_reference(const struct motion_engine *engine, const struct bitmask *motion_image,
+                           const float *background_model, const float *mask, const uchar *reference_image) {
+    int mismatches = 0;
+
+    for (int j = 0; j < engine->height; j++) {
+        for (int i = 0; i < engine->width; i++) {
+            int ndx = i + j * engine->width;
+            int motion = bitmask_get(motion_image, i, j) ? MOTION_PIXEL : STILL_PIXEL;
+            int differs = motion != reference_image[ndx] || engine->mask[ndx] != mask[ndx];
+
+            for (int k = 0; k < 3; k++) {
+                differs |= engine->bg_model[k][ndx] != background_model[ndx * 3 + k];
+            }
+
+            mismatches += differs;
         }
     }
 
-    // Write image to disk
-    if(libattopng_save(png, filename)) {
-        fprintf(stderr, "Failed to save png\n");
+    return mismatches;
+}
+
+/**
+ * Checks if two files hold the same bytes
+ *
+ * @param a first file, read from the start
+ * @param b second file, read from the start
+ * @return 1 if they do, 0 if they differ or can not be read
+ */
+int same_contents(FILE *a, FILE *b) {
+    char buffer_a[4096];
+    char buffer_b[4096];
+    size_t read_a;
+    size_t read_b;
+
+    rewind(a);
+    rewind(b);
+
+    do {
+        read_a = fread(buffer_a, 1, sizeof(buffer_a), a);
+        read_b = fread(buffer_b, 1, sizeof(buffer_b), b);
+
+        if (read_a != read_b || memcmp(buffer_a, buffer_b, read_a) != 0) {
+            return 0;
+        }
+    } while (read_a == sizeof(buffer_a));
+
+    return !ferror(a) && !ferror(b);
+}
+
+/**
+ * Times smoothing and blob labeling on a motion image tiled with BENCHMARK_BLOB_SIZE pixel squares
+ *
+ * Every square should come out as its own blob, however the bands cut through them.
+ *
+ * @param pipeline pipeline to run the benchmark on
+ * @param number_of_frames number of times to label the image
+ * @return 1 if the blobs found did not match the squares, 0 otherwise
+ */
+int run_blob_benchmark(struct pipeline *pipeline, int number_of_frames) {
+    int width = pipeline->width;
+    int height = pipeline->height;
+    int pitch = BENCHMARK_BLOB_SIZE + BENCHMARK_BLOB_GAP;
+    int expected = 0;
+    int failed = 0;
+    struct timespec start;
+    struct timespec end;
+    double run_time;
+
+    bitmask_clear(&pipeline->engine.motion);
+
+    for (int y = BENCHMARK_BLOB_GAP; y + BENCHMARK_BLOB_SIZE <= height; y += pitch) {
+        for (int x = BENCHMARK_BLOB_GAP; x + BENCHMARK_BLOB_SIZE <= width; x += pitch) {
+            for (int j = y; j < y + BENCHMARK_BLOB_SIZE; j++) {
+                bitmask_set_span(bitmask_row(&pipeline->engine.motion, j), x, x + BENCHMARK_BLOB_SIZE);
+            }
+
+            expected++;
+        }
+    }
+
+    // Every square is smoothed again on every run, as if it had just moved
+    motion_engine_scan_motion(&pipeline->engine);
+    expected = expected < MAX_BLOBS ? expected : MAX_BLOBS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int ndx = 0; ndx < number_of_frames; ndx++) {
+        pipeline_smooth(pipeline);
+
+        failed |= pipeline->labeler.num_blobs != expected;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    run_time = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    // Count the runs as frames so the band times are per run
+    pipeline->frames += number_of_frames;
+
+    printf("Labeled %d blobs (%d expected, %d dropped) %d times in %f seconds: %.3f ms per frame\n",
+           pipeline->labeler.num_blobs, expected, pipeline->labeler.dropped, number_of_frames, run_time,
+           run_time * 1000 / number_of_frames);
+
+    return failed;
+}
+
+/**
+ * Decoding thread, decodes the next frame not yet claimed by another decoder until there are none left
+ *
+ * @param ptr replay
+ * @return NULL
+ */
+void *decode_frames(void *ptr) {
+    struct replay *replay = ptr;
+    char in_filename[100];
+    char truth_filename[100];
+
+    g_heap_uncounted = 1;
+    pthread_mutex_lock(&replay->lock);
+
+    while (replay->next_decode < replay->num_frames) {
+        int frame = replay->next_decode++;
+        struct replay_input *slot = &replay->inputs[frame % replay->num_slots];
+
+        // The slot is free once the frame a ring before this one has been detected
+        while (frame - replay->detected >= replay->num_slots) {
+            pthread_cond_wait(&replay->changed, &replay->lock);
+        }
+
+        pthread_mutex_unlock(&replay->lock);
+
+        if (replay->options.cache) {
+            // Cached frames are used where they are mapped, the only cost is reading them in
+            slot->yuv = frame_cache_frame(replay->options.cache, frame);
+        } else {
+            // Read JPEG as YUV
+            snprintf(in_filename, 70, "input/in%06d.jpg", frame);
+
+            if (read_jpeg_file(in_filename, slot->decoded, replay->width, replay->height) != 1) {
+                exit(-1);
+            }
+
+            slot->yuv = slot->decoded;
+        }
+
+        if (replay->options.yuyv) {
+            yuv_to_yuyv(slot->yuv, slot->yuyv, replay->width, replay->height);
+        }
+
+        slot->scored = frame >= replay->options.score_first && frame <= replay->options.score_last;
+
+        if (slot->scored) {
+            snprintf(truth_filename, 70, "groundtruth/gt%06d.png", frame);
+
+            if (ground_truth_load(&slot->truth, truth_filename) != 1) {
+                exit(-1);
+            }
+        }
+
+        pthread_mutex_lock(&replay->lock);
+        slot->frame = frame;
+        slot->ready = 1;
+        pthread_cond_broadcast(&replay->changed);
+    }
+
+    pthread_mutex_unlock(&replay->lock);
+    return NULL;
+}
+
+/**
+ * Encoding thread, writes the motion image of the next detected frame not yet claimed by another encoder until there
+ * are none left
+ *
+ * @param ptr replay
+ * @return NULL
+ */
+void *encode_frames(void *ptr) {
+    struct replay *replay = ptr;
+    libattopng_mask_t *png;
+    char out_filename[100];
+
+    g_heap_uncounted = 1;
+    png = libattopng_mask_new(replay->width, replay->height, replay->options.png_depth, replay->options.png_level);
+
+    if (!png) {
+        fprintf(stderr, "Failed to create png\n");
         exit(-1);
     }
 
-    // Cleanup
-    libattopng_destroy(png);
+    pthread_mutex_lock(&replay->lock);
+
+    while (replay->next_encode < replay->num_frames) {
+        int frame = replay->next_encode++;
+        struct replay_output *slot = &replay->outputs[frame % replay->num_slots];
+
+        while (frame >= replay->detected) {
+            pthread_cond_wait(&replay->changed, &replay->lock);
+        }
+
+        pthread_mutex_unlock(&replay->lock);
+        snprintf(out_filename, 70, "results/bin%06d.png", frame);
+        write_png_file(png, out_filename, &slot->motion_image);
+
+        pthread_mutex_lock(&replay->lock);
+        slot->busy = 0;
+        pthread_cond_broadcast(&replay->changed);
+    }
+
+    pthread_mutex_unlock(&replay->lock);
+    libattopng_mask_destroy(png);
+    return NULL;
+}
+
+/**
+ * Starts the decoding and encoding threads of a replay
+ *
+ * @param replay replay to start
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param first_frame first frame to replay
+ * @param num_frames frame after the last one to replay
+ * @param options how to read the frames and what to do with their motion images
+ */
+void replay_start(struct replay *replay, int width, int height, int first_frame, int num_frames,
+                  const struct replay_options *options) {
+    int num_slots = REPLAY_FRAMES_PER_THREAD * options->num_threads;
+    int scoring = options->score_last > 0;
+    size_t frame_size = (size_t) width * height;
+
+    replay->width = width;
+    replay->height = height;
+    replay->num_frames = num_frames;
+    replay->options = *options;
+    replay->num_slots = num_slots;
+    replay->next_decode = first_frame;
+    replay->next_encode = first_frame;
+    replay->detected = first_frame;
+    pthread_mutex_init(&replay->lock, NULL);
+    pthread_cond_init(&replay->changed, NULL);
+
+    arena_init(&replay->arena, arena_size(sizeof(struct replay_input) * num_slots) +
+                               arena_size(sizeof(struct replay_output) * num_slots) +
+                               num_slots * ((options->cache ? 0 : arena_size(frame_size * 3)) +
+                                            (options->yuyv ? arena_size(frame_size * 2) : 0) +
+                                            (scoring ? ground_truth_arena_size(width, height) : 0) +
+                                            (options->png_depth ? bitmask_arena_size(width, height) : 0)));
+    replay->inputs = arena_alloc(&replay->arena, sizeof(struct replay_input) * num_slots);
+    replay->outputs = arena_alloc(&replay->arena, sizeof(struct replay_output) * num_slots);
+
+    for (int i = 0; i < num_slots; i++) {
+        replay->inputs[i].frame = -1;
+        replay->inputs[i].ready = 0;
+        replay->inputs[i].yuv = NULL;
+        replay->inputs[i].decoded = options->cache ? NULL : arena_alloc(&replay->arena, frame_size * 3);
+        replay->inputs[i].yuyv = options->yuyv ? arena_alloc(&replay->arena, frame_size * 2) : NULL;
+        replay->inputs[i].scored = 0;
+        replay->outputs[i].busy = 0;
+
+        if (scoring) {
+            ground_truth_init(&replay->inputs[i].truth, width, height, &replay->arena);
+        }
+
+        if (options->png_depth) {
+            bitmask_init(&replay->outputs[i].motion_image, width, height, &replay->arena);
+        }
+    }
+
+    for (int i = 0; i < options->num_threads; i++) {
+        if (pthread_create(&replay->decoders[i], NULL, decode_frames, replay) ||
+            (options->png_depth && pthread_create(&replay->encoders[i], NULL, encode_frames, replay))) {
+            fprintf(stderr, "Failed to start the replay threads\n");
+            exit(-1);
+        }
+    }
+}
+
+/**
+ * Waits for the next frame of a replay to be decoded
+ *
+ * @param replay replay
+ * @param frame frame to wait for, the one after the last frame detected
+ * @return decoded frame
+ */
+struct replay_input *replay_next_input(struct replay *replay, int frame) {
+    struct replay_input *slot = &replay->inputs[frame % replay->num_slots];
+
+    pthread_mutex_lock(&replay->lock);
+
+    while (!slot->ready || slot->frame != frame) {
+        pthread_cond_wait(&replay->changed, &replay->lock);
+    }
+
+    pthread_mutex_unlock(&replay->lock);
+
+    return slot;
+}
+
+/**
+ * Hands the motion image of a detected frame over to the encoders, if any, freeing its input slot
+ *
+ * @param replay replay
+ * @param frame frame detected
+ * @param motion_image motion image of the frame
+ */
+void replay_detected(struct replay *replay, int frame, const struct bitmask *motion_image) {
+    struct replay_output *slot = &replay->outputs[frame % replay->num_slots];
+
+    if (replay->options.png_depth) {
+        pthread_mutex_lock(&replay->lock);
+
+        // The slot is free once the frame a ring before this one has been written
+        while (slot->busy) {
+            pthread_cond_wait(&replay->changed, &replay->lock);
+        }
+
+        pthread_mutex_unlock(&replay->lock);
+        memcpy(slot->motion_image.bits, motion_image->bits,
+               (size_t) motion_image->words * motion_image->height * sizeof(uint64_t));
+    }
+
+    pthread_mutex_lock(&replay->lock);
+    slot->busy = replay->options.png_depth != 0;
+    replay->inputs[frame % replay->num_slots].ready = 0;
+    replay->detected = frame + 1;
+    pthread_cond_broadcast(&replay->changed);
+    pthread_mutex_unlock(&replay->lock);
+}
+
+/**
+ * Waits for every frame of a replay to be written and frees it
+ *
+ * @param replay replay
+ */
+void replay_finish(struct replay *replay) {
+    for (int i = 0; i < replay->options.num_threads; i++) {
+        pthread_join(replay->decoders[i], NULL);
+
+        if (replay->options.png_depth) {
+            pthread_join(replay->encoders[i], NULL);
+        }
+    }
+
+    pthread_cond_destroy(&replay->changed);
+    pthread_mutex_destroy(&replay->lock);
+    arena_free(&replay->arena);
 }
 
 /**
  * Test mode main
- * @param arc arg count
- * @param argv arg values: 1 - CDNET data path 2 - test length
+ * @param argc arg count
+ * @param argv arg values: 1 - CDNET data path 2 - test length. Passing -v also runs the reference implementation
+ *             and checks the motion engine against it on every frame. Passing -b runs the blob labeling benchmark
+ *             instead of processing the data set. Passing -j sets the number of decoding and of encoding threads.
+ *             Passing -C packs the decoded frames into the frame cache instead, which later runs replay from.
+ *             Passing -g scores the motion images against the ground truth, and -N skips writing them. Passing -t
+ *             also runs every frame through a pipeline on that many threads and checks its events are the same.
  * @return
  */
-int main(int arc, char *argv[]) {
-    char in_filename[100];
-    char out_filename[100];
+int main(int argc, char *argv[]) {
+    struct worker_pool pool;
+    struct pipeline pipeline;
+    struct worker_pool check_pool;
+    struct pipeline check_pipeline;
+    int check = 0;
+    int check_threads = 0;
+    FILE *check_events = NULL;
+    int events_differ = 0;
+    struct replay replay;
+    struct frame_cache cache;
+    int cached = 0;
+    int pack = 0;
+    FILE *events = NULL;
+    int width;
+    int height;
     int bg_model_ndx = 0;
-    float *background_model = malloc(WIDTH * HEIGHT * 3 * sizeof(float));
+    float *background_model = NULL;
     uchar *background_buffer[BG_MODEL_SIZE];
-    uchar *motion_image = malloc(WIDTH * HEIGHT * 3);
-    float *mask = malloc(WIDTH * HEIGHT * sizeof(float));
-    uchar *raw_image = (uchar *) malloc(WIDTH * HEIGHT * 3);
-    int number_of_test_frames = atoi(argv[2]);
-    clock_t t;
+    uchar *reference_image = NULL;
+    float *mask = NULL;
+    enum frame_format format = FRAME_YUV;
+    int number_of_test_frames;
+    int verify = 0;
+    int benchmark = 0;
+    // Half of the threads decode and half encode, detection already runs on all of them
+    int codec_threads = (worker_pool_default_threads() + 1) / 2;
+    int png_depth = 8;
+    int png_level = 1;
+    int write_pngs = 1;
+    int score = 0;
+    int score_first = 0;
+    int score_last = 0;
+    int scored_frames = 0;
+    struct confusion confusion = {0, 0, 0, 0};
+    struct replay_options replay_options;
+    int motion_frames = 0;
+    struct engine_config config = {BG_BOXCAR, STORAGE_FLOAT, CHANNELS_YUV, NULL, 0};
+    struct schedule_config *schedule = NULL;
+    struct schedule_config schedule_budgets;
+    char *roi_path = NULL;
+    uchar *roi_mask = NULL;
+    int total_mismatches = 0;
+    size_t allocations;
+    size_t steady_state_allocations = 0;
+    int opt;
+    struct timespec start;
+    struct timespec end;
+    struct timespec replay_start_time;
     double run_time = 0;
 
+    while ((opt = getopt(argc, argv, "vbCgNm:s:c:r:i:p:j:d:z:t:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verify = 1;
+                break;
+            case 'b':
+                benchmark = 1;
+                break;
+            case 'C':
+                pack = 1;
+                break;
+            case 'g':
+                score = 1;
+                break;
+            case 'N':
+                write_pngs = 0;
+                break;
+            case 'm':
+                config.model = parse_background_model(optarg);
+                break;
+            case 's':
+                config.storage = parse_model_storage(optarg);
+                break;
+            case 'c':
+                config.channels = parse_channel_mode(optarg);
+                break;
+            case 'r':
+                roi_path = optarg;
+                break;
+            case 'i':
+                parse_schedule(optarg, &schedule_budgets);
+                schedule = &schedule_budgets;
+                break;
+            case 'p':
+                config.pyramid_factor = atoi(optarg);
+                break;
+            case 'j':
+                codec_threads = atoi(optarg);
+                break;
+            case 'd':
+                png_depth = atoi(optarg);
+                break;
+            case 'z':
+                png_level = atoi(optarg);
+                break;
+            case 't':
+                check = 1;
+                check_threads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-v] [-b] [-C] [-g] [-N] [-m boxcar|ema] [-s float|fixed|half] "
+                                "[-c yuv|luma|luma-chroma] [-r roi_file] [-i idle_budgets] [-p 2|4] [-j codec_threads] "
+                                "[-d 1|8] [-z deflate_level] [-t check_threads] cdnet_data_path number_of_frames\n",
+                        argv[0]);
+                exit(-1);
+        }
+    }
+
+    if (argc - optind < 2) {
+        fprintf(stderr, "Usage: %s [-v] [-b] [-C] [-g] [-N] [-m boxcar|ema] [-s float|fixed|half] "
+                        "[-c yuv|luma|luma-chroma] [-r roi_file] [-i idle_budgets] [-p 2|4] [-j codec_threads] "
+                        "[-d 1|8] [-z deflate_level] [-t check_threads] cdnet_data_path number_of_frames\n",
+                argv[0]);
+        exit(-1);
+    }
+
+    if (codec_threads < 1 || codec_threads > MAX_WORKER_THREADS) {
+        fprintf(stderr, "Codec threads must be between 1 and %d\n", MAX_WORKER_THREADS);
+        exit(-1);
+    }
+
+    if (check && (check_threads < 1 || check_threads > MAX_WORKER_THREADS)) {
+        fprintf(stderr, "Check threads must be between 1 and %d\n", MAX_WORKER_THREADS);
+        exit(-1);
+    }
+
+    if ((png_depth != 1 && png_depth != 8) || png_level < 0 || png_level > 9) {
+        fprintf(stderr, "PNG bit depth must be 1 or 8 and deflate level between 0 and 9\n");
+        exit(-1);
+    }
+
+    // The reference implementation only knows the float boxcar model over the whole frame, run on every frame
+    if (verify && (config.model != BG_BOXCAR || config.storage != STORAGE_FLOAT || config.channels != CHANNELS_YUV ||
+                   roi_path || schedule || config.pyramid_factor)) {
+        fprintf(stderr, "Verification is only supported with the float boxcar background model, no region of "
+                        "interest, no scheduler and no coarse to fine detection\n");
+        exit(-1);
+    }
+
+    number_of_test_frames = atoi(argv[optind + 1]);
+
+    // Resolve the region of interest file before leaving the directory it is relative to
+    if (roi_path && !(roi_path = realpath(roi_path, NULL))) {
+        fprintf(stderr, "Failed to find region of interest file: %s\n", strerror(errno));
+        exit(-1);
+    }
+
     // Change dir to test data
-    if (chdir(argv[1])) {
+    if (chdir(argv[optind])) {
         fprintf(stderr, "Failed to change dir\n");
         exit(-1);
     }
@@ -683,58 +1517,242 @@ int main(int arc, char *argv[]) {
         }
     }
 
-    // Initialize background model buffer
-    for (int i = 0; i < BG_MODEL_SIZE; i++) {
-        background_buffer[i] = malloc(WIDTH * HEIGHT * 3);
+    // Pack the frames for later runs and stop there
+    if (pack) {
+        pack_frames(number_of_test_frames);
+        exit(0);
+    }
+
+    // Size everything from the cached frames or else the first frame of the sequence
+    if (frame_cache_open(&cache, FRAME_CACHE_FILE)) {
+        if (!frame_cache_holds(&cache, 1, number_of_test_frames)) {
+            printf("%s holds frames %d to %d, decoding the JPEGs instead\n", FRAME_CACHE_FILE, cache.first_frame,
+                   cache.first_frame + cache.num_frames - 1);
+            frame_cache_close(&cache);
+        } else if (!cache_matches_input(&cache)) {
+            printf("The JPEGs in input/ changed since %s was packed, decoding them instead\n", FRAME_CACHE_FILE);
+            frame_cache_close(&cache);
+        } else {
+            cached = 1;
+            width = cache.width;
+            height = cache.height;
+            printf("Replaying frames from %s\n", FRAME_CACHE_FILE);
+        }
+    }
+
+    if (!cached && read_jpeg_size("input/in000001.jpg", &width, &height) != 1) {
+        exit(-1);
+    }
+
+    // Only the frames in the data set's temporal region of interest are scored, as CDNET does
+    if (score && read_temporal_roi("temporalROI.txt", &score_first, &score_last) != 1) {
+        exit(-1);
+    }
+
+    printf("Processing %dx%d frames\n", width, height);
+    events = fopen("results/events.jsonl", "w+");
+
+    if (!events) {
+        fprintf(stderr, "Failed to open results/events.jsonl\n");
+        exit(-1);
+    }
+
+    // The luma modes read packed YUYV like a camera delivers, so each frame is repacked before it is timed
+    if (config.channels != CHANNELS_YUV) {
+        format = FRAME_YUYV;
+    }
+
+    if (roi_path) {
+        roi_mask = roi_load(roi_path, width, height);
+        config.roi_mask = roi_mask;
+        free(roi_path);
+    }
+
+    worker_pool_init(&pool, worker_pool_default_threads());
+    pipeline_init(&pipeline, width, height, format == FRAME_YUV ? width * 3 : width * 2, format, &config, schedule,
+                  FILTER_SIZE, &pool);
+    printf("Processing %.1f%% of each frame\n", 100.0 * pipeline.engine.roi.watched / ((double) width * height));
+    printf("Using %s detection kernel on %d threads, %s background model in %zu bytes\n",
+           pipeline.engine.kernel->name, pool.num_threads, config.model == BG_BOXCAR ? "boxcar" : "ema",
+           motion_engine_arena_size(width, height, &config));
+
+    // The same frames through bands cut elsewhere must give the same events, byte for byte
+    if (check_threads) {
+        check_events = fopen(CHECK_EVENTS_FILE, "w+");
+
+        if (!check_events) {
+            fprintf(stderr, "Failed to open %s\n", CHECK_EVENTS_FILE);
+            exit(-1);
+        }
+
+        worker_pool_init(&check_pool, check_threads);
+        pipeline_init(&check_pipeline, width, height, format == FRAME_YUV ? width * 3 : width * 2, format, &config,
+                      schedule, FILTER_SIZE, &check_pool);
+    }
+
+    // The model size above still reads the mask
+    free(roi_mask);
+    config.roi_mask = NULL;
+
+    if (benchmark) {
+        int failed = run_blob_benchmark(&pipeline, number_of_test_frames);
+
+        pipeline_print_band_times(&pipeline, stdout);
+        pipeline_free(&pipeline);
+        worker_pool_free(&pool);
+        fclose(events);
+
+        return failed;
     }
 
-    // Fill motion mask with 1.0
-    for (int i = 0; i < WIDTH; i++) {
-        for (int j = 0; j < HEIGHT; j++) {
-            *(mask + i + j * WIDTH) = 1.0f;
+    // Setup reference state, starting from the same zeroed model as the engine
+    if (verify) {
+        background_model = calloc((size_t) width * height * 3, sizeof(float));
+        reference_image = malloc((size_t) width * height);
+        mask = malloc((size_t) width * height * sizeof(float));
+
+        // Initialize background model buffer
+        for (int i = 0; i < BG_MODEL_SIZE; i++) {
+            background_buffer[i] = calloc((size_t) width * height * 3, 1);
+        }
+
+        // Fill motion mask with 1.0
+        for (int i = 0; i < width; i++) {
+            for (int j = 0; j < height; j++) {
+                *(mask + i + j * width) = 1.0f;
+            }
         }
     }
 
-    // Run motion detector on each frame
+    // Run motion detector on each frame, in order, while the frames around it are decoded and written
+    clock_gettime(CLOCK_MONOTONIC, &replay_start_time);
+    replay_options.yuyv = format == FRAME_YUYV;
+    replay_options.png_depth = write_pngs ? png_depth : 0;
+    replay_options.png_level = png_level;
+    replay_options.cache = cached ? &cache : NULL;
+    replay_options.score_first = score_first;
+    replay_options.score_last = score_last;
+    replay_options.num_threads = codec_threads;
+    replay_start(&replay, width, height, 1, number_of_test_frames, &replay_options);
+
     for (int ndx = 1; ndx < number_of_test_frames; ndx++) {
-        snprintf(in_filename, 70, "input/in%06d.jpg", ndx);
-        snprintf(out_filename, 70, "results/bin%06d.png", ndx);
-        // Read JPEG and convert to YUV
-        if (read_jpeg_file(in_filename, raw_image) == 1) {
-            for (int i = 0; i < WIDTH * 3; i += 3) {
-                for (int j = 0; j < HEIGHT; j++) {
-                    uchar b = *(raw_image + i + j * WIDTH * 3);
-                    uchar g = *(raw_image + i + 1 + j * WIDTH * 3);
-                    uchar r = *(raw_image + i + 2 + j * WIDTH * 3);
-
-                    *(raw_image + i + j * WIDTH * 3) = (0.257 * r) + (0.504 * g) + (0.098 * b) + 16;
-                    *(raw_image + i + 1 + j * WIDTH * 3) = (0.439 * r) - (0.368 * g) - (0.071 * b) + 128;
-                    *(raw_image + i + 2 + j * WIDTH * 3) = -(0.148 * r) - (0.291 * g) + (0.439 * b) + 128;
-                }
+        struct replay_input *input = replay_next_input(&replay, ndx);
+        const uchar *frame = input->yuyv ? input->yuyv : input->yuv;
+
+        // The running average has no buffer to fill, so seed it from the first frame instead of from zero
+        if (ndx == 1 && config.model == BG_EMA) {
+            pipeline_bootstrap(&pipeline, frame);
+
+            if (check_threads) {
+                pipeline_bootstrap(&check_pipeline, frame);
             }
+        }
 
-            //Run motion detection and time
-            t = clock();
-            detect_motion(raw_image, background_buffer, background_model, mask, motion_image,
-                          &bg_model_ndx, FILTER_SIZE);
+        //Run motion detection and time
+        allocations = g_heap_allocations;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pipeline_process(&pipeline, frame, ndx / TEST_FRAME_RATE);
 
-            run_time += ((double)(clock() - t)) / CLOCKS_PER_SEC;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        // Wall time, CPU time would add up the time of every worker thread
+        run_time += (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
 
-            // Write png
-            write_png_file(out_filename, motion_image);
-        } else {
-            exit(-1);
+        if (pipeline.labeler.num_blobs > 0) {
+            emit_motion_event(events, 0, &pipeline.tracker, ndx / TEST_FRAME_RATE);
+            motion_frames++;
+        }
+
+        if (input->scored) {
+            confusion_add(&confusion, &pipeline.motion_image, &input->truth);
+            scored_frames++;
+        }
+
+        // Everything past the first frame should run out of preallocated buffers
+        if (ndx > 1) {
+            steady_state_allocations += g_heap_allocations - allocations;
+        }
+
+        // Check the engine against the reference implementation
+        if (verify) {
+            int mismatches;
+
+            detect_motion(input->yuv, background_buffer, background_model, mask, reference_image,
+                          &bg_model_ndx, FILTER_SIZE, width, height);
+            mismatches = compare_with_reference(&pipeline.engine, &pipeline.motion_image, background_model,
+                                                mask, reference_image);
+
+            if (mismatches) {
+                printf("Image %d differs from the reference in %d pixels\n", ndx, mismatches);
+            }
+
+            total_mismatches += mismatches;
+        }
+
+        if (check_threads) {
+            pipeline_process(&check_pipeline, frame, ndx / TEST_FRAME_RATE);
+
+            if (check_pipeline.labeler.num_blobs > 0) {
+                emit_motion_event(check_events, 0, &check_pipeline.tracker, ndx / TEST_FRAME_RATE);
+            }
         }
 
-        printf("Finished image %d\n", ndx);
+        replay_detected(&replay, ndx, &pipeline.motion_image);
+    }
+
+    replay_finish(&replay);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
+    if (cached) {
+        frame_cache_close(&cache);
     }
 
     // Print stats
     printf("Finished in processing %d frames in %f seconds. FPS: %f\n", number_of_test_frames, run_time,
            number_of_test_frames / run_time);
+    printf("Replayed in %f seconds with %d decoding and %d encoding threads, %d frames with motion, %d blobs and "
+           "%d tracks on the last one\n", (double) (end.tv_sec - replay_start_time.tv_sec) +
+           (double) (end.tv_nsec - replay_start_time.tv_nsec) / 1e9, codec_threads, write_pngs ? codec_threads : 0,
+           motion_frames,
+           pipeline.labeler.num_blobs, pipeline.tracker.num_tracks);
+    printf("Heap allocations after the first frame: %zu\n", steady_state_allocations);
+
+    if (score) {
+        confusion_print(&confusion, scored_frames, stdout);
+    }
+
+    scheduler_print_stats(&pipeline.scheduler, stdout);
+    pyramid_print_stats(&pipeline.engine.pyramid, stdout);
+    tracker_print_stats(&pipeline.tracker, stdout);
+
+    if (verify) {
+        printf("Verification against reference: %s (%d mismatched pixels)\n",
+               total_mismatches ? "FAILED" : "PASSED", total_mismatches);
+
+        for (int i = 0; i < BG_MODEL_SIZE; i++) {
+            free(background_buffer[i]);
+        }
+
+        free(background_model);
+        free(reference_image);
+        free(mask);
+    }
+
+    if (check_threads) {
+        events_differ = !same_contents(events, check_events);
+        printf("Events on %d threads against %d threads: %s\n", pool.num_threads, check_pool.num_threads,
+               events_differ ? "FAILED" : "PASSED");
+
+        pipeline_free(&check_pipeline);
+        worker_pool_free(&check_pool);
+        fclose(check_events);
+    }
+
+    pipeline_print_band_times(&pipeline, stdout);
+    pipeline_free(&pipeline);
+    worker_pool_free(&pool);
+    fclose(events);
 
-    free(raw_image);
+    return (total_mismatches || steady_state_allocations || events_differ) ? 1 : 0;
 }
 
 #endif
@@ -0,0 +1,777 @@
+/**
+ * Planar motion detection engine
+ *
+ * Row-major replacement for the column-major detect_motion loop. Every plane is walked front to back once per frame,
+ * one row at a time through the detection kernel picked for this CPU.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motion_engine.h"
+
+/**
+ * Width of the U and V planes of the fixed point model
+ *
+ * @param width width of the frames
+ * @param storage model storage
+ * @return width in pixels
+ */
+static int fixed_chroma_width(int width, enum model_storage storage) {
+    return storage == STORAGE_FIXED_HALF_CHROMA ? (width + 1) / 2 : width;
+}
+
+/**
+ * Storage the model actually uses, the luma modes only work on the fixed point layout with half resolution chroma
+ *
+ * @param config background model options
+ * @return model storage
+ */
+static enum model_storage config_storage(const struct engine_config *config) {
+    return config->channels == CHANNELS_YUV ? config->storage : STORAGE_FIXED_HALF_CHROMA;
+}
+
+/**
+ * Size of one frame in the background buffer
+ *
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param channels channels differenced against the background
+ * @return size in bytes
+ */
+static size_t buffer_frame_size(int width, int height, enum channel_mode channels) {
+    size_t plane_size = (size_t) width * height;
+    size_t chroma_size = (size_t) fixed_chroma_width(width, STORAGE_FIXED_HALF_CHROMA) * height;
+
+    switch (channels) {
+        case CHANNELS_LUMA:
+            return plane_size;
+        case CHANNELS_LUMA_CHROMA:
+            return plane_size + 2 * chroma_size;
+        default:
+        case CHANNELS_YUV:
+            return plane_size * 3;
+    }
+}
+
+/**
+ * Number of dirty map tiles needed to cover a row
+ *
+ * @param width width of the frames
+ * @return number of tiles
+ */
+static int dirty_tile_count(int width) {
+    return (width + DIRTY_TILE_WIDTH - 1) / DIRTY_TILE_WIDTH;
+}
+
+/**
+ * Arena space needed by a motion engine
+ *
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param config background model options
+ * @return size in bytes
+ */
+size_t motion_engine_arena_size(int width, int height, const struct engine_config *config) {
+    size_t plane_size = (size_t) width * height;
+    enum model_storage storage = config_storage(config);
+    size_t size = 4 * arena_size(width) + arena_size(plane_size * sizeof(float)) + bitmask_arena_size(width, height) +
+                  roi_arena_size(config->roi_mask, width, height) +
+                  pyramid_arena_size(width, height, config->pyramid_factor) +
+                  arena_size(sizeof(struct roi_span) * motion_engine_max_row_spans(width)) +
+                  arena_size((size_t) dirty_tile_count(width) * height);
+
+    if (storage == STORAGE_FLOAT) {
+        size += 3 * arena_size(plane_size * sizeof(float));
+    } else {
+        size_t chroma_size = (size_t) fixed_chroma_width(width, storage) * height;
+
+        size += arena_size(plane_size * sizeof(uint16_t));
+
+        if (config->channels != CHANNELS_LUMA) {
+            size += 2 * arena_size(chroma_size * sizeof(uint16_t));
+        }
+    }
+
+    if (config->model == BG_BOXCAR) {
+        size += BG_MODEL_SIZE * arena_size(buffer_frame_size(width, height, config->channels));
+    }
+
+    return size;
+}
+
+/**
+ * Initializes a motion engine for frames of the given size and format
+ *
+ * The background model starts out zeroed and the motion mask at full sensitivity. Pixels outside the region of
+ * interest stay still in the motion image.
+ *
+ * @param engine engine to initialize
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param stride bytes between the start of two rows of a frame
+ * @param format layout of the frames
+ * @param config background model options
+ * @param arena arena to allocate the engine's planes from
+ */
+void motion_engine_init(struct motion_engine *engine, int width, int height, int stride, enum frame_format format,
+                        const struct engine_config *config, struct arena *arena) {
+    size_t plane_size = (size_t) width * height;
+
+    if (config->channels != CHANNELS_YUV && (format != FRAME_YUYV || width % 2)) {
+        fprintf(stderr, "Luma only detection needs YUYV frames of even width\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (config->pyramid_factor != 0 && config->pyramid_factor != 2 && config->pyramid_factor != 4) {
+        fprintf(stderr, "Coarse to fine detection downsamples by 2 or 4, not %d\n", config->pyramid_factor);
+        exit(EXIT_FAILURE);
+    }
+
+    engine->width = width;
+    engine->height = height;
+    engine->stride = stride;
+    engine->format = format;
+    engine->model = config->model;
+    engine->storage = config_storage(config);
+    engine->channels = config->channels;
+    engine->chroma_width = fixed_chroma_width(width, engine->storage);
+    engine->bg_model_ndx = 0;
+    engine->kernel = select_detect_kernel(width);
+    engine->span_kernel = generic_detect_kernel(engine->kernel);
+
+    for (int k = 0; k < 3; k++) {
+        size_t fixed_size = (size_t) (k == 0 ? width : engine->chroma_width) * height;
+
+        if (engine->storage == STORAGE_FLOAT) {
+            engine->bg_model[k] = arena_alloc(arena, plane_size * sizeof(float));
+            engine->bg_fixed[k] = NULL;
+        } else if (k > 0 && engine->channels == CHANNELS_LUMA) {
+            engine->bg_model[k] = NULL;
+            engine->bg_fixed[k] = NULL;
+        } else {
+            engine->bg_model[k] = NULL;
+            engine->bg_fixed[k] = arena_alloc(arena, fixed_size * sizeof(uint16_t));
+        }
+
+        engine->row[k] = arena_alloc(arena, width);
+    }
+
+    engine->row[3] = arena_alloc(arena, width);
+
+    for (int i = 0; i < BG_MODEL_SIZE; i++) {
+        engine->bg_buffer[i] = NULL;
+
+        if (engine->model == BG_BOXCAR) {
+            engine->bg_buffer[i] = arena_alloc(arena, buffer_frame_size(width, height, engine->channels));
+        }
+    }
+
+    engine->mask = arena_alloc(arena, plane_size * sizeof(float));
+    bitmask_init(&engine->motion, width, height, arena);
+    engine->dirty_width = dirty_tile_count(width);
+    engine->dirty = arena_alloc(arena, (size_t) engine->dirty_width * height);
+    memset(engine->dirty, 0, (size_t) engine->dirty_width * height);
+    roi_init(&engine->roi, config->roi_mask, width, height, arena);
+    // A tile stays active until the boxcar model has forgotten the last change in it
+    pyramid_init(&engine->pyramid, width, height, stride, format == FRAME_YUYV ? 2 : 3, config->pyramid_factor,
+                 BG_MODEL_SIZE, arena);
+    engine->spans = arena_alloc(arena, sizeof(struct roi_span) * motion_engine_max_row_spans(width));
+
+    // Fill motion mask with 1.0
+    for (size_t i = 0; i < plane_size; i++) {
+        engine->mask[i] = 1.0f;
+    }
+}
+
+/**
+ * Unpacks pixels [start, end) of row j of a frame into Y, U and V row buffers
+ *
+ * @param engine motion engine
+ * @param frame frame to unpack
+ * @param j row to unpack
+ * @param start first pixel to unpack, even
+ * @param end pixel after the last one to unpack
+ * @param row Y, U and V row buffers, each width bytes long
+ */
+static void unpack_row(const struct motion_engine *engine, const uchar *frame, int j, int start, int end,
+                       uchar *const *row) {
+    uchar *y = row[0];
+    uchar *u = row[1];
+    uchar *v = row[2];
+
+    if (engine->format == FRAME_YUYV) {
+        const uchar *src = frame + (size_t) j * engine->stride;
+
+        // Each YUYV macro pixel holds two luma samples sharing one chroma pair
+        for (int i = start; i < end; i += 2) {
+            y[i] = src[i * 2];
+            y[i + 1] = src[i * 2 + 2];
+            u[i] = u[i + 1] = src[i * 2 + 1];
+            v[i] = v[i + 1] = src[i * 2 + 3];
+        }
+    } else {
+        const uchar *src = frame + (size_t) j * engine->stride;
+
+        for (int i = start; i < end; i++) {
+            y[i] = src[i * 3];
+            u[i] = src[i * 3 + 1];
+            v[i] = src[i * 3 + 2];
+        }
+    }
+}
+
+/**
+ * Finds the Y, U and V rows of row j of a frame in the background buffer
+ *
+ * @param engine motion engine
+ * @param frame frame in the background buffer, NULL if the model keeps no buffer
+ * @param j row to find
+ * @param rows set to the Y, U and V rows, NULL for channels that are not kept
+ */
+static void buffer_rows(const struct motion_engine *engine, uchar *frame, int j, uchar **rows) {
+    size_t plane_size = (size_t) engine->width * engine->height;
+    size_t chroma_size = (size_t) engine->chroma_width * engine->height;
+
+    for (int k = 0; k < 3; k++) {
+        rows[k] = NULL;
+    }
+
+    if (!frame) {
+        return;
+    }
+
+    rows[0] = frame + (size_t) j * engine->width;
+
+    if (engine->channels == CHANNELS_YUV) {
+        rows[1] = frame + plane_size + (size_t) j * engine->width;
+        rows[2] = frame + 2 * plane_size + (size_t) j * engine->width;
+    } else if (engine->channels == CHANNELS_LUMA_CHROMA) {
+        rows[1] = frame + plane_size + (size_t) j * engine->chroma_width;
+        rows[2] = frame + plane_size + chroma_size + (size_t) j * engine->chroma_width;
+    }
+}
+
+/**
+ * Folds one channel of a row of a bootstrap frame into the fixed point model
+ *
+ * @param engine motion engine
+ * @param new_row channel of the new row
+ * @param bg_row same channel of the fixed point model
+ * @param half_chroma 1 if the channel is kept for every other pixel only
+ */
+static void bootstrap_fixed_row(const struct motion_engine *engine, const uchar *new_row, uint16_t *bg_row,
+                                int half_chroma) {
+    int step = half_chroma ? 2 : 1;
+
+    for (int i = 0; i < engine->width; i += step) {
+        int value = half_chroma ? chroma_pair_value(new_row, i, engine->width) : new_row[i];
+        uint16_t *bg = bg_row + i / step;
+
+        if (engine->model == BG_BOXCAR) {
+            *bg = *bg + value;
+        } else {
+            *bg = value * FIXED_EMA_SCALE;
+        }
+    }
+}
+
+/**
+ * Adds a frame to the background model while the background buffer is first being filled
+ *
+ * The exponential moving average model has no buffer to fill and starts out as a copy of the first frame.
+ *
+ * @param engine motion engine
+ * @param frame new frame from the video source
+ * @return 1 once the background buffer is full, 0 otherwise
+ */
+int motion_engine_bootstrap(struct motion_engine *engine, const uchar *frame) {
+    uchar *slot = engine->bg_buffer[engine->bg_model_ndx];
+
+    if (engine->pyramid.factor) {
+        pyramid_bootstrap(&engine->pyramid, frame);
+    }
+
+    for (int j = 0; j < engine->height; j++) {
+        size_t offset = (size_t) j * engine->width;
+        uchar *slot_row[3];
+
+        // Speed does not matter here, so the luma modes unpack like the others
+        unpack_row(engine, frame, j, 0, engine->width, engine->row);
+        buffer_rows(engine, slot, j, slot_row);
+
+        for (int k = 0; k < 3; k++) {
+            if (k > 0 && engine->channels == CHANNELS_LUMA) {
+                continue;
+            }
+
+            if (engine->storage != STORAGE_FLOAT) {
+                int chroma = k > 0 && engine->storage == STORAGE_FIXED_HALF_CHROMA;
+                int plane_width = k == 0 ? engine->width : engine->chroma_width;
+
+                bootstrap_fixed_row(engine, engine->row[k], engine->bg_fixed[k] + (size_t) j * plane_width, chroma);
+            } else {
+                float *bg_row = engine->bg_model[k] + offset;
+
+                for (int i = 0; i < engine->width; i++) {
+                    if (engine->model == BG_BOXCAR) {
+                        bg_row[i] = bg_row[i] + (float) engine->row[k][i] / BG_MODEL_SIZE;
+                    } else {
+                        bg_row[i] = engine->row[k][i];
+                    }
+                }
+            }
+
+            if (!slot_row[k]) {
+                continue;
+            }
+
+            if (k > 0 && engine->channels == CHANNELS_LUMA_CHROMA) {
+                // YUYV chroma is shared by each pair, so either pixel of the pair holds it
+                for (int i = 0; i < engine->chroma_width; i++) {
+                    slot_row[k][i] = engine->row[k][i * 2];
+                }
+            } else {
+                memcpy(slot_row[k], engine->row[k], engine->width);
+            }
+        }
+    }
+
+    if (engine->model == BG_EMA) {
+        return 1;
+    }
+
+    engine->bg_model_ndx++;
+
+    if (engine->bg_model_ndx >= BG_MODEL_SIZE) {
+        engine->bg_model_ndx = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Row functions of a kernel for the model, storage and channels of an engine
+ */
+struct row_kernels {
+    detect_row_fn detect_row;
+    detect_row_fixed_fn detect_row_fixed;
+    detect_row_packed_fn detect_row_packed;
+};
+
+/**
+ * Picks the row functions of a kernel matching an engine's options
+ *
+ * @param engine motion engine
+ * @param kernel kernel to pick from
+ * @param row_kernels set to the row functions
+ */
+static void pick_row_kernels(const struct motion_engine *engine, const struct detect_kernel *kernel,
+                             struct row_kernels *row_kernels) {
+    int ema = engine->model == BG_EMA;
+
+    row_kernels->detect_row = ema ? kernel->detect_row_ema : kernel->detect_row;
+
+    if (engine->storage == STORAGE_FIXED_HALF_CHROMA) {
+        row_kernels->detect_row_fixed = ema ? kernel->detect_row_half_ema : kernel->detect_row_half;
+    } else {
+        row_kernels->detect_row_fixed = ema ? kernel->detect_row_fixed_ema : kernel->detect_row_fixed;
+    }
+
+    if (engine->channels == CHANNELS_LUMA_CHROMA) {
+        row_kernels->detect_row_packed = ema ? kernel->detect_row_luma_chroma_ema : kernel->detect_row_luma_chroma;
+    } else {
+        row_kernels->detect_row_packed = ema ? kernel->detect_row_luma_ema : kernel->detect_row_luma;
+    }
+}
+
+/**
+ * Runs the coarse pass over a band of rows of a frame, does nothing unless coarse to fine detection is on
+ *
+ * Bands that do not overlap can be run in parallel. Once every band of a frame is done, motion_engine_flag_tiles must
+ * be called before detecting the frame.
+ *
+ * @param engine motion engine
+ * @param frame new frame from the video source
+ * @param first_row first row of the band
+ * @param last_row row after the last row of the band
+ */
+void motion_engine_coarse_rows(struct motion_engine *engine, const uchar *frame, int first_row, int last_row) {
+    if (engine->pyramid.factor) {
+        pyramid_coarse_rows(&engine->pyramid, frame, first_row, last_row);
+    }
+}
+
+/**
+ * Picks the tiles to process in the current frame from the coarse pass, does nothing unless coarse to fine detection
+ * is on
+ *
+ * @param engine motion engine
+ */
+void motion_engine_flag_tiles(struct motion_engine *engine) {
+    if (engine->pyramid.factor) {
+        pyramid_flag_tiles(&engine->pyramid);
+    }
+}
+
+/**
+ * Most spans motion_engine_row_spans() or motion_engine_dirty_spans() can return for a row
+ *
+ * @param width width of the frames
+ * @return number of spans
+ */
+size_t motion_engine_max_row_spans(int width) {
+    return (size_t) (width + 1) / 2 + (width + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE + dirty_tile_count(width);
+}
+
+/**
+ * Spans of a row in tiles of a given state, within the region of interest
+ *
+ * Without coarse to fine detection every tile is active.
+ *
+ * @param engine motion engine
+ * @param j row
+ * @param state state of the tiles to cover
+ * @param spans room for motion_engine_max_row_spans() spans, used if the spans have to be worked out
+ * @param count set to the number of spans
+ * @return first span of the row
+ */
+const struct roi_span *motion_engine_row_spans(const struct motion_engine *engine, int j, enum tile_state state,
+                                               struct roi_span *spans, int *count) {
+    if (engine->pyramid.factor) {
+        *count = pyramid_row_spans(&engine->pyramid, &engine->roi, j, state, spans);
+        return spans;
+    }
+
+    if (state != TILE_ACTIVE) {
+        *count = 0;
+        return spans;
+    }
+
+    return roi_row(&engine->roi, j, count);
+}
+
+/**
+ * Updates the dirty map of a row once its motion has been detected
+ *
+ * @param engine motion engine
+ * @param j row
+ * @return 1 if any tile of the row is dirty, 0 otherwise
+ */
+static int flag_dirty_row(const struct motion_engine *engine, int j) {
+    uchar *flags = engine->dirty + (size_t) j * engine->dirty_width;
+    const uint64_t *motion = bitmask_row(&engine->motion, j);
+    int dirty = 0;
+
+    // Each tile is a word of the motion plane
+    for (int t = 0; t < engine->dirty_width; t++) {
+        flags[t] = (flags[t] & DIRTY_MOTION ? DIRTY_HAD_MOTION : 0) | (motion[t] ? DIRTY_MOTION : 0);
+        dirty |= flags[t];
+    }
+
+    return dirty != 0;
+}
+
+/**
+ * Differences a band of rows of a frame against the background model, updating the model, background buffer and mask
+ * in the same pass
+ *
+ * Only the spans of the active tiles within the region of interest are processed, the motion of tiles that just went
+ * idle is cleared. Every pixel is independent, so bands that do not overlap can be processed in parallel. Once every
+ * band of a frame is done, motion_engine_advance must be called before the next frame.
+ *
+ * The dirty map of each row is updated once the row is done. A band none of whose rows is dirty has no motion in this
+ * frame nor in the last one, so its smoothed motion is unchanged.
+ *
+ * @param engine motion engine
+ * @param frame new frame from the video source
+ * @param first_row first row of the band
+ * @param last_row row after the last row of the band
+ * @param row Y, U and V row buffers for the band and a row buffer for its motion, each width bytes long
+ * @param spans room for motion_engine_max_row_spans() spans for the band
+ * @return number of rows of the band with a dirty tile
+ */
+int motion_engine_detect_rows(const struct motion_engine *engine, const uchar *frame, int first_row, int last_row,
+                              uchar *const *row, struct roi_span *spans) {
+    uchar *oldest = engine->bg_buffer[engine->bg_model_ndx];
+    // Chroma of the model and of the background buffer may be kept for every other pixel only
+    int model_chroma_shift = engine->storage == STORAGE_FIXED_HALF_CHROMA;
+    int buffer_chroma_shift = engine->channels == CHANNELS_LUMA_CHROMA;
+    struct row_kernels full_row;
+    struct row_kernels span;
+    int dirty_rows = 0;
+
+    // Whole rows go through the kernel specialized for the frame width
+    pick_row_kernels(engine, engine->kernel, &full_row);
+    pick_row_kernels(engine, engine->span_kernel, &span);
+
+    for (int j = first_row; j < last_row; j++) {
+        size_t offset = (size_t) j * engine->width;
+        size_t chroma_offset = (size_t) j * engine->chroma_width;
+        int num_spans;
+        const struct roi_span *row_spans = motion_engine_row_spans(engine, j, TILE_CLEARING, spans, &num_spans);
+        uint64_t *motion_bits = bitmask_row(&engine->motion, j);
+        uchar *oldest_row[3];
+
+        for (int s = 0; s < num_spans; s++) {
+            bitmask_clear_span(motion_bits, row_spans[s].start, row_spans[s].end);
+        }
+
+        row_spans = motion_engine_row_spans(engine, j, TILE_ACTIVE, spans, &num_spans);
+        buffer_rows(engine, oldest, j, oldest_row);
+
+        for (int s = 0; s < num_spans; s++) {
+            int start = row_spans[s].start;
+            int width = row_spans[s].end - start;
+            const struct row_kernels *kernels = width == engine->width ? &full_row : &span;
+            float *mask_row = engine->mask + offset + start;
+            // The kernels write a byte per pixel, packed into the motion plane once the span is done
+            uchar *motion_row = row[3] + start;
+            uchar *new_row[3] = {row[0] + start, row[1] + start, row[2] + start};
+            uchar *oldest_span[3] = {NULL, NULL, NULL};
+
+            for (int k = 0; k < 3; k++) {
+                if (oldest_row[k]) {
+                    oldest_span[k] = oldest_row[k] + (k == 0 ? start : start >> buffer_chroma_shift);
+                }
+            }
+
+            // The luma modes read the frame in place
+            if (engine->channels != CHANNELS_YUV) {
+                int chroma = engine->channels == CHANNELS_LUMA_CHROMA;
+                uint16_t *bg_row[3] = {engine->bg_fixed[0] + offset + start,
+                                       chroma ? engine->bg_fixed[1] + chroma_offset + start / 2 : NULL,
+                                       chroma ? engine->bg_fixed[2] + chroma_offset + start / 2 : NULL};
+
+                kernels->detect_row_packed(frame + (size_t) j * engine->stride + (size_t) start * 2, oldest_span,
+                                           bg_row, mask_row, motion_row, width);
+            } else if (engine->storage == STORAGE_FLOAT) {
+                float *bg_row[3] = {engine->bg_model[0] + offset + start, engine->bg_model[1] + offset + start,
+                                    engine->bg_model[2] + offset + start};
+
+                unpack_row(engine, frame, j, start, start + width, row);
+                kernels->detect_row(new_row, oldest_span, bg_row, mask_row, motion_row, width);
+            } else {
+                size_t chroma_start = chroma_offset + (start >> model_chroma_shift);
+                uint16_t *bg_row[3] = {engine->bg_fixed[0] + offset + start, engine->bg_fixed[1] + chroma_start,
+                                       engine->bg_fixed[2] + chroma_start};
+
+                unpack_row(engine, frame, j, start, start + width, row);
+                kernels->detect_row_fixed(new_row, oldest_span, bg_row, mask_row, motion_row, width);
+            }
+
+            bitmask_pack_span(motion_bits, row[3], start, start + width);
+        }
+
+        dirty_rows += flag_dirty_row(engine, j);
+    }
+
+    return dirty_rows;
+}
+
+/**
+ * Rebuilds the dirty map from the whole motion plane, for callers writing engine->motion themselves
+ *
+ * @param engine motion engine
+ */
+void motion_engine_scan_motion(struct motion_engine *engine) {
+    for (int j = 0; j < engine->height; j++) {
+        flag_dirty_row(engine, j);
+    }
+}
+
+/**
+ * Whether any tile near a tile of the motion plane is dirty
+ *
+ * @param engine motion engine
+ * @param t column of the tile
+ * @param first_row first row to look at
+ * @param last_row last row to look at
+ * @param halo tiles to look at on each side
+ * @return nonzero if a tile is dirty
+ */
+static int near_dirty(const struct motion_engine *engine, int t, int first_row, int last_row, int halo) {
+    int first = t - halo > 0 ? t - halo : 0;
+    int last = t + halo < engine->dirty_width - 1 ? t + halo : engine->dirty_width - 1;
+    uchar dirty = 0;
+
+    for (int j = first_row; j <= last_row; j++) {
+        const uchar *flags = engine->dirty + (size_t) j * engine->dirty_width;
+
+        for (int k = first; k <= last; k++) {
+            dirty |= flags[k];
+        }
+    }
+
+    return dirty;
+}
+
+/**
+ * Cuts the spans of a row of the smoothed motion image down to the tiles whose filter window reaches a dirty tile
+ *
+ * Tiles whose window is clean had no motion to filter in this frame or the last, so their smoothed motion is still
+ * from the frame before and does not need to be worked out again.
+ *
+ * @param engine motion engine
+ * @param j row
+ * @param radius reach of the filter, in pixels
+ * @param spans spans of the row to smooth
+ * @param num_spans number of spans
+ * @param dirty room for motion_engine_max_row_spans() spans, filled with the spans to smooth
+ * @return number of dirty spans
+ */
+int motion_engine_dirty_spans(const struct motion_engine *engine, int j, int radius, const struct roi_span *spans,
+                              int num_spans, struct roi_span *dirty) {
+    int first_row = j - radius > 0 ? j - radius : 0;
+    int last_row = j + radius < engine->height - 1 ? j + radius : engine->height - 1;
+    int halo = (radius + DIRTY_TILE_WIDTH - 1) / DIRTY_TILE_WIDTH;
+    int num_dirty = 0;
+    int s = 0;
+
+    for (int t = 0; t < engine->dirty_width && s < num_spans;) {
+        int start;
+        int end;
+
+        if (!near_dirty(engine, t, first_row, last_row, halo)) {
+            t++;
+            continue;
+        }
+
+        // Neighbouring dirty tiles make one run
+        for (start = t * DIRTY_TILE_WIDTH; t < engine->dirty_width && near_dirty(engine, t, first_row, last_row, halo);
+             t++);
+
+        end = t * DIRTY_TILE_WIDTH < engine->width ? t * DIRTY_TILE_WIDTH : engine->width;
+
+        while (s < num_spans && spans[s].end <= start) {
+            s++;
+        }
+
+        for (int q = s; q < num_spans && spans[q].start < end; q++) {
+            dirty[num_dirty].start = spans[q].start > start ? spans[q].start : start;
+            dirty[num_dirty].end = spans[q].end < end ? spans[q].end : end;
+            num_dirty++;
+        }
+    }
+
+    return num_dirty;
+}
+
+/**
+ * Moves on to the next frame once every row of the current frame has been processed
+ *
+ * @param engine motion engine
+ */
+void motion_engine_advance(struct motion_engine *engine) {
+    // Increment oldest background model value
+    engine->bg_model_ndx = (engine->bg_model_ndx + 1) % BG_MODEL_SIZE;
+}
+
+/**
+ * Differences a frame against the background model, updating the model, background buffer and mask in the same pass
+ *
+ * The thresholded output is left in engine->motion.
+ *
+ * @param engine motion engine
+ * @param frame new frame from the video source
+ */
+void motion_engine_detect(struct motion_engine *engine, const uchar *frame) {
+    motion_engine_coarse_rows(engine, frame, 0, engine->height);
+    motion_engine_flag_tiles(engine);
+    motion_engine_detect_rows(engine, frame, 0, engine->height, engine->row, engine->spans);
+    motion_engine_advance(engine);
+}
+
+/**
+ * Counts the pixels of a sparse grid that would be motion pixels, without updating anything
+ *
+ * Samples every step-th pixel of every step-th row inside the region of interest and differences it against the
+ * background model and mask as the kernels do, but in both directions. The kernels only flag pixels brighter than the
+ * model and see a darker object once the model has learnt it, which a model frozen while idle never does.
+ *
+ * @param engine motion engine
+ * @param frame new frame from the video source
+ * @param step distance between two samples, in pixels
+ * @return number of samples over the threshold
+ */
+int motion_engine_sample_motion(const struct motion_engine *engine, const uchar *frame, int step) {
+    float scale = engine->model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE;
+    int changed = 0;
+
+    for (int j = 0; j < engine->height; j += step) {
+        const uchar *src = frame + (size_t) j * engine->stride;
+        size_t offset = (size_t) j * engine->width;
+        int num_spans;
+        const struct roi_span *spans = roi_row(&engine->roi, j, &num_spans);
+
+        for (int s = 0; s < num_spans; s++) {
+            // Keep to the same grid of columns whatever the span starts on
+            for (int i = (spans[s].start + step - 1) / step * step; i < spans[s].end; i += step) {
+                float new_value[3];
+                float bg_value[3];
+                double pixel_mag = 0.0;
+
+                if (engine->format == FRAME_YUYV) {
+                    new_value[0] = src[i * 2];
+                    new_value[1] = src[(i & ~1) * 2 + 1];
+                    new_value[2] = src[(i & ~1) * 2 + 3];
+                } else {
+                    new_value[0] = src[i * 3];
+                    new_value[1] = src[i * 3 + 1];
+                    new_value[2] = src[i * 3 + 2];
+                }
+
+                for (int k = 0; k < 3; k++) {
+                    if (k > 0 && engine->channels == CHANNELS_LUMA) {
+                        // Chroma counts as matching the background
+                        new_value[k] = 0;
+                        bg_value[k] = 0;
+                    } else if (engine->storage == STORAGE_FLOAT) {
+                        bg_value[k] = engine->bg_model[k][offset + i];
+                    } else if (k > 0 && engine->storage == STORAGE_FIXED_HALF_CHROMA) {
+                        bg_value[k] = engine->bg_fixed[k][(size_t) j * engine->chroma_width + i / 2] / scale;
+                    } else {
+                        bg_value[k] = engine->bg_fixed[k][offset + i] / scale;
+                    }
+                }
+
+                for (int k = 0; k < 3; k++) {
+                    float new_out_value = (fabsf(new_value[k] - bg_value[k]) + 127.0f) * engine->mask[offset + i];
+                    pixel_mag += (double) new_out_value * new_out_value;
+                }
+
+                changed += pixel_mag >= (double) THRESHOLD * THRESHOLD;
+            }
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Reads row j of the background model as Y, U and V bytes, whatever the model's storage
+ *
+ * @param engine motion engine
+ * @param j row to read
+ * @param row Y, U and V row buffers, each width bytes long
+ */
+void motion_engine_background_row(const struct motion_engine *engine, int j, uchar *const *row) {
+    int scale = engine->model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE;
+
+    for (int k = 0; k < 3; k++) {
+        for (int i = 0; i < engine->width; i++) {
+            if (k > 0 && engine->channels == CHANNELS_LUMA) {
+                // No chroma is kept, show the luma in gray
+                row[k][i] = 128;
+            } else if (engine->storage == STORAGE_FLOAT) {
+                row[k][i] = (uchar) engine->bg_model[k][(size_t) j * engine->width + i];
+            } else if (k > 0 && engine->storage == STORAGE_FIXED_HALF_CHROMA) {
+                row[k][i] = engine->bg_fixed[k][(size_t) j * engine->chroma_width + i / 2] / scale;
+            } else {
+                row[k][i] = engine->bg_fixed[k][(size_t) j * engine->width + i] / scale;
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/**
+ * Planar motion detection engine
+ *
+ * Keeps the background model, background buffer and motion mask as separate row-major planes so a frame can be
+ * differenced, thresholded and folded into the model in a single streaming pass.
+ */
+
+#ifndef MOTION_DETECTOR_MOTION_ENGINE_H
+#define MOTION_DETECTOR_MOTION_ENGINE_H
+
+#include "image_manipulation.h"
+#include "motion_kernels.h"
+#include "arena.h"
+#include "bitmask.h"
+#include "pyramid.h"
+#include "roi.h"
+
+// Model Parameters
+#define BG_MODEL_SIZE 10
+#define THRESHOLD 225
+
+// Scale of the 16 bit fixed point background model. The boxcar model keeps the exact sum of the frames in the buffer
+// and the exponential moving average keeps the mean in Q8.8.
+#define FIXED_BOXCAR_SCALE BG_MODEL_SIZE
+#define FIXED_EMA_SCALE 256
+
+#if BG_MODEL_SIZE * 255 > UINT16_MAX
+#error "The fixed point boxcar model needs the sum of BG_MODEL_SIZE frames to fit in 16 bits"
+#endif
+
+// Motion plane values
+#define MOTION_PIXEL 255
+#define STILL_PIXEL 0
+
+// Width of the tiles the dirty map cuts each row of the motion plane into, one word of the bit-packed plane. Tiles are
+// a single row high, so each one belongs to the band detecting its row.
+#define DIRTY_TILE_WIDTH BITMASK_WORD_BITS
+// Dirty map flags, a tile is dirty while either is set
+#define DIRTY_MOTION 1
+#define DIRTY_HAD_MOTION 2
+
+/**
+ * Layout of the frames fed into the engine
+ */
+enum frame_format {
+    FRAME_YUYV, FRAME_YUV
+};
+
+/**
+ * How the background model is kept up to date
+ *
+ * The boxcar model is the mean of the last BG_MODEL_SIZE frames, which have to be kept around so the oldest one can be
+ * subtracted again. The exponential moving average model only keeps the model itself, giving each new frame a weight
+ * of 1 / BG_MODEL_SIZE.
+ */
+enum background_model {
+    BG_BOXCAR, BG_EMA
+};
+
+/**
+ * How the background model is stored
+ *
+ * Floats take 12 bytes per pixel. The fixed point model takes 6, or 4 with U and V kept for every other pixel only,
+ * which loses nothing for YUYV frames whose chroma is already shared by each pair of pixels.
+ */
+enum model_storage {
+    STORAGE_FLOAT, STORAGE_FIXED, STORAGE_FIXED_HALF_CHROMA
+};
+
+/**
+ * Channels differenced against the background
+ *
+ * The luma modes read YUYV frames in place instead of unpacking them, always keep the model in fixed point with half
+ * resolution chroma, and only keep chroma at all with CHANNELS_LUMA_CHROMA. Without chroma every pixel is treated as if
+ * its chroma matched the model, which suits cameras such as IR ones whose chroma carries no signal.
+ */
+enum channel_mode {
+    CHANNELS_YUV, CHANNELS_LUMA, CHANNELS_LUMA_CHROMA
+};
+
+/**
+ * Background model options of an engine
+ */
+struct engine_config {
+    enum background_model model;
+    enum model_storage storage;
+    enum channel_mode channels;
+    // Pixels to process, width * height bytes of ROI_WATCHED or ROI_EXCLUDED, NULL for the whole frame. Only read
+    // while the engine is created.
+    const uchar *roi_mask;
+    // Downsampling of the coarse pass, 2 or 4, only the tiles it flags are processed in full. 0 processes every tile.
+    int pyramid_factor;
+};
+
+/**
+ * Motion detection state for a single video stream
+ */
+struct motion_engine {
+    int width;
+    int height;
+    // Bytes between the start of two rows of an input frame
+    int stride;
+    enum frame_format format;
+    enum background_model model;
+    enum model_storage storage;
+    enum channel_mode channels;
+    // Running mean of the background, one plane per channel. Only kept by the float storage.
+    float *bg_model[3];
+    // Fixed point background, one plane per channel, see FIXED_BOXCAR_SCALE and FIXED_EMA_SCALE. Only kept by the
+    // fixed point storage.
+    uint16_t *bg_fixed[3];
+    // Width of the U and V planes of bg_fixed
+    int chroma_width;
+    // Last BG_MODEL_SIZE frames, each stored as consecutive Y, U and V planes, the U and V planes chroma_width wide in
+    // the luma modes. Only kept by the boxcar model.
+    uchar *bg_buffer[BG_MODEL_SIZE];
+    // Index of the oldest frame in the background buffer
+    int bg_model_ndx;
+    // Per pixel motion sensitivity
+    float *mask;
+    // Thresholded motion image of the last frame, one bit per pixel
+    struct bitmask motion;
+    // Whether each tile of the motion plane has motion in the last frame and had some in the frame before,
+    // dirty_width bytes per row. Smoothing a tile whose neighbourhood is clean again leaves it as it was.
+    uchar *dirty;
+    int dirty_width;
+    // Unpacked Y, U and V values of the row being processed when running on a single thread, and its thresholded motion
+    // before it is packed
+    uchar *row[4];
+    // Spans of each row to process, the rest of the frame is never touched
+    struct roi roi;
+    // Coarse pass picking the tiles to process within the region of interest
+    struct pyramid pyramid;
+    // Spans of the row being processed when running on a single thread, see motion_engine_row_spans()
+    struct roi_span *spans;
+    // Kernel used to process each row, and the one handling any width used for rows cut into several spans
+    const struct detect_kernel *kernel;
+    const struct detect_kernel *span_kernel;
+};
+
+size_t motion_engine_arena_size(int width, int height, const struct engine_config *config);
+void motion_engine_init(struct motion_engine *engine, int width, int height, int stride, enum frame_format format,
+                        const struct engine_config *config, struct arena *arena);
+int motion_engine_bootstrap(struct motion_engine *engine, const uchar *frame);
+void motion_engine_coarse_rows(struct motion_engine *engine, const uchar *frame, int first_row, int last_row);
+void motion_engine_flag_tiles(struct motion_engine *engine);
+size_t motion_engine_max_row_spans(int width);
+const struct roi_span *motion_engine_row_spans(const struct motion_engine *engine, int j, enum tile_state state,
+                                               struct roi_span *spans, int *count);
+int motion_engine_detect_rows(const struct motion_engine *engine, const uchar *frame, int first_row, int last_row,
+                              uchar *const *row, struct roi_span *spans);
+void motion_engine_scan_motion(struct motion_engine *engine);
+int motion_engine_dirty_spans(const struct motion_engine *engine, int j, int radius, const struct roi_span *spans,
+                              int num_spans, struct roi_span *dirty);
+void motion_engine_advance(struct motion_engine *engine);
+void motion_engine_detect(struct motion_engine *engine, const uchar *frame);
+int motion_engine_sample_motion(const struct motion_engine *engine, const uchar *frame, int step);
+void motion_engine_background_row(const struct motion_engine *engine, int j, uchar *const *row);
+#endif //MOTION_DETECTOR_MOTION_ENGINE_H
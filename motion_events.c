@@ -0,0 +1,41 @@
+/**
+ * Motion events
+ */
+
+#include "motion_events.h"
+
+/**
+ * Writes a motion event as a single line of JSON
+ *
+ * Only the tracks matched in the frame are listed, tracks that are missing but not yet dropped are left out.
+ *
+ * @param out stream to write to, flushed after the event
+ * @param camera index of the camera the frame came from
+ * @param tracker tracker updated with the frame
+ * @param timestamp capture time of the frame, in seconds since the epoch
+ */
+void emit_motion_event(FILE *out, int camera, const struct tracker *tracker, double timestamp) {
+    int listed = 0;
+
+    // Hold the stream for the whole line, so events from cameras processed on different threads never interleave
+    flockfile(out);
+    fprintf(out, "{\"camera\": %d, \"timestamp\": %.6f, \"tracks\": [", camera, timestamp);
+
+    for (int t = 0; t < tracker->num_tracks; t++) {
+        const struct track *track = &tracker->tracks[t];
+        const struct blob *blob = &track->blob;
+
+        if (track->misses) {
+            continue;
+        }
+
+        fprintf(out, "%s{\"id\": %d, \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, \"area\": %d, \"cx\": %.1f, "
+                     "\"cy\": %.1f, \"vx\": %.1f, \"vy\": %.1f, \"age\": %.3f, \"frames\": %d}",
+                listed++ ? ", " : "", track->id, blob->x, blob->y, blob->w, blob->h, blob->area, blob->cx, blob->cy,
+                track->vx, track->vy, track->last_seen - track->first_seen, track->frames);
+    }
+
+    fprintf(out, "]}\n");
+    fflush(out);
+    funlockfile(out);
+}
@@ -0,0 +1,15 @@
+/**
+ * Motion events
+ *
+ * Reports the tracks seen in a frame as a line of JSON, so the detector can run without a display and feed other
+ * programs.
+ */
+
+#ifndef MOTION_DETECTOR_MOTION_EVENTS_H
+#define MOTION_DETECTOR_MOTION_EVENTS_H
+
+#include <stdio.h>
+#include "tracker.h"
+
+void emit_motion_event(FILE *out, int camera, const struct tracker *tracker, double timestamp);
+#endif //MOTION_DETECTOR_MOTION_EVENTS_H
@@ -0,0 +1,1108 @@
+/**
+ * Per row motion detection kernels
+ *
+ * Every kernel performs exactly the same float operations in the same order as the scalar kernel, so all of them
+ * produce bit identical output. Magnitudes are compared squared against THRESHOLD * THRESHOLD, which is equivalent to
+ * truncating the square root and comparing against THRESHOLD.
+ *
+ * Each kernel is written once for both background models, the model is a compile time constant in every entry point.
+ * The fixed point kernels differ from the float ones in their model but all of them agree with each other bit for bit.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motion_kernels.h"
+#include "motion_engine.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+// Squared motion threshold
+#define THRESHOLD_SQUARED ((double) THRESHOLD * THRESHOLD)
+
+// Weight of a new frame in the exponential moving average model
+#define EMA_ALPHA (1.0f / BG_MODEL_SIZE)
+
+#define DETECT_ROW_ARGS uchar *const *new_row, uchar *const *oldest_row, float *const *bg_row, float *mask_row, \
+                        uchar *motion_row, int width
+#define DETECT_ROW_FIXED_ARGS uchar *const *new_row, uchar *const *oldest_row, uint16_t *const *bg_row, \
+                              float *mask_row, uchar *motion_row, int width
+#define DETECT_ROW_PACKED_ARGS const uchar *src, uchar *const *oldest_row, uint16_t *const *bg_row, float *mask_row, \
+                               uchar *motion_row, int width
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/**
+ * Defines a copy of a kernel with the row width fixed at compile time, so loop bounds and tails are known
+ */
+#define SPECIALIZE_WIDTH(kernel, attributes, fixed_width) \
+    attributes static void kernel##_##fixed_width(DETECT_ROW_ARGS) { \
+        (void) width; \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, fixed_width, BG_BOXCAR); \
+    } \
+    attributes static void kernel##_ema_##fixed_width(DETECT_ROW_ARGS) { \
+        (void) width; \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, fixed_width, BG_EMA); \
+    }
+
+/**
+ * Defines the generic and fixed width entry points of a kernel for both models, one for each of the common camera
+ * resolutions
+ */
+#define SPECIALIZE_KERNEL(kernel, attributes) \
+    attributes static void kernel##_any(DETECT_ROW_ARGS) { \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, width, BG_BOXCAR); \
+    } \
+    attributes static void kernel##_ema_any(DETECT_ROW_ARGS) { \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, width, BG_EMA); \
+    } \
+    SPECIALIZE_WIDTH(kernel, attributes, 320) \
+    SPECIALIZE_WIDTH(kernel, attributes, 640) \
+    SPECIALIZE_WIDTH(kernel, attributes, 1280)
+
+/**
+ * Defines the entry points of a fixed point kernel for both models, with full and half resolution chroma
+ */
+#define SPECIALIZE_FIXED_KERNEL(name, kernel, attributes) \
+    attributes static void name##_boxcar(DETECT_ROW_FIXED_ARGS) { \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, width, BG_BOXCAR, 0); \
+    } \
+    attributes static void name##_ema(DETECT_ROW_FIXED_ARGS) { \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, width, BG_EMA, 0); \
+    } \
+    attributes static void name##_half(DETECT_ROW_FIXED_ARGS) { \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, width, BG_BOXCAR, 1); \
+    } \
+    attributes static void name##_half_ema(DETECT_ROW_FIXED_ARGS) { \
+        kernel(new_row, oldest_row, bg_row, mask_row, motion_row, width, BG_EMA, 1); \
+    }
+
+// Fixed point entry points of a kernel, in the order of struct detect_kernel
+#define FIXED_KERNELS(name) name##_boxcar, name##_ema, name##_half, name##_half_ema
+
+/**
+ * Defines the entry points of a packed YUYV kernel for both models, with and without chroma
+ */
+#define SPECIALIZE_PACKED_KERNEL(kernel, attributes) \
+    attributes static void kernel##_luma(DETECT_ROW_PACKED_ARGS) { \
+        kernel(src, oldest_row, bg_row, mask_row, motion_row, width, BG_BOXCAR, 0); \
+    } \
+    attributes static void kernel##_luma_ema(DETECT_ROW_PACKED_ARGS) { \
+        kernel(src, oldest_row, bg_row, mask_row, motion_row, width, BG_EMA, 0); \
+    } \
+    attributes static void kernel##_luma_chroma(DETECT_ROW_PACKED_ARGS) { \
+        kernel(src, oldest_row, bg_row, mask_row, motion_row, width, BG_BOXCAR, 1); \
+    } \
+    attributes static void kernel##_luma_chroma_ema(DETECT_ROW_PACKED_ARGS) { \
+        kernel(src, oldest_row, bg_row, mask_row, motion_row, width, BG_EMA, 1); \
+    }
+
+// Packed YUYV entry points of a kernel, in the order of struct detect_kernel
+#define PACKED_KERNELS(kernel) kernel##_luma, kernel##_luma_ema, kernel##_luma_chroma, kernel##_luma_chroma_ema
+
+/**
+ * Scalar detection of pixels [start, width) of a row
+ */
+ALWAYS_INLINE void detect_pixels(uchar *const *new_row, uchar *const *oldest_row, float *const *bg_row,
+                                 float *mask_row, uchar *motion_row, int start, int width,
+                                 enum background_model model) {
+    for (int i = start; i < width; i++) {
+        double pixel_mag = 0.0;
+        float new_mask_value;
+
+        // Difference each channel with the background model and weight it by the mask
+        for (int k = 0; k < 3; k++) {
+            float new_out_value = (((float) new_row[k][i] - 127.0f) - (bg_row[k][i] - 127.0f)) + 127;
+            new_out_value = new_out_value * mask_row[i];
+            pixel_mag += (double) new_out_value * new_out_value;
+        }
+
+        // Threshold squared magnitude
+        if (pixel_mag < THRESHOLD_SQUARED) {
+            motion_row[i] = STILL_PIXEL;
+            new_mask_value = mask_row[i] + 0.05f;
+        } else {
+            motion_row[i] = MOTION_PIXEL;
+            new_mask_value = mask_row[i] - 0.2f;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            if (model == BG_BOXCAR) {
+                // Replace the oldest frame in the model with the new one
+                bg_row[k][i] = bg_row[k][i] + (new_row[k][i] / (float) BG_MODEL_SIZE) -
+                               (oldest_row[k][i] / (float) BG_MODEL_SIZE);
+                oldest_row[k][i] = new_row[k][i];
+            } else {
+                // Move the model towards the new frame
+                bg_row[k][i] = bg_row[k][i] + ((float) new_row[k][i] - bg_row[k][i]) * EMA_ALPHA;
+            }
+        }
+
+        // Saturate mask value
+        if (new_mask_value < 0.0f) {
+            new_mask_value = 0.0f;
+        } else if (new_mask_value > 1.0f) {
+            new_mask_value = 1.0f;
+        }
+
+        mask_row[i] = new_mask_value;
+    }
+}
+
+/**
+ * Scalar reference kernel
+ */
+ALWAYS_INLINE void detect_row_scalar(DETECT_ROW_ARGS, enum background_model model) {
+    detect_pixels(new_row, oldest_row, bg_row, mask_row, motion_row, 0, width, model);
+}
+
+SPECIALIZE_KERNEL(detect_row_scalar, )
+
+/**
+ * Updates one value of the fixed point model
+ *
+ * @param bg current model value
+ * @param new_value value of the new frame
+ * @param old_value value of the oldest frame in the background buffer, only used by the boxcar model
+ * @param model background model
+ * @return new model value
+ */
+ALWAYS_INLINE uint16_t update_fixed(uint16_t bg, int new_value, int old_value, enum background_model model) {
+    if (model == BG_BOXCAR) {
+        // Replace the oldest frame in the sum with the new one
+        return bg + new_value - old_value;
+    }
+
+    // Move the model towards the new frame, rounded to the nearest Q8.8 step
+    return bg + (int) lrintf((float) (new_value * FIXED_EMA_SCALE - bg) * EMA_ALPHA);
+}
+
+/**
+ * Scalar detection of pixels [start, width) of a row against a fixed point model, start must be even
+ */
+ALWAYS_INLINE void detect_pixels_fixed(DETECT_ROW_FIXED_ARGS, int start, enum background_model model,
+                                       int half_chroma) {
+    const float scale = model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE;
+
+    for (int i = start; i < width; i++) {
+        double pixel_mag = 0.0;
+        float new_mask_value;
+
+        // Difference each channel with the background model and weight it by the mask
+        for (int k = 0; k < 3; k++) {
+            int ndx = k > 0 && half_chroma ? i / 2 : i;
+            float new_out_value = ((float) new_row[k][i] - (float) bg_row[k][ndx] / scale) + 127.0f;
+            new_out_value = new_out_value * mask_row[i];
+            pixel_mag += (double) new_out_value * new_out_value;
+        }
+
+        // Threshold squared magnitude
+        if (pixel_mag < THRESHOLD_SQUARED) {
+            motion_row[i] = STILL_PIXEL;
+            new_mask_value = mask_row[i] + 0.05f;
+        } else {
+            motion_row[i] = MOTION_PIXEL;
+            new_mask_value = mask_row[i] - 0.2f;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            if (k > 0 && half_chroma) {
+                // Each pair of pixels shares one chroma value, updated once both of them have been differenced
+                int pair = i - i % 2;
+
+                if (i % 2 == 0 && i + 1 < width) {
+                    continue;
+                }
+
+                if (model == BG_BOXCAR) {
+                    bg_row[k][pair / 2] = update_fixed(bg_row[k][pair / 2], chroma_pair_value(new_row[k], pair, width),
+                                                       chroma_pair_value(oldest_row[k], pair, width), model);
+
+                    for (int p = pair; p <= i; p++) {
+                        oldest_row[k][p] = new_row[k][p];
+                    }
+                } else {
+                    bg_row[k][pair / 2] = update_fixed(bg_row[k][pair / 2], chroma_pair_value(new_row[k], pair, width),
+                                                       0, model);
+                }
+            } else if (model == BG_BOXCAR) {
+                bg_row[k][i] = update_fixed(bg_row[k][i], new_row[k][i], oldest_row[k][i], model);
+                oldest_row[k][i] = new_row[k][i];
+            } else {
+                bg_row[k][i] = update_fixed(bg_row[k][i], new_row[k][i], 0, model);
+            }
+        }
+
+        // Saturate mask value
+        if (new_mask_value < 0.0f) {
+            new_mask_value = 0.0f;
+        } else if (new_mask_value > 1.0f) {
+            new_mask_value = 1.0f;
+        }
+
+        mask_row[i] = new_mask_value;
+    }
+}
+
+/**
+ * Scalar fixed point kernel
+ */
+ALWAYS_INLINE void detect_row_scalar_fixed(DETECT_ROW_FIXED_ARGS, enum background_model model, int half_chroma) {
+    detect_pixels_fixed(new_row, oldest_row, bg_row, mask_row, motion_row, width, 0, model, half_chroma);
+}
+
+SPECIALIZE_FIXED_KERNEL(detect_row_scalar_fixed, detect_row_scalar_fixed, )
+
+/**
+ * Scalar detection of pixels [start, width) of a packed YUYV row, start and width must be even
+ */
+ALWAYS_INLINE void detect_pixels_packed(DETECT_ROW_PACKED_ARGS, int start, enum background_model model, int chroma) {
+    const float scale = model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE;
+
+    for (int i = start; i < width; i++) {
+        int pair = i / 2;
+        // Without chroma, difference a zero value against a zero model so U and V count as unchanged
+        int new_value[3] = {src[i * 2], chroma ? src[pair * 4 + 1] : 0, chroma ? src[pair * 4 + 3] : 0};
+        int bg_value[3] = {bg_row[0][i], chroma ? bg_row[1][pair] : 0, chroma ? bg_row[2][pair] : 0};
+        double pixel_mag = 0.0;
+        float new_mask_value;
+
+        // Difference each channel with the background model and weight it by the mask
+        for (int k = 0; k < 3; k++) {
+            float new_out_value = ((float) new_value[k] - (float) bg_value[k] / scale) + 127.0f;
+            new_out_value = new_out_value * mask_row[i];
+            pixel_mag += (double) new_out_value * new_out_value;
+        }
+
+        // Threshold squared magnitude
+        if (pixel_mag < THRESHOLD_SQUARED) {
+            motion_row[i] = STILL_PIXEL;
+            new_mask_value = mask_row[i] + 0.05f;
+        } else {
+            motion_row[i] = MOTION_PIXEL;
+            new_mask_value = mask_row[i] - 0.2f;
+        }
+
+        bg_row[0][i] = update_fixed(bg_row[0][i], new_value[0], model == BG_BOXCAR ? oldest_row[0][i] : 0, model);
+
+        if (model == BG_BOXCAR) {
+            oldest_row[0][i] = new_value[0];
+        }
+
+        // Each pair of pixels shares its chroma, updated once both of them have been differenced
+        if (chroma && i % 2 == 1) {
+            for (int k = 1; k < 3; k++) {
+                bg_row[k][pair] = update_fixed(bg_row[k][pair], new_value[k],
+                                               model == BG_BOXCAR ? oldest_row[k][pair] : 0, model);
+
+                if (model == BG_BOXCAR) {
+                    oldest_row[k][pair] = new_value[k];
+                }
+            }
+        }
+
+        // Saturate mask value
+        if (new_mask_value < 0.0f) {
+            new_mask_value = 0.0f;
+        } else if (new_mask_value > 1.0f) {
+            new_mask_value = 1.0f;
+        }
+
+        mask_row[i] = new_mask_value;
+    }
+}
+
+/**
+ * Scalar packed YUYV kernel
+ */
+ALWAYS_INLINE void detect_row_scalar_packed(DETECT_ROW_PACKED_ARGS, enum background_model model, int chroma) {
+    detect_pixels_packed(src, oldest_row, bg_row, mask_row, motion_row, width, 0, model, chroma);
+}
+
+SPECIALIZE_PACKED_KERNEL(detect_row_scalar_packed, )
+
+#ifdef HAVE_X86_KERNELS
+/**
+ * SSE2 kernel, 16 pixels per iteration
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE void detect_row_sse2(DETECT_ROW_ARGS, enum background_model model) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 offset = _mm_set1_ps(127.0f);
+    const __m128 model_size = _mm_set1_ps((float) BG_MODEL_SIZE);
+    const __m128 alpha = _mm_set1_ps(EMA_ALPHA);
+    const __m128 increase = _mm_set1_ps(0.05f);
+    const __m128 decrease = _mm_set1_ps(-0.2f);
+    const __m128 mask_min = _mm_setzero_ps();
+    const __m128 mask_max = _mm_set1_ps(1.0f);
+    const __m128d threshold = _mm_set1_pd(THRESHOLD_SQUARED);
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        __m128 new_value[3][4];
+        __m128 old_value[3][4];
+        __m128i still[4];
+
+        // Widen 16 bytes of each channel to 4 vectors of floats
+        for (int k = 0; k < 3; k++) {
+            __m128i n = _mm_loadu_si128((const __m128i *) (new_row[k] + i));
+            __m128i n_lo = _mm_unpacklo_epi8(n, zero);
+            __m128i n_hi = _mm_unpackhi_epi8(n, zero);
+
+            new_value[k][0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(n_lo, zero));
+            new_value[k][1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(n_lo, zero));
+            new_value[k][2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(n_hi, zero));
+            new_value[k][3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(n_hi, zero));
+
+            if (model == BG_BOXCAR) {
+                __m128i o = _mm_loadu_si128((const __m128i *) (oldest_row[k] + i));
+                __m128i o_lo = _mm_unpacklo_epi8(o, zero);
+                __m128i o_hi = _mm_unpackhi_epi8(o, zero);
+
+                old_value[k][0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(o_lo, zero));
+                old_value[k][1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(o_lo, zero));
+                old_value[k][2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(o_hi, zero));
+                old_value[k][3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(o_hi, zero));
+
+                _mm_storeu_si128((__m128i *) (oldest_row[k] + i), n);
+            }
+        }
+
+        for (int g = 0; g < 4; g++) {
+            int ndx = i + g * 4;
+            __m128 mask = _mm_loadu_ps(mask_row + ndx);
+            __m128d mag_lo = _mm_setzero_pd();
+            __m128d mag_hi = _mm_setzero_pd();
+            __m128 is_still;
+            __m128 new_mask;
+
+            for (int k = 0; k < 3; k++) {
+                __m128 bg = _mm_loadu_ps(bg_row[k] + ndx);
+                __m128 diff = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(new_value[k][g], offset), _mm_sub_ps(bg, offset)),
+                                         offset);
+                __m128d diff_lo;
+                __m128d diff_hi;
+
+                diff = _mm_mul_ps(diff, mask);
+                diff_lo = _mm_cvtps_pd(diff);
+                diff_hi = _mm_cvtps_pd(_mm_movehl_ps(diff, diff));
+                mag_lo = _mm_add_pd(mag_lo, _mm_mul_pd(diff_lo, diff_lo));
+                mag_hi = _mm_add_pd(mag_hi, _mm_mul_pd(diff_hi, diff_hi));
+
+                if (model == BG_BOXCAR) {
+                    // Replace the oldest frame in the model with the new one
+                    bg = _mm_sub_ps(_mm_add_ps(bg, _mm_div_ps(new_value[k][g], model_size)),
+                                    _mm_div_ps(old_value[k][g], model_size));
+                } else {
+                    // Move the model towards the new frame
+                    bg = _mm_add_ps(bg, _mm_mul_ps(_mm_sub_ps(new_value[k][g], bg), alpha));
+                }
+                _mm_storeu_ps(bg_row[k] + ndx, bg);
+            }
+
+            // Narrow the two 64 bit comparison masks to four 32 bit masks
+            is_still = _mm_shuffle_ps(_mm_castpd_ps(_mm_cmplt_pd(mag_lo, threshold)),
+                                      _mm_castpd_ps(_mm_cmplt_pd(mag_hi, threshold)), _MM_SHUFFLE(2, 0, 2, 0));
+
+            // Update and saturate the mask
+            new_mask = _mm_add_ps(mask, _mm_or_ps(_mm_and_ps(is_still, increase), _mm_andnot_ps(is_still, decrease)));
+            new_mask = _mm_min_ps(_mm_max_ps(new_mask, mask_min), mask_max);
+            _mm_storeu_ps(mask_row + ndx, new_mask);
+
+            still[g] = _mm_castps_si128(is_still);
+        }
+
+        // Motion pixels are the ones that are not still
+        _mm_storeu_si128((__m128i *) (motion_row + i),
+                         _mm_xor_si128(_mm_packs_epi16(_mm_packs_epi32(still[0], still[1]),
+                                                       _mm_packs_epi32(still[2], still[3])),
+                                       _mm_set1_epi8((char) MOTION_PIXEL)));
+    }
+
+    detect_pixels(new_row, oldest_row, bg_row, mask_row, motion_row, i, width, model);
+}
+
+/**
+ * AVX2 kernel, 32 pixels per iteration
+ */
+__attribute__((target("avx2")))
+ALWAYS_INLINE void detect_row_avx2(DETECT_ROW_ARGS, enum background_model model) {
+    const __m256 offset = _mm256_set1_ps(127.0f);
+    const __m256 model_size = _mm256_set1_ps((float) BG_MODEL_SIZE);
+    const __m256 alpha = _mm256_set1_ps(EMA_ALPHA);
+    const __m256 increase = _mm256_set1_ps(0.05f);
+    const __m256 decrease = _mm256_set1_ps(-0.2f);
+    const __m256 mask_min = _mm256_setzero_ps();
+    const __m256 mask_max = _mm256_set1_ps(1.0f);
+    const __m256d threshold = _mm256_set1_pd(THRESHOLD_SQUARED);
+    const __m256i pack_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i;
+
+    for (i = 0; i + 32 <= width; i += 32) {
+        __m256i still[4];
+        __m256i new_bytes[3];
+
+        for (int k = 0; k < 3; k++) {
+            new_bytes[k] = _mm256_loadu_si256((const __m256i *) (new_row[k] + i));
+        }
+
+        for (int g = 0; g < 4; g++) {
+            int ndx = i + g * 8;
+            __m256 mask = _mm256_loadu_ps(mask_row + ndx);
+            __m256d mag_lo = _mm256_setzero_pd();
+            __m256d mag_hi = _mm256_setzero_pd();
+            __m256 is_still;
+            __m256 new_mask;
+
+            for (int k = 0; k < 3; k++) {
+                __m256 new_value = _mm256_cvtepi32_ps(
+                        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (new_row[k] + ndx))));
+                __m256 bg = _mm256_loadu_ps(bg_row[k] + ndx);
+                __m256 diff = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(new_value, offset),
+                                                          _mm256_sub_ps(bg, offset)), offset);
+                __m256d diff_lo;
+                __m256d diff_hi;
+
+                diff = _mm256_mul_ps(diff, mask);
+                diff_lo = _mm256_cvtps_pd(_mm256_castps256_ps128(diff));
+                diff_hi = _mm256_cvtps_pd(_mm256_extractf128_ps(diff, 1));
+                mag_lo = _mm256_add_pd(mag_lo, _mm256_mul_pd(diff_lo, diff_lo));
+                mag_hi = _mm256_add_pd(mag_hi, _mm256_mul_pd(diff_hi, diff_hi));
+
+                if (model == BG_BOXCAR) {
+                    __m256 old_value = _mm256_cvtepi32_ps(
+                            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (oldest_row[k] + ndx))));
+
+                    // Replace the oldest frame in the model with the new one
+                    bg = _mm256_sub_ps(_mm256_add_ps(bg, _mm256_div_ps(new_value, model_size)),
+                                       _mm256_div_ps(old_value, model_size));
+                } else {
+                    // Move the model towards the new frame
+                    bg = _mm256_add_ps(bg, _mm256_mul_ps(_mm256_sub_ps(new_value, bg), alpha));
+                }
+                _mm256_storeu_ps(bg_row[k] + ndx, bg);
+            }
+
+            // Narrow the two 64 bit comparison masks to eight 32 bit masks
+            is_still = _mm256_shuffle_ps(_mm256_castpd_ps(_mm256_cmp_pd(mag_lo, threshold, _CMP_LT_OQ)),
+                                         _mm256_castpd_ps(_mm256_cmp_pd(mag_hi, threshold, _CMP_LT_OQ)),
+                                         _MM_SHUFFLE(2, 0, 2, 0));
+            is_still = _mm256_castsi256_ps(_mm256_permute4x64_epi64(_mm256_castps_si256(is_still),
+                                                                    _MM_SHUFFLE(3, 1, 2, 0)));
+
+            // Update and saturate the mask
+            new_mask = _mm256_add_ps(mask, _mm256_blendv_ps(decrease, increase, is_still));
+            new_mask = _mm256_min_ps(_mm256_max_ps(new_mask, mask_min), mask_max);
+            _mm256_storeu_ps(mask_row + ndx, new_mask);
+
+            still[g] = _mm256_castps_si256(is_still);
+        }
+
+        if (model == BG_BOXCAR) {
+            for (int k = 0; k < 3; k++) {
+                _mm256_storeu_si256((__m256i *) (oldest_row[k] + i), new_bytes[k]);
+            }
+        }
+
+        // Motion pixels are the ones that are not still. Packing works per 128 bit lane so restore the pixel order.
+        _mm256_storeu_si256((__m256i *) (motion_row + i),
+                            _mm256_xor_si256(_mm256_permutevar8x32_epi32(
+                                    _mm256_packs_epi16(_mm256_packs_epi32(still[0], still[1]),
+                                                       _mm256_packs_epi32(still[2], still[3])), pack_order),
+                                             _mm256_set1_epi8((char) MOTION_PIXEL)));
+    }
+
+    detect_pixels(new_row, oldest_row, bg_row, mask_row, motion_row, i, width, model);
+}
+
+SPECIALIZE_KERNEL(detect_row_sse2, __attribute__((target("sse2"))))
+SPECIALIZE_KERNEL(detect_row_avx2, __attribute__((target("avx2"))))
+
+/**
+ * Updates 8 values of the fixed point model with SSE2
+ *
+ * @param bg current model values
+ * @param new_value values of the new frame, 16 bits each
+ * @param old_value values of the oldest frame, 16 bits each, only used by the boxcar model
+ * @param model background model
+ * @return new model values
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE __m128i update_fixed_sse2(__m128i bg, __m128i new_value, __m128i old_value,
+                                        enum background_model model) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128 alpha = _mm_set1_ps(EMA_ALPHA);
+    __m128i result[2];
+
+    if (model == BG_BOXCAR) {
+        // Replace the oldest frame in the sum with the new one
+        return _mm_add_epi16(_mm_sub_epi16(bg, old_value), new_value);
+    }
+
+    // Move the model towards the new frame, in 32 bits as the step can be larger than 16 bits hold
+    for (int h = 0; h < 2; h++) {
+        __m128i bg32 = h ? _mm_unpackhi_epi16(bg, zero) : _mm_unpacklo_epi16(bg, zero);
+        __m128i new32 = h ? _mm_unpackhi_epi16(new_value, zero) : _mm_unpacklo_epi16(new_value, zero);
+        __m128i delta = _mm_sub_epi32(_mm_slli_epi32(new32, 8), bg32);
+        __m128i step = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(delta), alpha));
+
+        result[h] = _mm_sub_epi32(_mm_add_epi32(bg32, step), bias);
+    }
+
+    // There is no unsigned saturating pack before SSE4.1, so pack around zero and flip the sign bit back
+    return _mm_xor_si128(_mm_packs_epi32(result[0], result[1]), _mm_set1_epi16((short) 0x8000));
+}
+
+/**
+ * Rounded mean of each pair of bytes, as 8 16 bit values
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE __m128i pair_means_sse2(__m128i bytes) {
+    return _mm_avg_epu16(_mm_and_si128(bytes, _mm_set1_epi16(0x00ff)), _mm_srli_epi16(bytes, 8));
+}
+
+/**
+ * SSE2 fixed point kernel, 16 pixels per iteration
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE void detect_row_sse2_fixed(DETECT_ROW_FIXED_ARGS, enum background_model model, int half_chroma) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 offset = _mm_set1_ps(127.0f);
+    const __m128 scale = _mm_set1_ps(model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE);
+    const __m128 increase = _mm_set1_ps(0.05f);
+    const __m128 decrease = _mm_set1_ps(-0.2f);
+    const __m128 mask_min = _mm_setzero_ps();
+    const __m128 mask_max = _mm_set1_ps(1.0f);
+    const __m128d threshold = _mm_set1_pd(THRESHOLD_SQUARED);
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        __m128 new_value[3][4];
+        __m128 mean[3][4];
+        __m128i still[4];
+
+        for (int k = 0; k < 3; k++) {
+            __m128i n = _mm_loadu_si128((const __m128i *) (new_row[k] + i));
+            __m128i o = model == BG_BOXCAR ? _mm_loadu_si128((const __m128i *) (oldest_row[k] + i)) : zero;
+            __m128i n16[2] = {_mm_unpacklo_epi8(n, zero), _mm_unpackhi_epi8(n, zero)};
+            __m128i bg16[2];
+
+            for (int h = 0; h < 2; h++) {
+                new_value[k][h * 2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(n16[h], zero));
+                new_value[k][h * 2 + 1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(n16[h], zero));
+            }
+
+            if (k > 0 && half_chroma) {
+                // One model value per pair of pixels, repeated for both of them
+                __m128i bg = _mm_loadu_si128((const __m128i *) (bg_row[k] + i / 2));
+
+                bg16[0] = _mm_unpacklo_epi16(bg, bg);
+                bg16[1] = _mm_unpackhi_epi16(bg, bg);
+                _mm_storeu_si128((__m128i *) (bg_row[k] + i / 2),
+                                 update_fixed_sse2(bg, pair_means_sse2(n), pair_means_sse2(o), model));
+            } else {
+                __m128i o16[2] = {_mm_unpacklo_epi8(o, zero), _mm_unpackhi_epi8(o, zero)};
+
+                for (int h = 0; h < 2; h++) {
+                    bg16[h] = _mm_loadu_si128((const __m128i *) (bg_row[k] + i + h * 8));
+                    _mm_storeu_si128((__m128i *) (bg_row[k] + i + h * 8),
+                                     update_fixed_sse2(bg16[h], n16[h], o16[h], model));
+                }
+            }
+
+            for (int h = 0; h < 2; h++) {
+                mean[k][h * 2] = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(bg16[h], zero)), scale);
+                mean[k][h * 2 + 1] = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(bg16[h], zero)), scale);
+            }
+
+            if (model == BG_BOXCAR) {
+                _mm_storeu_si128((__m128i *) (oldest_row[k] + i), n);
+            }
+        }
+
+        for (int g = 0; g < 4; g++) {
+            int ndx = i + g * 4;
+            __m128 mask = _mm_loadu_ps(mask_row + ndx);
+            __m128d mag_lo = _mm_setzero_pd();
+            __m128d mag_hi = _mm_setzero_pd();
+            __m128 is_still;
+            __m128 new_mask;
+
+            for (int k = 0; k < 3; k++) {
+                __m128 diff = _mm_add_ps(_mm_sub_ps(new_value[k][g], mean[k][g]), offset);
+                __m128d diff_lo;
+                __m128d diff_hi;
+
+                diff = _mm_mul_ps(diff, mask);
+                diff_lo = _mm_cvtps_pd(diff);
+                diff_hi = _mm_cvtps_pd(_mm_movehl_ps(diff, diff));
+                mag_lo = _mm_add_pd(mag_lo, _mm_mul_pd(diff_lo, diff_lo));
+                mag_hi = _mm_add_pd(mag_hi, _mm_mul_pd(diff_hi, diff_hi));
+            }
+
+            // Narrow the two 64 bit comparison masks to four 32 bit masks
+            is_still = _mm_shuffle_ps(_mm_castpd_ps(_mm_cmplt_pd(mag_lo, threshold)),
+                                      _mm_castpd_ps(_mm_cmplt_pd(mag_hi, threshold)), _MM_SHUFFLE(2, 0, 2, 0));
+
+            // Update and saturate the mask
+            new_mask = _mm_add_ps(mask, _mm_or_ps(_mm_and_ps(is_still, increase), _mm_andnot_ps(is_still, decrease)));
+            new_mask = _mm_min_ps(_mm_max_ps(new_mask, mask_min), mask_max);
+            _mm_storeu_ps(mask_row + ndx, new_mask);
+
+            still[g] = _mm_castps_si128(is_still);
+        }
+
+        // Motion pixels are the ones that are not still
+        _mm_storeu_si128((__m128i *) (motion_row + i),
+                         _mm_xor_si128(_mm_packs_epi16(_mm_packs_epi32(still[0], still[1]),
+                                                       _mm_packs_epi32(still[2], still[3])),
+                                       _mm_set1_epi8((char) MOTION_PIXEL)));
+    }
+
+    detect_pixels_fixed(new_row, oldest_row, bg_row, mask_row, motion_row, width, i, model, half_chroma);
+}
+
+/**
+ * AVX2 fixed point kernel, 8 pixels per iteration
+ *
+ * The model update is 16 bit integer work that the SSE2 helpers already cover, only the differencing is widened.
+ */
+__attribute__((target("avx2")))
+ALWAYS_INLINE void detect_row_avx2_fixed(DETECT_ROW_FIXED_ARGS, enum background_model model, int half_chroma) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m256 offset = _mm256_set1_ps(127.0f);
+    const __m256 scale = _mm256_set1_ps(model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE);
+    const __m256 increase = _mm256_set1_ps(0.05f);
+    const __m256 decrease = _mm256_set1_ps(-0.2f);
+    const __m256 mask_min = _mm256_setzero_ps();
+    const __m256 mask_max = _mm256_set1_ps(1.0f);
+    const __m256d threshold = _mm256_set1_pd(THRESHOLD_SQUARED);
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        __m256 mask = _mm256_loadu_ps(mask_row + i);
+        __m256d mag_lo = _mm256_setzero_pd();
+        __m256d mag_hi = _mm256_setzero_pd();
+        __m256 is_still;
+        __m256 new_mask;
+        __m128i still;
+
+        for (int k = 0; k < 3; k++) {
+            __m128i n = _mm_loadl_epi64((const __m128i *) (new_row[k] + i));
+            __m128i o = model == BG_BOXCAR ? _mm_loadl_epi64((const __m128i *) (oldest_row[k] + i)) : zero;
+            __m256 new_value = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(n));
+            __m128i bg16;
+            __m256 diff;
+            __m256d diff_lo;
+            __m256d diff_hi;
+
+            if (k > 0 && half_chroma) {
+                // One model value per pair of pixels, repeated for both of them
+                __m128i bg = _mm_loadl_epi64((const __m128i *) (bg_row[k] + i / 2));
+
+                bg16 = _mm_unpacklo_epi16(bg, bg);
+                _mm_storel_epi64((__m128i *) (bg_row[k] + i / 2),
+                                 update_fixed_sse2(bg, pair_means_sse2(n), pair_means_sse2(o), model));
+            } else {
+                bg16 = _mm_loadu_si128((const __m128i *) (bg_row[k] + i));
+                _mm_storeu_si128((__m128i *) (bg_row[k] + i), update_fixed_sse2(bg16, _mm_unpacklo_epi8(n, zero),
+                                                                                 _mm_unpacklo_epi8(o, zero), model));
+            }
+
+            if (model == BG_BOXCAR) {
+                _mm_storel_epi64((__m128i *) (oldest_row[k] + i), n);
+            }
+
+            diff = _mm256_sub_ps(new_value, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(bg16)), scale));
+            diff = _mm256_mul_ps(_mm256_add_ps(diff, offset), mask);
+            diff_lo = _mm256_cvtps_pd(_mm256_castps256_ps128(diff));
+            diff_hi = _mm256_cvtps_pd(_mm256_extractf128_ps(diff, 1));
+            mag_lo = _mm256_add_pd(mag_lo, _mm256_mul_pd(diff_lo, diff_lo));
+            mag_hi = _mm256_add_pd(mag_hi, _mm256_mul_pd(diff_hi, diff_hi));
+        }
+
+        // Narrow the two 64 bit comparison masks to eight 32 bit masks
+        is_still = _mm256_shuffle_ps(_mm256_castpd_ps(_mm256_cmp_pd(mag_lo, threshold, _CMP_LT_OQ)),
+                                     _mm256_castpd_ps(_mm256_cmp_pd(mag_hi, threshold, _CMP_LT_OQ)),
+                                     _MM_SHUFFLE(2, 0, 2, 0));
+        is_still = _mm256_castsi256_ps(_mm256_permute4x64_epi64(_mm256_castps_si256(is_still),
+                                                                _MM_SHUFFLE(3, 1, 2, 0)));
+
+        // Update and saturate the mask
+        new_mask = _mm256_add_ps(mask, _mm256_blendv_ps(decrease, increase, is_still));
+        new_mask = _mm256_min_ps(_mm256_max_ps(new_mask, mask_min), mask_max);
+        _mm256_storeu_ps(mask_row + i, new_mask);
+
+        // Motion pixels are the ones that are not still
+        still = _mm_packs_epi32(_mm256_castsi256_si128(_mm256_castps_si256(is_still)),
+                                _mm256_extracti128_si256(_mm256_castps_si256(is_still), 1));
+        _mm_storel_epi64((__m128i *) (motion_row + i),
+                         _mm_xor_si128(_mm_packs_epi16(still, still), _mm_set1_epi8((char) MOTION_PIXEL)));
+    }
+
+    detect_pixels_fixed(new_row, oldest_row, bg_row, mask_row, motion_row, width, i, model, half_chroma);
+}
+
+SPECIALIZE_FIXED_KERNEL(detect_row_sse2_fixed, detect_row_sse2_fixed, __attribute__((target("sse2"))))
+SPECIALIZE_FIXED_KERNEL(detect_row_avx2_fixed, detect_row_avx2_fixed, __attribute__((target("avx2"))))
+
+/**
+ * Splits 8 packed YUYV pixels into 16 bit Y values and the 16 bit U and V values of their 4 pairs
+ *
+ * @param src YUYV pixels
+ * @param y set to the 8 Y values
+ * @param u set to the 4 U values, in the low half
+ * @param v set to the 4 V values, in the low half
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE void load_yuyv_sse2(const uchar *src, __m128i *y, __m128i *u, __m128i *v) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i pixels = _mm_loadu_si128((const __m128i *) src);
+    // U0 V0 U1 V1... with each chroma value in its own 16 bits
+    __m128i chroma = _mm_srli_epi16(pixels, 8);
+
+    *y = _mm_and_si128(pixels, _mm_set1_epi16(0x00ff));
+    *u = _mm_packs_epi32(_mm_and_si128(chroma, _mm_set1_epi32(0xffff)), zero);
+    *v = _mm_packs_epi32(_mm_srli_epi32(chroma, 16), zero);
+}
+
+/**
+ * Loads 4 bytes of the oldest frame as 16 bit values
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE __m128i load_oldest_chroma_sse2(const uchar *oldest) {
+    int32_t bytes;
+
+    memcpy(&bytes, oldest, sizeof(bytes));
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128());
+}
+
+/**
+ * Stores the low 4 of 8 16 bit values as bytes of the oldest frame
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE void store_oldest_chroma_sse2(uchar *oldest, __m128i values) {
+    int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(values, values));
+
+    memcpy(oldest, &bytes, sizeof(bytes));
+}
+
+/**
+ * Updates the model and oldest frame for 8 packed YUYV pixels and returns their model and new values per pixel
+ *
+ * Shared by the SSE2 and AVX2 packed kernels, which only differ in how wide they difference.
+ *
+ * @param src YUYV pixels
+ * @param oldest_row oldest frame rows, at the first pixel and its pair
+ * @param bg_row fixed point model rows, at the first pixel and its pair
+ * @param model background model
+ * @param chroma 1 to read and update chroma, otherwise chroma values and models are left zero
+ * @param new_value set to the 8 16 bit new values of each channel
+ * @param bg_value set to the 8 16 bit model values of each channel, from before the update
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE void update_packed_sse2(const uchar *src, uchar *const *oldest_row, uint16_t *const *bg_row,
+                                      enum background_model model, int chroma, __m128i *new_value,
+                                      __m128i *bg_value) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i u;
+    __m128i v;
+
+    load_yuyv_sse2(src, &new_value[0], &u, &v);
+    bg_value[0] = _mm_loadu_si128((const __m128i *) bg_row[0]);
+
+    if (model == BG_BOXCAR) {
+        __m128i oldest = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) oldest_row[0]), zero);
+
+        _mm_storeu_si128((__m128i *) bg_row[0], update_fixed_sse2(bg_value[0], new_value[0], oldest, model));
+        _mm_storel_epi64((__m128i *) oldest_row[0], _mm_packus_epi16(new_value[0], new_value[0]));
+    } else {
+        _mm_storeu_si128((__m128i *) bg_row[0], update_fixed_sse2(bg_value[0], new_value[0], zero, model));
+    }
+
+    for (int k = 1; k < 3; k++) {
+        __m128i pairs = k == 1 ? u : v;
+        __m128i bg;
+
+        if (!chroma) {
+            new_value[k] = zero;
+            bg_value[k] = zero;
+            continue;
+        }
+
+        bg = _mm_loadl_epi64((const __m128i *) bg_row[k]);
+
+        if (model == BG_BOXCAR) {
+            _mm_storel_epi64((__m128i *) bg_row[k],
+                             update_fixed_sse2(bg, pairs, load_oldest_chroma_sse2(oldest_row[k]), model));
+            store_oldest_chroma_sse2(oldest_row[k], pairs);
+        } else {
+            _mm_storel_epi64((__m128i *) bg_row[k], update_fixed_sse2(bg, pairs, zero, model));
+        }
+
+        // Repeat each pair's values for both of its pixels
+        new_value[k] = _mm_unpacklo_epi16(pairs, pairs);
+        bg_value[k] = _mm_unpacklo_epi16(bg, bg);
+    }
+}
+
+/**
+ * SSE2 packed YUYV kernel, 8 pixels per iteration
+ */
+__attribute__((target("sse2")))
+ALWAYS_INLINE void detect_row_sse2_packed(DETECT_ROW_PACKED_ARGS, enum background_model model, int chroma) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 offset = _mm_set1_ps(127.0f);
+    const __m128 scale = _mm_set1_ps(model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE);
+    const __m128 increase = _mm_set1_ps(0.05f);
+    const __m128 decrease = _mm_set1_ps(-0.2f);
+    const __m128 mask_min = _mm_setzero_ps();
+    const __m128 mask_max = _mm_set1_ps(1.0f);
+    const __m128d threshold = _mm_set1_pd(THRESHOLD_SQUARED);
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        uchar *oldest[3] = {NULL, NULL, NULL};
+        uint16_t *bg[3] = {bg_row[0] + i, chroma ? bg_row[1] + i / 2 : NULL, chroma ? bg_row[2] + i / 2 : NULL};
+        __m128i new_value[3];
+        __m128i bg_value[3];
+        __m128i still[2];
+
+        if (model == BG_BOXCAR) {
+            oldest[0] = oldest_row[0] + i;
+            oldest[1] = chroma ? oldest_row[1] + i / 2 : NULL;
+            oldest[2] = chroma ? oldest_row[2] + i / 2 : NULL;
+        }
+
+        update_packed_sse2(src + i * 2, oldest, bg, model, chroma, new_value, bg_value);
+
+        for (int g = 0; g < 2; g++) {
+            int ndx = i + g * 4;
+            __m128 mask = _mm_loadu_ps(mask_row + ndx);
+            __m128d mag_lo = _mm_setzero_pd();
+            __m128d mag_hi = _mm_setzero_pd();
+            __m128 is_still;
+            __m128 new_mask;
+
+            for (int k = 0; k < 3; k++) {
+                __m128i n32 = g ? _mm_unpackhi_epi16(new_value[k], zero) : _mm_unpacklo_epi16(new_value[k], zero);
+                __m128i bg32 = g ? _mm_unpackhi_epi16(bg_value[k], zero) : _mm_unpacklo_epi16(bg_value[k], zero);
+                __m128 diff = _mm_sub_ps(_mm_cvtepi32_ps(n32), _mm_div_ps(_mm_cvtepi32_ps(bg32), scale));
+                __m128d diff_lo;
+                __m128d diff_hi;
+
+                diff = _mm_mul_ps(_mm_add_ps(diff, offset), mask);
+                diff_lo = _mm_cvtps_pd(diff);
+                diff_hi = _mm_cvtps_pd(_mm_movehl_ps(diff, diff));
+                mag_lo = _mm_add_pd(mag_lo, _mm_mul_pd(diff_lo, diff_lo));
+                mag_hi = _mm_add_pd(mag_hi, _mm_mul_pd(diff_hi, diff_hi));
+            }
+
+            // Narrow the two 64 bit comparison masks to four 32 bit masks
+            is_still = _mm_shuffle_ps(_mm_castpd_ps(_mm_cmplt_pd(mag_lo, threshold)),
+                                      _mm_castpd_ps(_mm_cmplt_pd(mag_hi, threshold)), _MM_SHUFFLE(2, 0, 2, 0));
+
+            // Update and saturate the mask
+            new_mask = _mm_add_ps(mask, _mm_or_ps(_mm_and_ps(is_still, increase), _mm_andnot_ps(is_still, decrease)));
+            new_mask = _mm_min_ps(_mm_max_ps(new_mask, mask_min), mask_max);
+            _mm_storeu_ps(mask_row + ndx, new_mask);
+
+            still[g] = _mm_castps_si128(is_still);
+        }
+
+        // Motion pixels are the ones that are not still
+        still[0] = _mm_packs_epi32(still[0], still[1]);
+        _mm_storel_epi64((__m128i *) (motion_row + i),
+                         _mm_xor_si128(_mm_packs_epi16(still[0], still[0]), _mm_set1_epi8((char) MOTION_PIXEL)));
+    }
+
+    detect_pixels_packed(src, oldest_row, bg_row, mask_row, motion_row, width, i, model, chroma);
+}
+
+/**
+ * AVX2 packed YUYV kernel, 8 pixels per iteration differenced in one pass
+ */
+__attribute__((target("avx2")))
+ALWAYS_INLINE void detect_row_avx2_packed(DETECT_ROW_PACKED_ARGS, enum background_model model, int chroma) {
+    const __m256 offset = _mm256_set1_ps(127.0f);
+    const __m256 scale = _mm256_set1_ps(model == BG_BOXCAR ? FIXED_BOXCAR_SCALE : FIXED_EMA_SCALE);
+    const __m256 increase = _mm256_set1_ps(0.05f);
+    const __m256 decrease = _mm256_set1_ps(-0.2f);
+    const __m256 mask_min = _mm256_setzero_ps();
+    const __m256 mask_max = _mm256_set1_ps(1.0f);
+    const __m256d threshold = _mm256_set1_pd(THRESHOLD_SQUARED);
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        uchar *oldest[3] = {NULL, NULL, NULL};
+        uint16_t *bg[3] = {bg_row[0] + i, chroma ? bg_row[1] + i / 2 : NULL, chroma ? bg_row[2] + i / 2 : NULL};
+        __m128i new_value[3];
+        __m128i bg_value[3];
+        __m256 mask = _mm256_loadu_ps(mask_row + i);
+        __m256d mag_lo = _mm256_setzero_pd();
+        __m256d mag_hi = _mm256_setzero_pd();
+        __m256 is_still;
+        __m256 new_mask;
+        __m128i still;
+
+        if (model == BG_BOXCAR) {
+            oldest[0] = oldest_row[0] + i;
+            oldest[1] = chroma ? oldest_row[1] + i / 2 : NULL;
+            oldest[2] = chroma ? oldest_row[2] + i / 2 : NULL;
+        }
+
+        update_packed_sse2(src + i * 2, oldest, bg, model, chroma, new_value, bg_value);
+
+        for (int k = 0; k < 3; k++) {
+            __m256 diff = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(new_value[k])),
+                                        _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(bg_value[k])), scale));
+            __m256d diff_lo;
+            __m256d diff_hi;
+
+            diff = _mm256_mul_ps(_mm256_add_ps(diff, offset), mask);
+            diff_lo = _mm256_cvtps_pd(_mm256_castps256_ps128(diff));
+            diff_hi = _mm256_cvtps_pd(_mm256_extractf128_ps(diff, 1));
+            mag_lo = _mm256_add_pd(mag_lo, _mm256_mul_pd(diff_lo, diff_lo));
+            mag_hi = _mm256_add_pd(mag_hi, _mm256_mul_pd(diff_hi, diff_hi));
+        }
+
+        // Narrow the two 64 bit comparison masks to eight 32 bit masks
+        is_still = _mm256_shuffle_ps(_mm256_castpd_ps(_mm256_cmp_pd(mag_lo, threshold, _CMP_LT_OQ)),
+                                     _mm256_castpd_ps(_mm256_cmp_pd(mag_hi, threshold, _CMP_LT_OQ)),
+                                     _MM_SHUFFLE(2, 0, 2, 0));
+        is_still = _mm256_castsi256_ps(_mm256_permute4x64_epi64(_mm256_castps_si256(is_still),
+                                                                _MM_SHUFFLE(3, 1, 2, 0)));
+
+        // Update and saturate the mask
+        new_mask = _mm256_add_ps(mask, _mm256_blendv_ps(decrease, increase, is_still));
+        new_mask = _mm256_min_ps(_mm256_max_ps(new_mask, mask_min), mask_max);
+        _mm256_storeu_ps(mask_row + i, new_mask);
+
+        // Motion pixels are the ones that are not still
+        still = _mm_packs_epi32(_mm256_castsi256_si128(_mm256_castps_si256(is_still)),
+                                _mm256_extracti128_si256(_mm256_castps_si256(is_still), 1));
+        _mm_storel_epi64((__m128i *) (motion_row + i),
+                         _mm_xor_si128(_mm_packs_epi16(still, still), _mm_set1_epi8((char) MOTION_PIXEL)));
+    }
+
+    detect_pixels_packed(src, oldest_row, bg_row, mask_row, motion_row, width, i, model, chroma);
+}
+
+SPECIALIZE_PACKED_KERNEL(detect_row_sse2_packed, __attribute__((target("sse2"))))
+SPECIALIZE_PACKED_KERNEL(detect_row_avx2_packed, __attribute__((target("avx2"))))
+#endif
+
+// Every kernel, the ones with a width of 0 handle any width
+static const struct detect_kernel kernels[] = {
+        {"scalar", 0,    detect_row_scalar_any,  detect_row_scalar_ema_any,  FIXED_KERNELS(detect_row_scalar_fixed),
+         PACKED_KERNELS(detect_row_scalar_packed)},
+        {"scalar", 320,  detect_row_scalar_320,  detect_row_scalar_ema_320,  FIXED_KERNELS(detect_row_scalar_fixed),
+         PACKED_KERNELS(detect_row_scalar_packed)},
+        {"scalar", 640,  detect_row_scalar_640,  detect_row_scalar_ema_640,  FIXED_KERNELS(detect_row_scalar_fixed),
+         PACKED_KERNELS(detect_row_scalar_packed)},
+        {"scalar", 1280, detect_row_scalar_1280, detect_row_scalar_ema_1280, FIXED_KERNELS(detect_row_scalar_fixed),
+         PACKED_KERNELS(detect_row_scalar_packed)},
+#ifdef HAVE_X86_KERNELS
+        {"sse2",   0,    detect_row_sse2_any,    detect_row_sse2_ema_any,    FIXED_KERNELS(detect_row_sse2_fixed),
+         PACKED_KERNELS(detect_row_sse2_packed)},
+        {"sse2",   320,  detect_row_sse2_320,    detect_row_sse2_ema_320,    FIXED_KERNELS(detect_row_sse2_fixed),
+         PACKED_KERNELS(detect_row_sse2_packed)},
+        {"sse2",   640,  detect_row_sse2_640,    detect_row_sse2_ema_640,    FIXED_KERNELS(detect_row_sse2_fixed),
+         PACKED_KERNELS(detect_row_sse2_packed)},
+        {"sse2",   1280, detect_row_sse2_1280,   detect_row_sse2_ema_1280,   FIXED_KERNELS(detect_row_sse2_fixed),
+         PACKED_KERNELS(detect_row_sse2_packed)},
+        {"avx2",   0,    detect_row_avx2_any,    detect_row_avx2_ema_any,    FIXED_KERNELS(detect_row_avx2_fixed),
+         PACKED_KERNELS(detect_row_avx2_packed)},
+        {"avx2",   320,  detect_row_avx2_320,    detect_row_avx2_ema_320,    FIXED_KERNELS(detect_row_avx2_fixed),
+         PACKED_KERNELS(detect_row_avx2_packed)},
+        {"avx2",   640,  detect_row_avx2_640,    detect_row_avx2_ema_640,    FIXED_KERNELS(detect_row_avx2_fixed),
+         PACKED_KERNELS(detect_row_avx2_packed)},
+        {"avx2",   1280, detect_row_avx2_1280,   detect_row_avx2_ema_1280,   FIXED_KERNELS(detect_row_avx2_fixed),
+         PACKED_KERNELS(detect_row_avx2_packed)},
+#endif
+};
+
+/**
+ * Checks if this CPU can run the kernels of an instruction set
+ *
+ * @param name name of the instruction set
+ * @return 1 if supported, 0 otherwise
+ */
+static int instruction_set_supported(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        return 1;
+    }
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+
+    if (strcmp(name, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    } else if (strcmp(name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Picks the fastest kernel supported by this CPU, specialized for the row width if one exists
+ *
+ * The instruction set can be overridden by setting the MOTION_KERNEL environment variable to scalar, sse2 or avx2.
+ *
+ * @param width width of the rows that will be processed
+ * @return selected kernel
+ */
+const struct detect_kernel *select_detect_kernel(int width) {
+    const char *requested = getenv("MOTION_KERNEL");
+    const char *instruction_set = "scalar";
+    const struct detect_kernel *kernel = NULL;
+
+    if (instruction_set_supported("avx2")) {
+        instruction_set = "avx2";
+    } else if (instruction_set_supported("sse2")) {
+        instruction_set = "sse2";
+    }
+
+    if (requested) {
+        if (instruction_set_supported(requested)) {
+            instruction_set = requested;
+        } else {
+            fprintf(stderr, "Kernel %s is not supported, using %s\n", requested, instruction_set);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, instruction_set) != 0) {
+            continue;
+        }
+
+        if (kernels[i].width == width) {
+            return &kernels[i];
+        } else if (kernels[i].width == 0) {
+            kernel = &kernels[i];
+        }
+    }
+
+    return kernel;
+}
+
+/**
+ * Finds the kernel of the same instruction set as another that handles rows of any width
+ *
+ * @param kernel kernel, possibly specialized for a width
+ * @return kernel for any width
+ */
+const struct detect_kernel *generic_detect_kernel(const struct detect_kernel *kernel) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (kernels[i].width == 0 && strcmp(kernels[i].name, kernel->name) == 0) {
+            return &kernels[i];
+        }
+    }
+
+    return kernel;
+}
@@ -0,0 +1,98 @@
+/**
+ * Per row motion detection kernels
+ *
+ * A scalar reference kernel plus SSE2 and AVX2 versions, picked at runtime from the features of the CPU.
+ */
+
+#ifndef MOTION_DETECTOR_MOTION_KERNELS_H
+#define MOTION_DETECTOR_MOTION_KERNELS_H
+
+#include <stdint.h>
+#include "image_manipulation.h"
+
+/**
+ * Differences one row of a frame against the background model and updates the model, background buffer and mask
+ *
+ * @param new_row Y, U and V rows of the new frame
+ * @param oldest_row Y, U and V rows of the oldest frame in the background buffer, overwritten with the new frame. Not
+ *                   used by the exponential moving average model.
+ * @param bg_row Y, U and V rows of the background model
+ * @param mask_row row of the motion mask
+ * @param motion_row row of the motion image to write
+ * @param width number of pixels in the row
+ */
+typedef void (*detect_row_fn)(uchar *const *new_row, uchar *const *oldest_row, float *const *bg_row, float *mask_row,
+                              uchar *motion_row, int width);
+
+/**
+ * Same as detect_row_fn for a background model kept in 16 bit fixed point
+ *
+ * @param new_row Y, U and V rows of the new frame
+ * @param oldest_row Y, U and V rows of the oldest frame in the background buffer, overwritten with the new frame. Not
+ *                   used by the exponential moving average model.
+ * @param bg_row Y, U and V rows of the fixed point background model. The U and V rows are (width + 1) / 2 long for
+ *               kernels with half resolution chroma.
+ * @param mask_row row of the motion mask
+ * @param motion_row row of the motion image to write
+ * @param width number of pixels in the row
+ */
+typedef void (*detect_row_fixed_fn)(uchar *const *new_row, uchar *const *oldest_row, uint16_t *const *bg_row,
+                                    float *mask_row, uchar *motion_row, int width);
+
+/**
+ * Differences one packed YUYV row against a luma, or luma and half resolution chroma, fixed point background model
+ *
+ * Without chroma the U and V rows are not touched and every pixel is treated as if its chroma matched the model.
+ *
+ * @param src YUYV row of the new frame, read in place
+ * @param oldest_row Y row and half width U and V rows of the oldest frame in the background buffer, overwritten with
+ *                   the new frame. Not used by the exponential moving average model.
+ * @param bg_row Y row and half width U and V rows of the fixed point background model
+ * @param mask_row row of the motion mask
+ * @param motion_row row of the motion image to write
+ * @param width number of pixels in the row, even
+ */
+typedef void (*detect_row_packed_fn)(const uchar *src, uchar *const *oldest_row, uint16_t *const *bg_row,
+                                     float *mask_row, uchar *motion_row, int width);
+
+/**
+ * A motion detection kernel implementation
+ */
+struct detect_kernel {
+    // Instruction set used by the kernel
+    const char *name;
+    // Row width the kernel is specialized for, 0 if it handles any width
+    int width;
+    // Boxcar model version
+    detect_row_fn detect_row;
+    // Exponential moving average model version
+    detect_row_fn detect_row_ema;
+    // Fixed point boxcar and exponential moving average model versions
+    detect_row_fixed_fn detect_row_fixed;
+    detect_row_fixed_fn detect_row_fixed_ema;
+    // Fixed point versions with chroma kept at half horizontal resolution
+    detect_row_fixed_fn detect_row_half;
+    detect_row_fixed_fn detect_row_half_ema;
+    // Luma only versions working on packed YUYV rows
+    detect_row_packed_fn detect_row_luma;
+    detect_row_packed_fn detect_row_luma_ema;
+    // Luma and half resolution chroma versions working on packed YUYV rows
+    detect_row_packed_fn detect_row_luma_chroma;
+    detect_row_packed_fn detect_row_luma_chroma_ema;
+};
+
+/**
+ * Chroma value the half resolution model takes from the pair of pixels starting at i, their rounded mean
+ *
+ * @param row U or V row
+ * @param i even index of the first pixel of the pair
+ * @param width number of pixels in the row, the last pair of an odd width row only has one pixel
+ * @return chroma value of the pair
+ */
+static inline int chroma_pair_value(const uchar *row, int i, int width) {
+    return i + 1 < width ? (row[i] + row[i + 1] + 1) >> 1 : row[i];
+}
+
+const struct detect_kernel *select_detect_kernel(int width);
+const struct detect_kernel *generic_detect_kernel(const struct detect_kernel *kernel);
+#endif //MOTION_DETECTOR_MOTION_KERNELS_H
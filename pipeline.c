@@ -0,0 +1,265 @@
+/**
+ * Frame processing pipeline
+ */
+
+#include <string.h>
+#include <time.h>
+#include "pipeline.h"
+
+/**
+ * Reads a monotonic clock
+ *
+ * @return time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * Creates a pipeline, allocating all of its buffers
+ *
+ * The frame is split into one band per thread of the pool, or one per row on frames shorter than that.
+ *
+ * @param pipeline pipeline to initialize
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param stride bytes between the start of two rows of a frame
+ * @param format layout of the frames
+ * @param config background model options
+ * @param schedule budgets of the motion gated scheduler, NULL to process every frame
+ * @param filter_size convolution and median filter size to use
+ * @param pool worker pool to run the bands on
+ */
+void pipeline_init(struct pipeline *pipeline, int width, int height, int stride, enum frame_format format,
+                   const struct engine_config *config, const struct schedule_config *schedule, int filter_size,
+                   struct worker_pool *pool) {
+    int num_bands = pool->num_threads < height ? pool->num_threads : height;
+    size_t size = motion_engine_arena_size(width, height, config) + smoother_arena_size(filter_size, width, height) +
+                  bitmask_arena_size(width, height) + arena_size(sizeof(struct band) * num_bands) +
+                  4 * num_bands * arena_size(width) +
+                  2 * num_bands * arena_size(sizeof(struct roi_span) * motion_engine_max_row_spans(width)) +
+                  blob_labeler_arena_size(width, num_bands) + tracker_arena_size(width, height);
+
+    pipeline->width = width;
+    pipeline->height = height;
+    pipeline->pool = pool;
+    pipeline->num_bands = num_bands;
+    pipeline->frame = NULL;
+    pipeline->frames = 0;
+
+    arena_init(&pipeline->arena, size);
+    motion_engine_init(&pipeline->engine, width, height, stride, format, config, &pipeline->arena);
+    smoother_init(&pipeline->smoother, filter_size, width, height, &pipeline->arena);
+    bitmask_init(&pipeline->motion_image, width, height, &pipeline->arena);
+    pipeline->bands = arena_alloc(&pipeline->arena, sizeof(struct band) * num_bands);
+    blob_labeler_init(&pipeline->labeler, width, height, num_bands, &pipeline->arena);
+    tracker_init(&pipeline->tracker, width, height, &pipeline->arena);
+    scheduler_init(&pipeline->scheduler, schedule);
+
+    // Spread the rows as evenly as possible over the bands
+    for (int b = 0; b < num_bands; b++) {
+        struct band *band = &pipeline->bands[b];
+
+        band->first_row = (int) ((long) height * b / num_bands);
+        band->last_row = (int) ((long) height * (b + 1) / num_bands);
+
+        for (int k = 0; k < 4; k++) {
+            band->row[k] = arena_alloc(&pipeline->arena, width);
+        }
+
+        band->spans = arena_alloc(&pipeline->arena, sizeof(struct roi_span) * motion_engine_max_row_spans(width));
+        band->dirty_spans = arena_alloc(&pipeline->arena,
+                                        sizeof(struct roi_span) * motion_engine_max_row_spans(width));
+        band->dirty_rows = 0;
+        band->smoothed_pixels = 0;
+    }
+}
+
+/**
+ * Frees every buffer of a pipeline
+ *
+ * @param pipeline pipeline to free
+ */
+void pipeline_free(struct pipeline *pipeline) {
+    arena_free(&pipeline->arena);
+}
+
+/**
+ * Adds a frame to the background model while the background buffer is first being filled
+ *
+ * @param pipeline pipeline
+ * @param frame new frame from the video source
+ * @return 1 once the background buffer is full, 0 otherwise
+ */
+int pipeline_bootstrap(struct pipeline *pipeline, const uchar *frame) {
+    return motion_engine_bootstrap(&pipeline->engine, frame);
+}
+
+/**
+ * Coarse pass task, differences the coarse pixels of one band of the current frame
+ *
+ * @param context pipeline
+ * @param task band to run the coarse pass on
+ */
+static void coarse_band(void *context, int task) {
+    struct pipeline *pipeline = context;
+    struct band *band = &pipeline->bands[task];
+    double start = now();
+
+    motion_engine_coarse_rows(&pipeline->engine, pipeline->frame, band->first_row, band->last_row);
+    band->detect_time += now() - start;
+}
+
+/**
+ * Detection task, differences one band of the current frame
+ *
+ * @param context pipeline
+ * @param task band to detect
+ */
+static void detect_band(void *context, int task) {
+    struct pipeline *pipeline = context;
+    struct band *band = &pipeline->bands[task];
+    double start = now();
+
+    band->dirty_rows = motion_engine_detect_rows(&pipeline->engine, pipeline->frame, band->first_row,
+                                                 band->last_row, band->row, band->spans);
+    band->detect_time += now() - start;
+}
+
+/**
+ * Smoothing task, filters one band of the motion image and labels its blobs
+ *
+ * @param context pipeline
+ * @param task band to smooth
+ */
+static void smooth_band(void *context, int task) {
+    struct pipeline *pipeline = context;
+    struct band *band = &pipeline->bands[task];
+    double start = now();
+
+    blob_labeler_begin_band(&pipeline->labeler, task, band->first_row, band->last_row);
+
+    // Label each row while it is still in cache from the filter
+    for (int j = band->first_row; j < band->last_row; j++) {
+        uint64_t *motion_row = bitmask_row(&pipeline->motion_image, j);
+        int num_spans;
+        const struct roi_span *spans = motion_engine_row_spans(&pipeline->engine, j, TILE_CLEARING, band->spans,
+                                                               &num_spans);
+
+        // Tiles that just went idle are cleared, filtering them could pick up motion from an active neighbour that
+        // nothing would clear later
+        for (int s = 0; s < num_spans; s++) {
+            bitmask_clear_span(motion_row, spans[s].start, spans[s].end);
+        }
+
+        // The rest of the row is still what it was in the previous frame
+        spans = motion_engine_row_spans(&pipeline->engine, j, TILE_ACTIVE, band->spans, &num_spans);
+        num_spans = motion_engine_dirty_spans(&pipeline->engine, j, pipeline->smoother.filter_size / 2, spans,
+                                              num_spans, band->dirty_spans);
+        smoother_median_spans(&pipeline->smoother, &pipeline->engine.motion, &pipeline->motion_image, j,
+                              band->dirty_spans, num_spans);
+
+        for (int s = 0; s < num_spans; s++) {
+            band->smoothed_pixels += band->dirty_spans[s].end - band->dirty_spans[s].start;
+        }
+
+        blob_labeler_add_row(&pipeline->labeler, task, j, motion_row);
+    }
+
+    blob_labeler_end_band(&pipeline->labeler, task);
+    band->smooth_time += now() - start;
+}
+
+/**
+ * Smooths the motion image of the engine into pipeline->motion_image and finds its blobs
+ *
+ * @param pipeline pipeline
+ */
+void pipeline_smooth(struct pipeline *pipeline) {
+    worker_pool_run(pipeline->pool, smooth_band, pipeline, pipeline->num_bands);
+    blob_labeler_finish(&pipeline->labeler);
+}
+
+/**
+ * Detects motion in a frame, leaving the smoothed motion image in pipeline->motion_image, its blobs in
+ * pipeline->labeler and the updated tracks in pipeline->tracker
+ *
+ * While the scheduler is idle, frames are skipped or only checked for motion and leave all of these as they were: an
+ * empty motion image and no blobs.
+ *
+ * @param pipeline pipeline
+ * @param frame new frame from the video source
+ * @param timestamp capture time of the frame, in seconds
+ */
+void pipeline_process(struct pipeline *pipeline, const uchar *frame, double timestamp) {
+    struct scheduler *scheduler = &pipeline->scheduler;
+    int dirty_rows = 0;
+
+    switch (scheduler_next(scheduler)) {
+        case SCHEDULE_SKIP:
+            return;
+        case SCHEDULE_CHECK:
+            if (!scheduler_checked(scheduler, motion_engine_sample_motion(&pipeline->engine, frame,
+                                                                          scheduler->config.sample_step))) {
+                return;
+            }
+            break;
+        case SCHEDULE_PROCESS:
+            break;
+    }
+
+    pipeline->frame = frame;
+
+    // Every coarse row is needed to pick the tiles before any band is detected
+    if (pipeline->engine.pyramid.factor) {
+        worker_pool_run(pipeline->pool, coarse_band, pipeline, pipeline->num_bands);
+        motion_engine_flag_tiles(&pipeline->engine);
+    }
+
+    // Smoothing reads rows from the neighbouring bands, so every band is detected before any is smoothed
+    worker_pool_run(pipeline->pool, detect_band, pipeline, pipeline->num_bands);
+    motion_engine_advance(&pipeline->engine);
+
+    for (int b = 0; b < pipeline->num_bands; b++) {
+        dirty_rows += pipeline->bands[b].dirty_rows;
+    }
+
+    // Without a dirty tile the motion image and its blobs are those of the previous frame
+    if (dirty_rows) {
+        pipeline_smooth(pipeline);
+    }
+
+    tracker_update(&pipeline->tracker, pipeline->labeler.blobs, pipeline->labeler.num_blobs, timestamp);
+
+    pipeline->frame = NULL;
+    pipeline->frames++;
+
+    // The specks left under the blob size are not motion the idle frames should keep reporting
+    if (scheduler_processed(scheduler, pipeline->labeler.num_blobs)) {
+        bitmask_clear(&pipeline->motion_image);
+    }
+}
+
+/**
+ * Prints the average time spent on each band per frame
+ *
+ * @param pipeline pipeline
+ * @param out stream to print to
+ */
+void pipeline_print_band_times(const struct pipeline *pipeline, FILE *out) {
+    int frames = pipeline->frames > 0 ? pipeline->frames : 1;
+
+    fprintf(out, "Band timing over %d frames (%d threads):\n", pipeline->frames, pipeline->pool->num_threads);
+
+    for (int b = 0; b < pipeline->num_bands; b++) {
+        const struct band *band = &pipeline->bands[b];
+        double band_pixels = (double) pipeline->width * (band->last_row - band->first_row);
+
+        fprintf(out, "  band %d rows %d-%d: detect %.3f ms smooth %.3f ms (%.1f%% smoothed)\n", b, band->first_row,
+                band->last_row - 1, band->detect_time * 1000 / frames, band->smooth_time * 1000 / frames,
+                100.0 * band->smoothed_pixels / (frames * band_pixels));
+    }
+}
@@ -0,0 +1,88 @@
+/**
+ * Frame processing pipeline
+ *
+ * Owns every working buffer needed to turn a frame into a smoothed motion image. All of them are allocated once from
+ * a single arena when the pipeline is created, so processing a frame makes no heap allocations.
+ *
+ * Each frame is split into horizontal bands that are run on a worker pool, first through detection and then, once
+ * every band has been detected, through smoothing. Each row is labeled into blobs as soon as it has been smoothed, and
+ * the blobs of the frame are then linked to those of the previous frames.
+ *
+ * A scheduler may gate the pipeline on motion, skipping the frames of a still scene but for a cheap check every few
+ * frames. With coarse to fine detection, a coarse pass over every band first picks the tiles detected and smoothed.
+ * Detection keeps a dirty map of the motion plane, and smoothing only works out again the parts of the motion image
+ * near a dirty tile, reusing the rest from the previous frame. A frame without any dirty tile is not smoothed nor
+ * labeled at all, and keeps the blobs of the previous frame.
+ */
+
+#ifndef MOTION_DETECTOR_PIPELINE_H
+#define MOTION_DETECTOR_PIPELINE_H
+
+#include <stdio.h>
+#include "arena.h"
+#include "blobs.h"
+#include "motion_engine.h"
+#include "scheduler.h"
+#include "smoothing.h"
+#include "tracker.h"
+#include "worker_pool.h"
+
+/**
+ * A horizontal band of rows processed by a single task
+ */
+struct band {
+    int first_row;
+    // Row after the last row of the band
+    int last_row;
+    // Unpacked Y, U and V values of the row being detected, and its thresholded motion before it is packed
+    uchar *row[4];
+    // Spans of the row being detected or smoothed
+    struct roi_span *spans;
+    // Spans of the row being smoothed that reach a dirty tile
+    struct roi_span *dirty_spans;
+    // Rows of the band with a dirty tile in the current frame
+    int dirty_rows;
+    // Pixels smoothed again, summed over every processed frame
+    long smoothed_pixels;
+    // Seconds spent detecting and smoothing the band, the coarse pass and labeling included, summed over every
+    // processed frame
+    double detect_time;
+    double smooth_time;
+} __attribute__((aligned(ARENA_ALIGNMENT)));
+
+/**
+ * Processing context for a single video stream
+ */
+struct pipeline {
+    int width;
+    int height;
+    struct arena arena;
+    struct motion_engine engine;
+    struct smoother smoother;
+    // Smoothed motion image of the last frame, one bit per pixel
+    struct bitmask motion_image;
+    // Blobs of the smoothed motion image
+    struct blob_labeler labeler;
+    // Blobs followed across frames
+    struct tracker tracker;
+    // Decides which frames are processed in full
+    struct scheduler scheduler;
+    // Pool the bands are run on, shared with the caller
+    struct worker_pool *pool;
+    int num_bands;
+    struct band *bands;
+    // Frame being processed by the bands
+    const uchar *frame;
+    // Number of frames processed in full
+    int frames;
+};
+
+void pipeline_init(struct pipeline *pipeline, int width, int height, int stride, enum frame_format format,
+                   const struct engine_config *config, const struct schedule_config *schedule, int filter_size,
+                   struct worker_pool *pool);
+void pipeline_free(struct pipeline *pipeline);
+int pipeline_bootstrap(struct pipeline *pipeline, const uchar *frame);
+void pipeline_process(struct pipeline *pipeline, const uchar *frame, double timestamp);
+void pipeline_smooth(struct pipeline *pipeline);
+void pipeline_print_band_times(const struct pipeline *pipeline, FILE *out);
+#endif //MOTION_DETECTOR_PIPELINE_H
@@ -0,0 +1,279 @@
+/**
+ * Coarse to fine detection
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pyramid.h"
+
+/**
+ * Number of tiles needed to cover size pixels
+ */
+static int tile_count(int size) {
+    return (size + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+}
+
+/**
+ * Arena space needed by the coarse pass
+ *
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param factor pixels averaged along each side of a coarse pixel, 0 if coarse to fine detection is off
+ * @return size in bytes
+ */
+size_t pyramid_arena_size(int width, int height, int factor) {
+    size_t num_tiles = (size_t) tile_count(width) * tile_count(height);
+
+    if (!factor) {
+        return 0;
+    }
+
+    return arena_size((size_t) (width / factor) * (height / factor) * sizeof(uint16_t)) +
+           arena_size((size_t) (height / factor) * tile_count(width)) + 3 * arena_size(num_tiles);
+}
+
+/**
+ * Initializes the coarse pass with every tile idle
+ *
+ * @param pyramid coarse pass to initialize
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param stride bytes between the start of two rows of a frame
+ * @param luma_step bytes between the luma of two pixels of a frame
+ * @param factor pixels averaged along each side of a coarse pixel, 0 to turn coarse to fine detection off
+ * @param hold_frames frames a tile stays active after its last change
+ * @param arena arena to allocate the coarse model and tiles from
+ */
+void pyramid_init(struct pyramid *pyramid, int width, int height, int stride, int luma_step, int factor,
+                  int hold_frames, struct arena *arena) {
+    size_t num_tiles;
+
+    pyramid->factor = factor;
+    pyramid->width = width;
+    pyramid->height = height;
+    pyramid->stride = stride;
+    pyramid->luma_step = luma_step;
+    pyramid->coarse_width = factor ? width / factor : 0;
+    pyramid->coarse_height = factor ? height / factor : 0;
+    pyramid->tiles_x = tile_count(width);
+    pyramid->tiles_y = tile_count(height);
+    pyramid->seeded = 0;
+    pyramid->hold_frames = hold_frames;
+    pyramid->active_tiles = 0;
+    pyramid->frames = 0;
+
+    if (!factor) {
+        return;
+    }
+
+    num_tiles = (size_t) pyramid->tiles_x * pyramid->tiles_y;
+    pyramid->model = arena_alloc(arena, (size_t) pyramid->coarse_width * pyramid->coarse_height * sizeof(uint16_t));
+    pyramid->changed = arena_alloc(arena, (size_t) pyramid->coarse_height * pyramid->tiles_x);
+    pyramid->tile_changed = arena_alloc(arena, num_tiles);
+    pyramid->hold = arena_alloc(arena, num_tiles);
+    pyramid->state = arena_alloc(arena, num_tiles);
+
+    memset(pyramid->hold, 0, num_tiles);
+    memset(pyramid->state, TILE_IDLE, num_tiles);
+}
+
+/**
+ * Averages a block of luma into a coarse pixel
+ *
+ * @param pyramid coarse pass
+ * @param frame frame to average
+ * @param cx column of the coarse pixel
+ * @param cy row of the coarse pixel
+ * @return mean luma of the block, Q8.8
+ */
+static int coarse_pixel(const struct pyramid *pyramid, const uchar *frame, int cx, int cy) {
+    int factor = pyramid->factor;
+    const uchar *src = frame + (size_t) cy * factor * pyramid->stride + (size_t) cx * factor * pyramid->luma_step;
+    int sum = 0;
+
+    for (int r = 0; r < factor; r++) {
+        for (int c = 0; c < factor; c++) {
+            sum += src[c * pyramid->luma_step];
+        }
+
+        src += pyramid->stride;
+    }
+
+    return sum * 256 / (factor * factor);
+}
+
+/**
+ * Folds a frame into the coarse model while the background is first being learnt, the first frame seeds it
+ *
+ * @param pyramid coarse pass
+ * @param frame new frame from the video source
+ */
+void pyramid_bootstrap(struct pyramid *pyramid, const uchar *frame) {
+    for (int cy = 0; cy < pyramid->coarse_height; cy++) {
+        uint16_t *model_row = pyramid->model + (size_t) cy * pyramid->coarse_width;
+
+        for (int cx = 0; cx < pyramid->coarse_width; cx++) {
+            int value = coarse_pixel(pyramid, frame, cx, cy);
+
+            model_row[cx] = pyramid->seeded ? model_row[cx] + (value - model_row[cx]) / PYRAMID_MODEL_FRAMES : value;
+        }
+    }
+
+    pyramid->seeded = 1;
+}
+
+/**
+ * Differences the coarse pixels of a band of rows against the coarse model, updating the model in the same pass
+ *
+ * Each band covers the coarse rows starting within it, so bands that do not overlap can be run in parallel.
+ *
+ * @param pyramid coarse pass
+ * @param frame new frame from the video source
+ * @param first_row first row of the band
+ * @param last_row row after the last row of the band
+ */
+void pyramid_coarse_rows(struct pyramid *pyramid, const uchar *frame, int first_row, int last_row) {
+    int first = (first_row + pyramid->factor - 1) / pyramid->factor;
+    int last = (last_row + pyramid->factor - 1) / pyramid->factor;
+
+    last = last < pyramid->coarse_height ? last : pyramid->coarse_height;
+
+    for (int cy = first; cy < last; cy++) {
+        uint16_t *model_row = pyramid->model + (size_t) cy * pyramid->coarse_width;
+        uchar *changed_row = pyramid->changed + (size_t) cy * pyramid->tiles_x;
+
+        memset(changed_row, 0, pyramid->tiles_x);
+
+        for (int cx = 0; cx < pyramid->coarse_width; cx++) {
+            int value = coarse_pixel(pyramid, frame, cx, cy);
+            int difference = value - model_row[cx];
+
+            if (difference >= PYRAMID_THRESHOLD * 256 || difference <= -PYRAMID_THRESHOLD * 256) {
+                changed_row[cx * pyramid->factor / PYRAMID_TILE_SIZE] = 1;
+            }
+
+            model_row[cx] += difference / PYRAMID_MODEL_FRAMES;
+        }
+    }
+}
+
+/**
+ * Decides what each tile does with the current frame, once every coarse row has been differenced
+ *
+ * A change in a tile activates it and its 8 neighbours, so motion crossing into a tile is detected in full even where
+ * too little of it is in the tile for the coarse pass to see.
+ *
+ * @param pyramid coarse pass
+ */
+void pyramid_flag_tiles(struct pyramid *pyramid) {
+    int coarse_tile = PYRAMID_TILE_SIZE / pyramid->factor;
+
+    for (int ty = 0; ty < pyramid->tiles_y; ty++) {
+        int first = ty * coarse_tile;
+        int last = first + coarse_tile < pyramid->coarse_height ? first + coarse_tile : pyramid->coarse_height;
+
+        for (int tx = 0; tx < pyramid->tiles_x; tx++) {
+            uchar changed = 0;
+
+            for (int cy = first; cy < last; cy++) {
+                changed |= pyramid->changed[(size_t) cy * pyramid->tiles_x + tx];
+            }
+
+            pyramid->tile_changed[ty * pyramid->tiles_x + tx] = changed;
+        }
+    }
+
+    for (int ty = 0; ty < pyramid->tiles_y; ty++) {
+        for (int tx = 0; tx < pyramid->tiles_x; tx++) {
+            int t = ty * pyramid->tiles_x + tx;
+            int changed = 0;
+
+            for (int ny = ty - 1; ny <= ty + 1; ny++) {
+                for (int nx = tx - 1; nx <= tx + 1; nx++) {
+                    if (ny >= 0 && ny < pyramid->tiles_y && nx >= 0 && nx < pyramid->tiles_x) {
+                        changed |= pyramid->tile_changed[ny * pyramid->tiles_x + nx];
+                    }
+                }
+            }
+
+            if (changed) {
+                pyramid->hold[t] = pyramid->hold_frames;
+            } else if (pyramid->hold[t] > 0) {
+                pyramid->hold[t]--;
+            }
+
+            if (pyramid->hold[t] > 0) {
+                pyramid->state[t] = TILE_ACTIVE;
+                pyramid->active_tiles++;
+            } else {
+                pyramid->state[t] = pyramid->state[t] == TILE_ACTIVE ? TILE_CLEARING : TILE_IDLE;
+            }
+        }
+    }
+
+    pyramid->frames++;
+}
+
+/**
+ * Spans of a row covered by the tiles in a given state, within the region of interest
+ *
+ * @param pyramid coarse pass
+ * @param roi region of interest
+ * @param j row
+ * @param state state of the tiles to cover
+ * @param spans spans to fill, room for (width + 1) / 2 + tiles_x of them
+ * @return number of spans
+ */
+int pyramid_row_spans(const struct pyramid *pyramid, const struct roi *roi, int j, enum tile_state state,
+                      struct roi_span *spans) {
+    const uchar *states = pyramid->state + (j / PYRAMID_TILE_SIZE) * pyramid->tiles_x;
+    int num_roi_spans;
+    const struct roi_span *roi_spans = roi_row(roi, j, &num_roi_spans);
+    int num_spans = 0;
+    int r = 0;
+
+    for (int tx = 0; tx < pyramid->tiles_x;) {
+        int start;
+        int end;
+
+        if (states[tx] != state) {
+            tx++;
+            continue;
+        }
+
+        // Neighbouring tiles in the same state make one run
+        for (start = tx * PYRAMID_TILE_SIZE; tx < pyramid->tiles_x && states[tx] == state; tx++);
+
+        end = tx * PYRAMID_TILE_SIZE < pyramid->width ? tx * PYRAMID_TILE_SIZE : pyramid->width;
+
+        while (r < num_roi_spans && roi_spans[r].end <= start) {
+            r++;
+        }
+
+        for (int q = r; q < num_roi_spans && roi_spans[q].start < end; q++) {
+            spans[num_spans].start = roi_spans[q].start > start ? roi_spans[q].start : start;
+            spans[num_spans].end = roi_spans[q].end < end ? roi_spans[q].end : end;
+            num_spans++;
+        }
+    }
+
+    return num_spans;
+}
+
+/**
+ * Prints how much of the frame the coarse pass let through, does nothing unless coarse to fine detection is on
+ *
+ * @param pyramid coarse pass
+ * @param out stream to print to
+ */
+void pyramid_print_stats(const struct pyramid *pyramid, FILE *out) {
+    long frames = pyramid->frames > 0 ? pyramid->frames : 1;
+
+    if (!pyramid->factor) {
+        return;
+    }
+
+    fprintf(out, "Coarse to fine: %.1f%% of the %dx%d tiles active per frame over %ld frames (1/%d downsampling)\n",
+            100.0 * pyramid->active_tiles / ((double) frames * pyramid->tiles_x * pyramid->tiles_y),
+            PYRAMID_TILE_SIZE, PYRAMID_TILE_SIZE, pyramid->frames, pyramid->factor);
+}
@@ -0,0 +1,81 @@
+/**
+ * Coarse to fine detection
+ *
+ * Averages the luma of each block of factor x factor pixels into a coarse image and differences it against a coarse
+ * background model of its own, a moving average kept at the coarse resolution. The frame is cut into tiles, and only
+ * the tiles the coarse pass saw change, along with their neighbours, are run through full resolution detection and
+ * smoothing. A tile stays active for a while after its last change, so the full resolution model can forget what
+ * moved through it before it goes idle again. Idle tiles show no motion and their full resolution model is left as it
+ * was.
+ */
+
+#ifndef MOTION_DETECTOR_PYRAMID_H
+#define MOTION_DETECTOR_PYRAMID_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "image_manipulation.h"
+#include "arena.h"
+#include "roi.h"
+
+// Side of the tiles, in full resolution pixels. Even so tiles never split a YUYV pair.
+#define PYRAMID_TILE_SIZE 32
+// Luma levels a coarse pixel has to differ from the coarse model by to flag its tile
+#define PYRAMID_THRESHOLD 8
+// Weight of each new frame in the coarse model is 1 / PYRAMID_MODEL_FRAMES
+#define PYRAMID_MODEL_FRAMES 10
+
+/**
+ * What a tile does with the current frame
+ */
+enum tile_state {
+    // Not processed, the motion image is still
+    TILE_IDLE,
+    // Detected and smoothed at full resolution
+    TILE_ACTIVE,
+    // Just went idle, the motion image is cleared once
+    TILE_CLEARING
+};
+
+/**
+ * Coarse pass state of a video stream
+ */
+struct pyramid {
+    // Pixels averaged along each side of a coarse pixel, 0 when coarse to fine detection is off
+    int factor;
+    int width;
+    int height;
+    // Bytes between the start of two rows of a frame, and between the luma of two pixels
+    int stride;
+    int luma_step;
+    int coarse_width;
+    int coarse_height;
+    // Coarse background model, Q8.8 luma
+    uint16_t *model;
+    int seeded;
+    int tiles_x;
+    int tiles_y;
+    // Whether each coarse row changed in each column of tiles, tiles_x bytes per coarse row
+    uchar *changed;
+    // Whether each tile changed in the current frame
+    uchar *tile_changed;
+    // Frames each tile stays active for, and what each tile does with the current frame
+    uchar *hold;
+    uchar *state;
+    // Frames a tile stays active after its last change
+    int hold_frames;
+    // Active tiles summed over every frame, and number of frames
+    long active_tiles;
+    long frames;
+};
+
+size_t pyramid_arena_size(int width, int height, int factor);
+void pyramid_init(struct pyramid *pyramid, int width, int height, int stride, int luma_step, int factor,
+                  int hold_frames, struct arena *arena);
+void pyramid_bootstrap(struct pyramid *pyramid, const uchar *frame);
+void pyramid_coarse_rows(struct pyramid *pyramid, const uchar *frame, int first_row, int last_row);
+void pyramid_flag_tiles(struct pyramid *pyramid);
+int pyramid_row_spans(const struct pyramid *pyramid, const struct roi *roi, int j, enum tile_state state,
+                      struct roi_span *spans);
+void pyramid_print_stats(const struct pyramid *pyramid, FILE *out);
+#endif //MOTION_DETECTOR_PYRAMID_H
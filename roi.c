@@ -0,0 +1,410 @@
+/**
+ * Regions of interest
+ *
+ * A PGM mask watches its pixels brighter than half its maximum value and is stretched to the frame size if it does not
+ * match it. A polygon file holds one polygon per line, an include or exclude keyword followed by the x y coordinates of
+ * at least 3 vertices in frame pixels, with # starting a comment:
+ *
+ *     # Watch the doorway but not the clock above it
+ *     include 100 20 220 20 220 239 100 239
+ *     exclude 150 20 170 20 170 40 150 40
+ *
+ * Polygons are drawn in order. The frame starts out excluded if any polygon is an include one, watched otherwise.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roi.h"
+
+// Most vertices of a polygon
+#define ROI_MAX_VERTICES 256
+// Longest line of a polygon file
+#define ROI_MAX_LINE 4096
+
+/**
+ * Reports a malformed region of interest file and exits
+ *
+ * @param path path of the file
+ * @param message what is wrong with it
+ */
+static void roi_error(const char *path, const char *message) {
+    fprintf(stderr, "Bad region of interest file %s: %s\n", path, message);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Reads the next number of a PGM, skipping whitespace and comments
+ *
+ * The whitespace character following the number is consumed too, which is where the binary pixels start after the
+ * header.
+ *
+ * @param file PGM file
+ * @param path path of the file
+ * @return number read
+ */
+static int read_pgm_number(FILE *file, const char *path) {
+    int value = 0;
+    int c;
+
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(file)) != EOF && c != '\n');
+        } else if (!isspace(c)) {
+            break;
+        }
+    }
+
+    if (c == EOF || !isdigit(c)) {
+        roi_error(path, "truncated PGM");
+    }
+
+    for (; c != EOF && isdigit(c); c = fgetc(file)) {
+        value = value * 10 + c - '0';
+    }
+
+    return value;
+}
+
+/**
+ * Reads a PGM mask, its magic number already read, and stretches it over the frame
+ *
+ * @param file PGM file
+ * @param path path of the file
+ * @param binary 1 for a binary P5 PGM, 0 for a plain P2 one
+ * @param mask mask to fill, width * height bytes
+ * @param width width of the frames
+ * @param height height of the frames
+ */
+static void load_pgm(FILE *file, const char *path, int binary, uchar *mask, int width, int height) {
+    int pgm_width = read_pgm_number(file, path);
+    int pgm_height = read_pgm_number(file, path);
+    int max_value = read_pgm_number(file, path);
+    uchar *watched;
+
+    if (pgm_width <= 0 || pgm_height <= 0 || max_value <= 0 || max_value > UINT16_MAX) {
+        roi_error(path, "bad PGM header");
+    }
+
+    watched = malloc((size_t) pgm_width * pgm_height);
+
+    for (size_t p = 0; p < (size_t) pgm_width * pgm_height; p++) {
+        int value;
+
+        if (!binary) {
+            value = read_pgm_number(file, path);
+        } else if (max_value > 255) {
+            // Two bytes per pixel, most significant first
+            int high = fgetc(file);
+            int low = fgetc(file);
+
+            value = low == EOF ? EOF : high << 8 | low;
+        } else {
+            value = fgetc(file);
+        }
+
+        if (value == EOF) {
+            roi_error(path, "truncated PGM");
+        }
+
+        watched[p] = value > max_value / 2 ? ROI_WATCHED : ROI_EXCLUDED;
+    }
+
+    for (int j = 0; j < height; j++) {
+        const uchar *pgm_row = watched + (size_t) ((long) j * pgm_height / height) * pgm_width;
+
+        for (int i = 0; i < width; i++) {
+            mask[(size_t) j * width + i] = pgm_row[(long) i * pgm_width / width];
+        }
+    }
+
+    free(watched);
+}
+
+/**
+ * Sets the pixels whose centers lie inside a polygon, by the even-odd rule
+ *
+ * @param mask mask to draw on
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param x x coordinates of the vertices
+ * @param y y coordinates of the vertices
+ * @param num_vertices number of vertices
+ * @param value value to set the pixels to
+ */
+static void fill_polygon(uchar *mask, int width, int height, const double *x, const double *y, int num_vertices,
+                         uchar value) {
+    double crossings[ROI_MAX_VERTICES];
+
+    for (int j = 0; j < height; j++) {
+        double center = j + 0.5;
+        int num_crossings = 0;
+
+        // Find where the edges cross the row, sorted by insertion
+        for (int v = 0; v < num_vertices; v++) {
+            int w = (v + 1) % num_vertices;
+            double crossing;
+            int c;
+
+            if ((y[v] <= center) == (y[w] <= center)) {
+                continue;
+            }
+
+            crossing = x[v] + (center - y[v]) * (x[w] - x[v]) / (y[w] - y[v]);
+
+            for (c = num_crossings++; c > 0 && crossings[c - 1] > crossing; c--) {
+                crossings[c] = crossings[c - 1];
+            }
+
+            crossings[c] = crossing;
+        }
+
+        for (int c = 0; c + 1 < num_crossings; c += 2) {
+            double first = ceil(crossings[c] - 0.5);
+            double last = ceil(crossings[c + 1] - 0.5);
+            int start = first < 0 ? 0 : (first > width ? width : (int) first);
+            int end = last < 0 ? 0 : (last > width ? width : (int) last);
+
+            for (int i = start; i < end; i++) {
+                mask[(size_t) j * width + i] = value;
+            }
+        }
+    }
+}
+
+/**
+ * Parses a line of a polygon file
+ *
+ * @param line line to parse, modified
+ * @param path path of the file
+ * @param include set to 1 for an include polygon, 0 for an exclude one
+ * @param x set to the x coordinates of the vertices
+ * @param y set to the y coordinates of the vertices
+ * @return number of vertices, 0 for a blank line
+ */
+static int parse_polygon(char *line, const char *path, int *include, double *x, double *y) {
+    char *comment = strchr(line, '#');
+    char *token;
+    int num_values = 0;
+
+    if (comment) {
+        *comment = '\0';
+    }
+
+    token = strtok(line, " \t\r\n,");
+
+    if (!token) {
+        return 0;
+    }
+
+    if (strcmp(token, "include") == 0) {
+        *include = 1;
+    } else if (strcmp(token, "exclude") == 0) {
+        *include = 0;
+    } else {
+        roi_error(path, "polygons start with include or exclude");
+    }
+
+    // Coordinates alternate between x and y
+    while ((token = strtok(NULL, " \t\r\n,"))) {
+        char *end;
+        double value = strtod(token, &end);
+
+        if (*end || num_values == 2 * ROI_MAX_VERTICES) {
+            roi_error(path, "polygons are at most 256 x y pairs of numbers");
+        }
+
+        if (num_values % 2) {
+            y[num_values / 2] = value;
+        } else {
+            x[num_values / 2] = value;
+        }
+
+        num_values++;
+    }
+
+    if (num_values % 2 || num_values < 6) {
+        roi_error(path, "polygons need x y pairs for at least 3 vertices");
+    }
+
+    return num_values / 2;
+}
+
+/**
+ * Draws the polygons of a polygon file
+ *
+ * @param file polygon file
+ * @param path path of the file
+ * @param mask mask to fill, width * height bytes
+ * @param width width of the frames
+ * @param height height of the frames
+ */
+static void load_polygons(FILE *file, const char *path, uchar *mask, int width, int height) {
+    char line[ROI_MAX_LINE];
+    double x[ROI_MAX_VERTICES];
+    double y[ROI_MAX_VERTICES];
+    int include;
+    int any_include = 0;
+
+    // The first pass only checks what the frame starts out as
+    while (fgets(line, sizeof(line), file)) {
+        if (parse_polygon(line, path, &include, x, y) && include) {
+            any_include = 1;
+        }
+    }
+
+    memset(mask, any_include ? ROI_EXCLUDED : ROI_WATCHED, (size_t) width * height);
+    rewind(file);
+
+    while (fgets(line, sizeof(line), file)) {
+        int num_vertices = parse_polygon(line, path, &include, x, y);
+
+        if (num_vertices) {
+            fill_polygon(mask, width, height, x, y, num_vertices, include ? ROI_WATCHED : ROI_EXCLUDED);
+        }
+    }
+}
+
+/**
+ * Loads a region of interest from a PGM image or a polygon file
+ *
+ * @param path path of the file, a PGM if it starts with a P2 or P5 magic number and a polygon file otherwise
+ * @param width width of the frames
+ * @param height height of the frames
+ * @return mask of width * height bytes, ROI_WATCHED or ROI_EXCLUDED, to be freed by the caller
+ */
+uchar *roi_load(const char *path, int width, int height) {
+    FILE *file = fopen(path, "rb");
+    uchar *mask = malloc((size_t) width * height);
+    char magic[3] = {0};
+
+    if (!file) {
+        fprintf(stderr, "Failed to open region of interest file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && (magic[1] == '2' || magic[1] == '5')) {
+        load_pgm(file, path, magic[1] == '5', mask, width, height);
+    } else {
+        rewind(file);
+        load_polygons(file, path, mask, width, height);
+    }
+
+    fclose(file);
+
+    return mask;
+}
+
+/**
+ * Compiles a row of a mask into spans
+ *
+ * Runs of watched pixels are widened to whole YUYV pairs, merging runs that end up touching.
+ *
+ * @param mask_row row of the mask, NULL to watch the whole row
+ * @param width width of the row
+ * @param spans spans to fill, NULL to only count them
+ * @return number of spans
+ */
+static int compile_row(const uchar *mask_row, int width, struct roi_span *spans) {
+    int num_spans = 0;
+    int last_end = -1;
+
+    if (!mask_row) {
+        if (spans) {
+            spans[0].start = 0;
+            spans[0].end = width;
+        }
+
+        return 1;
+    }
+
+    for (int i = 0; i < width;) {
+        int start;
+        int end;
+
+        if (mask_row[i] != ROI_WATCHED) {
+            i++;
+            continue;
+        }
+
+        for (start = i; i < width && mask_row[i] == ROI_WATCHED; i++);
+
+        start &= ~1;
+        end = (i + 1) & ~1;
+        end = end > width ? width : end;
+
+        if (start <= last_end) {
+            // Touches the previous span once both are widened
+            if (spans) {
+                spans[num_spans - 1].end = end;
+            }
+        } else {
+            if (spans) {
+                spans[num_spans].start = start;
+                spans[num_spans].end = end;
+            }
+
+            num_spans++;
+        }
+
+        last_end = end;
+    }
+
+    return num_spans;
+}
+
+/**
+ * Arena space needed by a region of interest
+ *
+ * @param mask mask of watched pixels, NULL to watch the whole frame
+ * @param width width of the frames
+ * @param height height of the frames
+ * @return size in bytes
+ */
+size_t roi_arena_size(const uchar *mask, int width, int height) {
+    size_t num_spans = 0;
+
+    for (int j = 0; j < height; j++) {
+        num_spans += compile_row(mask ? mask + (size_t) j * width : NULL, width, NULL);
+    }
+
+    return arena_size(sizeof(int) * (height + 1)) + arena_size(sizeof(struct roi_span) * (num_spans ? num_spans : 1));
+}
+
+/**
+ * Compiles a mask into spans
+ *
+ * @param roi region of interest to initialize
+ * @param mask mask of watched pixels, NULL to watch the whole frame
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param arena arena to allocate the spans from, sized with roi_arena_size()
+ */
+void roi_init(struct roi *roi, const uchar *mask, int width, int height, struct arena *arena) {
+    size_t num_spans = 0;
+
+    for (int j = 0; j < height; j++) {
+        num_spans += compile_row(mask ? mask + (size_t) j * width : NULL, width, NULL);
+    }
+
+    roi->width = width;
+    roi->height = height;
+    roi->row_spans = arena_alloc(arena, sizeof(int) * (height + 1));
+    roi->spans = arena_alloc(arena, sizeof(struct roi_span) * (num_spans ? num_spans : 1));
+    roi->row_spans[0] = 0;
+    roi->watched = 0;
+
+    for (int j = 0; j < height; j++) {
+        struct roi_span *spans = roi->spans + roi->row_spans[j];
+        int count = compile_row(mask ? mask + (size_t) j * width : NULL, width, spans);
+
+        for (int s = 0; s < count; s++) {
+            roi->watched += spans[s].end - spans[s].start;
+        }
+
+        roi->row_spans[j + 1] = roi->row_spans[j] + count;
+    }
+}
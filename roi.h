@@ -0,0 +1,59 @@
+/**
+ * Regions of interest
+ *
+ * A static mask of the pixels worth watching, loaded from a PGM image or a polygon file and compiled into a list of
+ * spans for each row. Detection, the model update and smoothing only ever touch the pixels inside the spans, the others
+ * are never read or written and stay still in the motion image.
+ */
+
+#ifndef MOTION_DETECTOR_ROI_H
+#define MOTION_DETECTOR_ROI_H
+
+#include "image_manipulation.h"
+#include "arena.h"
+
+// Mask values
+#define ROI_WATCHED 1
+#define ROI_EXCLUDED 0
+
+/**
+ * Pixels [start, end) of a row
+ */
+struct roi_span {
+    int start;
+    int end;
+};
+
+/**
+ * Watched pixels of a frame as spans of each row
+ *
+ * Spans start on an even pixel and end on an even pixel or at the end of the row, so they never split the pair of
+ * pixels sharing a YUYV chroma sample.
+ */
+struct roi {
+    int width;
+    int height;
+    // Index of the first span of each row in spans, height + 1 entries
+    int *row_spans;
+    struct roi_span *spans;
+    // Number of watched pixels
+    long watched;
+};
+
+uchar *roi_load(const char *path, int width, int height);
+size_t roi_arena_size(const uchar *mask, int width, int height);
+void roi_init(struct roi *roi, const uchar *mask, int width, int height, struct arena *arena);
+
+/**
+ * Spans of a row
+ *
+ * @param roi region of interest
+ * @param j row
+ * @param count set to the number of spans
+ * @return first span of the row
+ */
+static inline const struct roi_span *roi_row(const struct roi *roi, int j, int *count) {
+    *count = roi->row_spans[j + 1] - roi->row_spans[j];
+    return roi->spans + roi->row_spans[j];
+}
+#endif //MOTION_DETECTOR_ROI_H
@@ -0,0 +1,129 @@
+/**
+ * Motion gated frame scheduler
+ */
+
+#include "blobs.h"
+#include "scheduler.h"
+
+/**
+ * Initializes a scheduler, starting out active
+ *
+ * Budgets left at 0 other than the idle interval take their defaults.
+ *
+ * @param scheduler scheduler to initialize
+ * @param config budgets, NULL to process every frame
+ */
+void scheduler_init(struct scheduler *scheduler, const struct schedule_config *config) {
+    struct schedule_config *budgets = &scheduler->config;
+
+    budgets->idle_interval = 0;
+    budgets->sample_step = SCHEDULE_DEFAULT_SAMPLE_STEP;
+    budgets->wake_samples = 0;
+    budgets->idle_after = SCHEDULE_DEFAULT_IDLE_AFTER;
+
+    if (config) {
+        budgets->idle_interval = config->idle_interval;
+        budgets->sample_step = config->sample_step > 0 ? config->sample_step : budgets->sample_step;
+        budgets->wake_samples = config->wake_samples;
+        budgets->idle_after = config->idle_after > 0 ? config->idle_after : budgets->idle_after;
+    }
+
+    // A blob of MIN_BLOB_AREA pixels covers about this many samples
+    if (budgets->wake_samples <= 0) {
+        budgets->wake_samples = MIN_BLOB_AREA / (budgets->sample_step * budgets->sample_step);
+        budgets->wake_samples = budgets->wake_samples > 0 ? budgets->wake_samples : 1;
+    }
+
+    scheduler->idle = 0;
+    scheduler->quiet_frames = 0;
+    scheduler->frames_to_check = 0;
+    scheduler->processed = 0;
+    scheduler->checked = 0;
+    scheduler->skipped = 0;
+    scheduler->wakeups = 0;
+}
+
+/**
+ * Decides what to do with the next frame
+ *
+ * @param scheduler scheduler
+ * @return SCHEDULE_PROCESS to run the frame through the whole pipeline, SCHEDULE_CHECK to run the idle check on it and
+ *         report the result with scheduler_checked(), SCHEDULE_SKIP to drop it
+ */
+enum schedule_action scheduler_next(struct scheduler *scheduler) {
+    if (!scheduler->idle) {
+        return SCHEDULE_PROCESS;
+    }
+
+    if (scheduler->frames_to_check > 0) {
+        scheduler->frames_to_check--;
+        scheduler->skipped++;
+        return SCHEDULE_SKIP;
+    }
+
+    scheduler->frames_to_check = scheduler->config.idle_interval - 1;
+    scheduler->checked++;
+    return SCHEDULE_CHECK;
+}
+
+/**
+ * Reports the result of an idle check
+ *
+ * @param scheduler scheduler
+ * @param changed_samples number of sampled pixels that differ from the background model
+ * @return 1 if the pipeline woke up and the checked frame has to be processed, 0 otherwise
+ */
+int scheduler_checked(struct scheduler *scheduler, int changed_samples) {
+    if (changed_samples < scheduler->config.wake_samples) {
+        return 0;
+    }
+
+    scheduler->idle = 0;
+    scheduler->quiet_frames = 0;
+    scheduler->wakeups++;
+
+    return 1;
+}
+
+/**
+ * Reports the blobs found in a processed frame
+ *
+ * @param scheduler scheduler
+ * @param num_blobs number of blobs in the frame
+ * @return 1 if the pipeline just went idle, 0 otherwise
+ */
+int scheduler_processed(struct scheduler *scheduler, int num_blobs) {
+    scheduler->processed++;
+
+    if (num_blobs > 0) {
+        scheduler->quiet_frames = 0;
+        return 0;
+    }
+
+    // Without an idle interval the scheduler never goes idle
+    if (scheduler->config.idle_interval <= 0 || ++scheduler->quiet_frames < scheduler->config.idle_after) {
+        return 0;
+    }
+
+    scheduler->idle = 1;
+    scheduler->frames_to_check = scheduler->config.idle_interval - 1;
+
+    return 1;
+}
+
+/**
+ * Prints how the frames were scheduled
+ *
+ * @param scheduler scheduler
+ * @param out stream to print to
+ */
+void scheduler_print_stats(const struct scheduler *scheduler, FILE *out) {
+    if (scheduler->config.idle_interval <= 0) {
+        return;
+    }
+
+    fprintf(out, "Scheduler: %lu frames processed, %lu idle checks, %lu skipped, %lu wake ups (checking every %d "
+                 "frames, 1/%d of the pixels)\n", scheduler->processed, scheduler->checked, scheduler->skipped,
+            scheduler->wakeups, scheduler->config.idle_interval,
+            scheduler->config.sample_step * scheduler->config.sample_step);
+}
@@ -0,0 +1,65 @@
+/**
+ * Motion gated frame scheduler
+ *
+ * Runs a pipeline at full rate only while there is motion to follow. Once no blob has been seen for a while the
+ * pipeline goes idle: most frames are skipped outright, and every few frames a cheap check compares a sparse grid of
+ * pixels against the background model. Enough changed samples wake the pipeline up again, starting with the frame
+ * that woke it.
+ *
+ * The background model is not updated while idle. Slow changes such as lighting drifting away from the frozen model
+ * eventually wake the pipeline, which brings the model up to date before going idle again.
+ */
+
+#ifndef MOTION_DETECTOR_SCHEDULER_H
+#define MOTION_DETECTOR_SCHEDULER_H
+
+#include <stdio.h>
+
+// Defaults of the scheduler budgets
+#define SCHEDULE_DEFAULT_SAMPLE_STEP 4
+#define SCHEDULE_DEFAULT_IDLE_AFTER 30
+
+/**
+ * Budgets of a scheduler
+ */
+struct schedule_config {
+    // Frames between two idle checks, 1 to check every frame. 0 disables the scheduler, every frame is processed.
+    int idle_interval;
+    // Idle checks sample every sample_step-th pixel of every sample_step-th row
+    int sample_step;
+    // Changed samples needed to wake up, 0 for enough to cover a blob of MIN_BLOB_AREA pixels
+    int wake_samples;
+    // Consecutive processed frames without blobs before going idle
+    int idle_after;
+};
+
+/**
+ * What to do with the next frame
+ */
+enum schedule_action {
+    SCHEDULE_PROCESS, SCHEDULE_CHECK, SCHEDULE_SKIP
+};
+
+/**
+ * Scheduling state of a pipeline
+ */
+struct scheduler {
+    struct schedule_config config;
+    int idle;
+    // Consecutive processed frames without blobs
+    int quiet_frames;
+    // Frames left to skip before the next idle check
+    int frames_to_check;
+    // Frames processed, checked and skipped, and times the pipeline woke up
+    unsigned long processed;
+    unsigned long checked;
+    unsigned long skipped;
+    unsigned long wakeups;
+};
+
+void scheduler_init(struct scheduler *scheduler, const struct schedule_config *config);
+enum schedule_action scheduler_next(struct scheduler *scheduler);
+int scheduler_checked(struct scheduler *scheduler, int changed_samples);
+int scheduler_processed(struct scheduler *scheduler, int num_blobs);
+void scheduler_print_stats(const struct scheduler *scheduler, FILE *out);
+#endif //MOTION_DETECTOR_SCHEDULER_H
@@ -0,0 +1,206 @@
+/**
+ * Scoring against CDNET ground truth
+ */
+
+#include <png.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include "scoring.h"
+
+/**
+ * Arena space needed by the ground truth of a frame
+ *
+ * @param width width of the frames
+ * @param height height of the frames
+ * @return size in bytes
+ */
+size_t ground_truth_arena_size(int width, int height) {
+    return 2 * bitmask_arena_size(width, height) + arena_size(width);
+}
+
+/**
+ * Initializes the ground truth of a frame with no pixel labeled
+ *
+ * @param truth ground truth to initialize
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param arena arena to allocate from
+ */
+void ground_truth_init(struct ground_truth *truth, int width, int height, struct arena *arena) {
+    bitmask_init(&truth->positive, width, height, arena);
+    bitmask_init(&truth->negative, width, height, arena);
+    truth->num_positive = 0;
+    truth->num_negative = 0;
+    truth->row = arena_alloc(arena, width);
+}
+
+/**
+ * Reads a ground truth mask
+ *
+ * The mask is read as 8 bit grey whatever its format, and must be the size of the frames.
+ *
+ * @param truth ground truth to fill
+ * @param filename file location of the PNG
+ * @return 1 on success, -1 if the file can not be read or is not the size of the frames
+ */
+int ground_truth_load(struct ground_truth *truth, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    png_structp png = NULL;
+    png_infop info = NULL;
+    int width = truth->positive.width;
+    int height = truth->positive.height;
+
+    if (!file) {
+        fprintf(stderr, "Error opening ground truth file %s\n", filename);
+        return -1;
+    }
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png ? png_create_info_struct(png) : NULL;
+
+    // libpng reports errors by jumping back here
+    if (!info || setjmp(png_jmpbuf(png))) {
+        fprintf(stderr, "Failed to read ground truth file %s\n", filename);
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(file);
+        return -1;
+    }
+
+    png_init_io(png, file);
+    png_read_info(png, info);
+
+    if ((int) png_get_image_width(png, info) != width || (int) png_get_image_height(png, info) != height ||
+        png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+        fprintf(stderr, "Ground truth file %s is not a non-interlaced %dx%d image\n", filename, width, height);
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(file);
+        return -1;
+    }
+
+    // Labels are grey levels, so any other format is brought down to one 8 bit channel
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+
+    if (png_get_color_type(png, info) & PNG_COLOR_MASK_COLOR) {
+        png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+    }
+
+    png_read_update_info(png, info);
+    truth->num_positive = 0;
+    truth->num_negative = 0;
+
+    for (int j = 0; j < height; j++) {
+        uint64_t *positive = bitmask_row(&truth->positive, j);
+        uint64_t *negative = bitmask_row(&truth->negative, j);
+
+        png_read_row(png, truth->row, NULL);
+
+        for (int w = 0; w < truth->positive.words; w++) {
+            positive[w] = 0;
+            negative[w] = 0;
+        }
+
+        for (int i = 0; i < width; i++) {
+            uchar label = truth->row[i];
+
+            if (label == TRUTH_MOTION) {
+                positive[i / BITMASK_WORD_BITS] |= 1ULL << (i % BITMASK_WORD_BITS);
+                truth->num_positive++;
+            } else if (label == TRUTH_STATIC || label == TRUTH_SHADOW) {
+                negative[i / BITMASK_WORD_BITS] |= 1ULL << (i % BITMASK_WORD_BITS);
+                truth->num_negative++;
+            }
+        }
+    }
+
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(file);
+
+    return 1;
+}
+
+/**
+ * Scores a motion image against the ground truth of its frame
+ *
+ * Only the true and false positives are counted, the negatives follow from the number of pixels of each label.
+ *
+ * @param confusion confusion matrix to add the frame's pixels to
+ * @param motion_image motion image of the frame
+ * @param truth ground truth of the frame
+ */
+void confusion_add(struct confusion *confusion, const struct bitmask *motion_image, const struct ground_truth *truth) {
+    const uint64_t *motion = motion_image->bits;
+    const uint64_t *positive = truth->positive.bits;
+    const uint64_t *negative = truth->negative.bits;
+    size_t words = (size_t) motion_image->words * motion_image->height;
+    long long tp = 0;
+    long long fp = 0;
+
+    for (size_t w = 0; w < words; w++) {
+        tp += __builtin_popcountll(motion[w] & positive[w]);
+        fp += __builtin_popcountll(motion[w] & negative[w]);
+    }
+
+    confusion->tp += tp;
+    confusion->fp += fp;
+    confusion->fn += truth->num_positive - tp;
+    confusion->tn += truth->num_negative - fp;
+}
+
+/**
+ * Reads the range of frames a CDNET data set is scored on
+ *
+ * @param filename file location of temporalROI.txt
+ * @param first_frame set to the first frame scored
+ * @param last_frame set to the last frame scored
+ * @return 1 on success, -1 if the file can not be read
+ */
+int read_temporal_roi(const char *filename, int *first_frame, int *last_frame) {
+    FILE *file = fopen(filename, "r");
+    int read;
+
+    if (!file) {
+        fprintf(stderr, "Error opening temporal region of interest file %s\n", filename);
+        return -1;
+    }
+
+    read = fscanf(file, "%d %d", first_frame, last_frame);
+    fclose(file);
+
+    if (read != 2 || *first_frame < 1 || *last_frame < *first_frame) {
+        fprintf(stderr, "Bad temporal region of interest file %s\n", filename);
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * Ratio of two counts, 0 if the denominator is
+ */
+static double ratio(long long numerator, long long denominator) {
+    return denominator ? (double) numerator / (double) denominator : 0;
+}
+
+/**
+ * Prints a confusion matrix and the measures CDNET ranks methods by
+ *
+ * @param confusion confusion matrix
+ * @param num_frames number of frames scored
+ * @param out file to print to
+ */
+void confusion_print(const struct confusion *confusion, int num_frames, FILE *out) {
+    double recall = ratio(confusion->tp, confusion->tp + confusion->fn);
+    double precision = ratio(confusion->tp, confusion->tp + confusion->fp);
+    double specificity = ratio(confusion->tn, confusion->tn + confusion->fp);
+    double f_measure = precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0;
+    long long total = confusion->tp + confusion->fp + confusion->fn + confusion->tn;
+
+    fprintf(out, "Scored %d frames against the ground truth: TP %lld FP %lld FN %lld TN %lld\n", num_frames,
+            confusion->tp, confusion->fp, confusion->fn, confusion->tn);
+    fprintf(out, "  recall %.4f specificity %.4f FPR %.4f FNR %.4f PWC %.4f precision %.4f F-measure %.4f\n",
+            recall, specificity, ratio(confusion->fp, confusion->fp + confusion->tn),
+            ratio(confusion->fn, confusion->tp + confusion->fn), 100 * ratio(confusion->fn + confusion->fp, total),
+            precision, f_measure);
+}
@@ -0,0 +1,51 @@
+/**
+ * Scoring against CDNET ground truth
+ *
+ * Each ground truth mask is read into two binary images, the pixels that show motion and those that do not, so a
+ * motion image is scored with a few word-wide ANDs and population counts. Pixels outside the data set's region of
+ * interest and those whose motion is unknown are in neither and never scored, as CDNET's own comparator does.
+ */
+
+#ifndef MOTION_DETECTOR_SCORING_H
+#define MOTION_DETECTOR_SCORING_H
+
+#include <stdio.h>
+#include "bitmask.h"
+
+// Ground truth labels
+#define TRUTH_STATIC 0
+#define TRUTH_SHADOW 50
+#define TRUTH_OUTSIDE_ROI 85
+#define TRUTH_UNKNOWN 170
+#define TRUTH_MOTION 255
+
+/**
+ * Ground truth of a frame
+ */
+struct ground_truth {
+    // Pixels labeled as motion, and as static or shadow
+    struct bitmask positive;
+    struct bitmask negative;
+    long num_positive;
+    long num_negative;
+    // One row of labels as read from the file
+    uchar *row;
+};
+
+/**
+ * Confusion matrix, in pixels
+ */
+struct confusion {
+    long long tp;
+    long long fp;
+    long long fn;
+    long long tn;
+};
+
+size_t ground_truth_arena_size(int width, int height);
+void ground_truth_init(struct ground_truth *truth, int width, int height, struct arena *arena);
+int ground_truth_load(struct ground_truth *truth, const char *filename);
+void confusion_add(struct confusion *confusion, const struct bitmask *motion_image, const struct ground_truth *truth);
+int read_temporal_roi(const char *filename, int *first_frame, int *last_frame);
+void confusion_print(const struct confusion *confusion, int num_frames, FILE *out);
+#endif //MOTION_DETECTOR_SCORING_H
@@ -0,0 +1,407 @@
+/**
+ * Smoothing stage for motion images
+ *
+ * Pixels outside of the image are treated as copies of the nearest edge pixel.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "smoothing.h"
+
+/**
+ * Clamps a coordinate to [0, size)
+ */
+static inline int clamp(int value, int size) {
+    return value < 0 ? 0 : (value >= size ? size - 1 : value);
+}
+
+/**
+ * Row of a binary neighbourhood, clamped to the image
+ */
+struct clamped_row {
+    const uint64_t *bits;
+    // Pixels left of the row, right of it, and the bits of its last word past its end
+    uint64_t left;
+    uint64_t right;
+    uint64_t padding;
+};
+
+/**
+ * Arena space needed by the smoothing stage
+ *
+ * @param filter_size convolution and median filter size to use
+ * @param width width of the images to smooth
+ * @param height height of the images to smooth
+ * @return size in bytes
+ */
+size_t smoother_arena_size(int filter_size, int width, int height) {
+    return arena_size(sizeof(uint16_t) * filter_size) + arena_size(sizeof(uint16_t) * width * height) +
+           bitmask_arena_size(width, height);
+}
+
+/**
+ * Initializes the smoothing stage, building the Gaussian kernel
+ *
+ * @param smoother smoother to initialize
+ * @param filter_size convolution and median filter size to use
+ * @param width width of the images to smooth
+ * @param height height of the images to smooth
+ * @param arena arena to allocate the stage's buffers from
+ */
+void smoother_init(struct smoother *smoother, int filter_size, int width, int height, struct arena *arena) {
+    int radius = filter_size / 2;
+    double taps[filter_size];
+    double sum = 0.0;
+    int fixed_sum = 0;
+
+    // Each neighbour has to be within the words on either side of its pixel's
+    if (filter_size % 2 == 0 || radius >= BITMASK_WORD_BITS) {
+        fprintf(stderr, "Filter size %d is not odd or is over %d\n", filter_size, 2 * BITMASK_WORD_BITS - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    smoother->filter_size = filter_size;
+    smoother->width = width;
+    smoother->height = height;
+    smoother->kernel = arena_alloc(arena, sizeof(uint16_t) * filter_size);
+    smoother->horizontal = arena_alloc(arena, sizeof(uint16_t) * width * height);
+    bitmask_init(&smoother->morphology, width, height, arena);
+
+    // The 2D Gaussian is the product of two 1D Gaussians
+    for (int i = 0; i < filter_size; i++) {
+        taps[i] = exp(-((i - radius) * (i - radius)) / (2 * GAUSSIAN_SIGMA * GAUSSIAN_SIGMA));
+        sum += taps[i];
+    }
+
+    // Quantize the normalized taps, folding the rounding error into the center tap
+    for (int i = 0; i < filter_size; i++) {
+        smoother->kernel[i] = (uint16_t) lround(taps[i] / sum * (1 << GAUSSIAN_SHIFT));
+        fixed_sum += smoother->kernel[i];
+    }
+
+    smoother->kernel[radius] += (1 << GAUSSIAN_SHIFT) - fixed_sum;
+}
+
+/**
+ * Word of a clamped row, pixels past either end of the row reading as the nearest edge pixel
+ *
+ * @param row clamped row
+ * @param w word, may be one past either end of the row
+ * @param words words per row
+ * @return pixels of the word
+ */
+static inline uint64_t clamped_word(const struct clamped_row *row, int w, int words) {
+    if (w < 0) {
+        return row->left;
+    }
+
+    if (w >= words) {
+        return row->right;
+    }
+
+    return w == words - 1 ? row->bits[w] | (row->right & row->padding) : row->bits[w];
+}
+
+/**
+ * Clamps the rows of the neighbourhood of a row to the image
+ *
+ * @param smoother smoothing stage
+ * @param src binary image
+ * @param j row
+ * @param rows filter_size rows to fill
+ */
+static void clamp_rows(const struct smoother *smoother, const struct bitmask *src, int j, struct clamped_row *rows) {
+    int radius = smoother->filter_size / 2;
+    int last = smoother->width - 1;
+    int tail = smoother->width % BITMASK_WORD_BITS;
+
+    for (int l = 0; l < smoother->filter_size; l++) {
+        rows[l].bits = bitmask_row(src, clamp(j + l - radius, smoother->height));
+        rows[l].left = rows[l].bits[0] & 1 ? UINT64_MAX : 0;
+        rows[l].right = (rows[l].bits[last / BITMASK_WORD_BITS] >> (last % BITMASK_WORD_BITS)) & 1 ? UINT64_MAX : 0;
+        rows[l].padding = tail ? UINT64_MAX << tail : 0;
+    }
+}
+
+/**
+ * Gathers the neighbourhood of the 64 pixels of a word, one word per offset of the neighbourhood
+ *
+ * @param smoother smoothing stage
+ * @param rows clamped rows of the neighbourhood
+ * @param w word
+ * @param taps filter_size * filter_size words to fill, bit k of each holding a neighbour of pixel k of the word
+ */
+static inline void gather_words(const struct smoother *smoother, const struct clamped_row *rows, int w,
+                                uint64_t *taps) {
+    int filter_size = smoother->filter_size;
+    int radius = filter_size / 2;
+    int words = (smoother->width + BITMASK_WORD_BITS - 1) / BITMASK_WORD_BITS;
+
+    for (int l = 0; l < filter_size; l++) {
+        uint64_t prev = clamped_word(&rows[l], w - 1, words);
+        uint64_t cur = clamped_word(&rows[l], w, words);
+        uint64_t next = clamped_word(&rows[l], w + 1, words);
+
+        for (int k = 0; k < filter_size; k++) {
+            int dx = k - radius;
+            uint64_t tap = cur;
+
+            if (dx < 0) {
+                tap = cur << -dx | prev >> (BITMASK_WORD_BITS + dx);
+            } else if (dx > 0) {
+                tap = cur >> dx | next << (BITMASK_WORD_BITS - dx);
+            }
+
+            taps[k + l * filter_size] = tap;
+        }
+    }
+}
+
+/**
+ * Median of the neighbourhood of the 64 pixels of a word
+ *
+ * The median of a binary neighbourhood is set when at least half of it is. The set pixels are counted for every pixel
+ * of the word at once in a bit-sliced counter, one word per bit of the count.
+ *
+ * @param smoother smoothing stage
+ * @param rows clamped rows of the neighbourhood
+ * @param w word
+ * @return filtered pixels of the word
+ */
+static uint64_t median_word(const struct smoother *smoother, const struct clamped_row *rows, int w) {
+    int size = smoother->filter_size * smoother->filter_size;
+    int majority = (size + 1) / 2;
+    uint64_t taps[size];
+    uint64_t count[MEDIAN_COUNT_BITS] = {0};
+    uint64_t greater = 0;
+    uint64_t equal = UINT64_MAX;
+
+    gather_words(smoother, rows, w, taps);
+
+    for (int t = 0; t < size; t++) {
+        uint64_t carry = taps[t];
+
+        for (int b = 0; carry; b++) {
+            uint64_t sum = count[b] ^ carry;
+
+            carry &= count[b];
+            count[b] = sum;
+        }
+    }
+
+    // Compare the count against the majority from its top bit down
+    for (int b = MEDIAN_COUNT_BITS - 1; b >= 0; b--) {
+        if ((majority >> b) & 1) {
+            equal &= count[b];
+        } else {
+            greater |= equal & count[b];
+            equal &= ~count[b];
+        }
+    }
+
+    return greater | equal;
+}
+
+/**
+ * Median filters spans of a row of a binary motion image
+ *
+ * Pixels outside the spans are left as they are in dest. The neighbourhood of a row reaches filter_size / 2 rows above
+ * and below it, so every row of src must be final before any row is filtered. Rows can be filtered in parallel, 64
+ * pixels at a time.
+ *
+ * @param smoother smoothing stage
+ * @param src motion image to filter
+ * @param dest filtered motion image
+ * @param j row to filter
+ * @param spans spans of the row to filter
+ * @param num_spans number of spans
+ */
+void smoother_median_spans(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest, int j,
+                           const struct roi_span *spans, int num_spans) {
+    uint64_t *dest_row = bitmask_row(dest, j);
+    struct clamped_row rows[smoother->filter_size];
+
+    clamp_rows(smoother, src, j, rows);
+
+    for (int s = 0; s < num_spans; s++) {
+        int start = spans[s].start;
+        int end = spans[s].end;
+
+        for (int w = start / BITMASK_WORD_BITS; w * BITMASK_WORD_BITS < end; w++) {
+            int first = start - w * BITMASK_WORD_BITS;
+            int last = end - w * BITMASK_WORD_BITS;
+            uint64_t bits = first > 0 ? UINT64_MAX << first : UINT64_MAX;
+
+            bits &= last < BITMASK_WORD_BITS ? ~(UINT64_MAX << last) : UINT64_MAX;
+            dest_row[w] = (dest_row[w] & ~bits) | (median_word(smoother, rows, w) & bits);
+        }
+    }
+}
+
+/**
+ * Median filters a band of rows of a binary motion image
+ *
+ * The neighbourhood of a row reaches filter_size / 2 rows into the bands above and below it, so every row of src must
+ * be final before any band is filtered. Bands write disjoint rows of dest and can be filtered in parallel.
+ *
+ * @param smoother smoothing stage
+ * @param src motion image to filter
+ * @param dest filtered motion image
+ * @param first_row first row of the band
+ * @param last_row row after the last row of the band
+ */
+void smoother_median_rows(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest,
+                          int first_row, int last_row) {
+    struct roi_span whole_row = {0, smoother->width};
+
+    for (int j = first_row; j < last_row; j++) {
+        smoother_median_spans(smoother, src, dest, j, &whole_row, 1);
+    }
+}
+
+/**
+ * Median filters a binary motion image
+ *
+ * @param smoother smoothing stage
+ * @param src motion image to filter
+ * @param dest filtered motion image
+ */
+void smoother_median(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest) {
+    smoother_median_rows(smoother, src, dest, 0, smoother->height);
+}
+
+/**
+ * Erodes or dilates a binary image over a filter_size square
+ *
+ * @param smoother smoothing stage
+ * @param src image to filter
+ * @param dest filtered image, not src
+ * @param dilate 1 to dilate, 0 to erode
+ */
+static void morphology(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest, int dilate) {
+    int size = smoother->filter_size * smoother->filter_size;
+    int tail = smoother->width % BITMASK_WORD_BITS;
+    uint64_t taps[size];
+    struct clamped_row rows[smoother->filter_size];
+
+    for (int j = 0; j < smoother->height; j++) {
+        uint64_t *dest_row = bitmask_row(dest, j);
+
+        clamp_rows(smoother, src, j, rows);
+
+        for (int w = 0; w < dest->words; w++) {
+            uint64_t word = dilate ? 0 : UINT64_MAX;
+
+            gather_words(smoother, rows, w, taps);
+
+            for (int t = 0; t < size; t++) {
+                word = dilate ? word | taps[t] : word & taps[t];
+            }
+
+            dest_row[w] = word;
+        }
+
+        // Keep the bits past the end of the row clear
+        if (tail) {
+            dest_row[dest->words - 1] &= ~(UINT64_MAX << tail);
+        }
+    }
+}
+
+/**
+ * Erodes a binary motion image, a pixel stays set only if its whole filter_size neighbourhood is
+ *
+ * @param smoother smoothing stage
+ * @param src image to erode
+ * @param dest eroded image, not src
+ */
+void smoother_erode(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest) {
+    morphology(smoother, src, dest, 0);
+}
+
+/**
+ * Dilates a binary motion image, a pixel is set if any pixel of its filter_size neighbourhood is
+ *
+ * @param smoother smoothing stage
+ * @param src image to dilate
+ * @param dest dilated image, not src
+ */
+void smoother_dilate(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest) {
+    morphology(smoother, src, dest, 1);
+}
+
+/**
+ * Opens a binary motion image, eroding then dilating it to remove specks smaller than the filter
+ *
+ * @param smoother smoothing stage
+ * @param src image to open
+ * @param dest opened image, not src
+ */
+void smoother_open(struct smoother *smoother, const struct bitmask *src, struct bitmask *dest) {
+    morphology(smoother, src, &smoother->morphology, 0);
+    morphology(smoother, &smoother->morphology, dest, 1);
+}
+
+/**
+ * Closes a binary motion image, dilating then eroding it to fill holes smaller than the filter
+ *
+ * @param smoother smoothing stage
+ * @param src image to close
+ * @param dest closed image, not src
+ */
+void smoother_close(struct smoother *smoother, const struct bitmask *src, struct bitmask *dest) {
+    morphology(smoother, src, &smoother->morphology, 1);
+    morphology(smoother, &smoother->morphology, dest, 0);
+}
+
+/**
+ * Gaussian smooths a single channel image with two fixed-point passes
+ *
+ * @param smoother smoothing stage
+ * @param src image to smooth
+ * @param dest smoothed image
+ */
+void smoother_gaussian(const struct smoother *smoother, const uchar *src, uchar *dest) {
+    int filter_size = smoother->filter_size;
+    int radius = filter_size / 2;
+    int width = smoother->width;
+    int height = smoother->height;
+    const uint16_t *kernel = smoother->kernel;
+
+    // Horizontal pass, each output holds GAUSSIAN_SHIFT fractional bits
+    for (int j = 0; j < height; j++) {
+        const uchar *src_row = src + (size_t) j * width;
+        uint16_t *out_row = smoother->horizontal + (size_t) j * width;
+
+        for (int i = 0; i < width; i++) {
+            uint32_t sum = 0;
+
+            for (int k = 0; k < filter_size; k++) {
+                sum += kernel[k] * src_row[clamp(i + k - radius, width)];
+            }
+
+            out_row[i] = (uint16_t) sum;
+        }
+    }
+
+    // Vertical pass, rounding away both passes' fractional bits
+    for (int j = 0; j < height; j++) {
+        uchar *dest_row = dest + (size_t) j * width;
+        const uint16_t *rows[filter_size];
+
+        for (int l = 0; l < filter_size; l++) {
+            rows[l] = smoother->horizontal + (size_t) clamp(j + l - radius, height) * width;
+        }
+
+        for (int i = 0; i < width; i++) {
+            uint32_t sum = 0;
+
+            for (int l = 0; l < filter_size; l++) {
+                sum += kernel[l] * rows[l][i];
+            }
+
+            dest_row[i] = (uchar) ((sum + (1u << (2 * GAUSSIAN_SHIFT - 1))) >> (2 * GAUSSIAN_SHIFT));
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/**
+ * Smoothing stage for motion images
+ *
+ * Median, erosion, dilation, opening and closing of bit-packed binary motion images, each word of 64 pixels filtered
+ * at once with bitwise operations, and a separable fixed-point Gaussian whose kernel is built once.
+ */
+
+#ifndef MOTION_DETECTOR_SMOOTHING_H
+#define MOTION_DETECTOR_SMOOTHING_H
+
+#include <stdint.h>
+#include "image_manipulation.h"
+#include "arena.h"
+#include "bitmask.h"
+#include "roi.h"
+
+// Words of the bit-sliced counter of the median filter, enough to count any neighbourhood it allows
+#define MEDIAN_COUNT_BITS 14
+
+// Gaussian standard deviation and fixed-point precision of its taps
+#define GAUSSIAN_SIGMA 1.5
+#define GAUSSIAN_SHIFT 8
+
+/**
+ * Smoothing state shared by every frame of a stream
+ */
+struct smoother {
+    int filter_size;
+    int width;
+    int height;
+    // 1D Gaussian taps, in fixed-point with GAUSSIAN_SHIFT fractional bits, summing to 1 << GAUSSIAN_SHIFT
+    uint16_t *kernel;
+    // Output of the horizontal Gaussian pass
+    uint16_t *horizontal;
+    // Output of the first pass of an opening or closing
+    struct bitmask morphology;
+};
+
+size_t smoother_arena_size(int filter_size, int width, int height);
+void smoother_init(struct smoother *smoother, int filter_size, int width, int height, struct arena *arena);
+void smoother_median_spans(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest, int j,
+                           const struct roi_span *spans, int num_spans);
+void smoother_median_rows(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest,
+                          int first_row, int last_row);
+void smoother_median(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest);
+void smoother_erode(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest);
+void smoother_dilate(const struct smoother *smoother, const struct bitmask *src, struct bitmask *dest);
+void smoother_open(struct smoother *smoother, const struct bitmask *src, struct bitmask *dest);
+void smoother_close(struct smoother *smoother, const struct bitmask *src, struct bitmask *dest);
+void smoother_gaussian(const struct smoother *smoother, const uchar *src, uchar *dest);
+#endif //MOTION_DETECTOR_SMOOTHING_H
@@ -0,0 +1,369 @@
+/**
+ * Blob tracker
+ *
+ * Matching is greedy: every candidate pair is scored, and pairs are taken best first as long as neither side is
+ * already matched.
+ */
+
+#include <math.h>
+#include "tracker.h"
+
+/**
+ * Number of grid cells needed to cover size pixels
+ */
+static int grid_cells(int size) {
+    return (size + TRACKER_CELL_SIZE - 1) / TRACKER_CELL_SIZE;
+}
+
+/**
+ * Number of grid cell entries the tracks can be bucketed in
+ */
+static int max_cell_entries(int width, int height) {
+    return TRACK_CELL_ENTRIES * MAX_TRACKS + 4 * grid_cells(width) * grid_cells(height);
+}
+
+/**
+ * Arena space needed to track the blobs of a stream
+ *
+ * @param width width of the frames
+ * @param height height of the frames
+ * @return size in bytes
+ */
+size_t tracker_arena_size(int width, int height) {
+    return arena_size(sizeof(struct track) * MAX_TRACKS) + arena_size(sizeof(struct blob) * MAX_TRACKS) +
+           arena_size(sizeof(int) * grid_cells(width) * grid_cells(height)) +
+           2 * arena_size(sizeof(int) * max_cell_entries(width, height)) + 2 * arena_size(sizeof(int) * MAX_TRACKS) +
+           arena_size(sizeof(struct track_pair) * MAX_TRACK_PAIRS) + arena_size(sizeof(int) * MAX_BLOBS);
+}
+
+/**
+ * Initializes a tracker with no tracks
+ *
+ * @param tracker tracker to initialize
+ * @param width width of the frames
+ * @param height height of the frames
+ * @param arena arena to allocate the tracker's buffers from
+ */
+void tracker_init(struct tracker *tracker, int width, int height, struct arena *arena) {
+    tracker->width = width;
+    tracker->height = height;
+    tracker->num_tracks = 0;
+    tracker->next_id = 1;
+    tracker->grid_width = grid_cells(width);
+    tracker->grid_height = grid_cells(height);
+    tracker->tracks = arena_alloc(arena, sizeof(struct track) * MAX_TRACKS);
+    tracker->predicted = arena_alloc(arena, sizeof(struct blob) * MAX_TRACKS);
+    tracker->cells = arena_alloc(arena, sizeof(int) * tracker->grid_width * tracker->grid_height);
+    tracker->max_entries = max_cell_entries(width, height);
+    tracker->entry_track = arena_alloc(arena, sizeof(int) * tracker->max_entries);
+    tracker->entry_next = arena_alloc(arena, sizeof(int) * tracker->max_entries);
+    tracker->scored_blob = arena_alloc(arena, sizeof(int) * MAX_TRACKS);
+    tracker->track_blob = arena_alloc(arena, sizeof(int) * MAX_TRACKS);
+    tracker->pairs = arena_alloc(arena, sizeof(struct track_pair) * MAX_TRACK_PAIRS);
+    tracker->blob_track = arena_alloc(arena, sizeof(int) * MAX_BLOBS);
+    tracker->dropped_pairs = 0;
+    tracker->dropped_cells = 0;
+    tracker->total_dropped_pairs = 0;
+    tracker->total_dropped_cells = 0;
+}
+
+/**
+ * Clamps a grid coordinate to [0, size)
+ */
+static inline int clamp_cell(int cell, int size) {
+    return cell < 0 ? 0 : (cell >= size ? size - 1 : cell);
+}
+
+/**
+ * Box of a track moved along its velocity to a new capture time
+ *
+ * @param track track
+ * @param timestamp capture time of the new frame
+ * @param predicted box and centroid of the track at that time
+ */
+static void predict_track(const struct track *track, double timestamp, struct blob *predicted) {
+    float dt = (float) (timestamp - track->last_seen);
+    float dx = track->vx * dt;
+    float dy = track->vy * dt;
+
+    *predicted = track->blob;
+    predicted->x = (int) lrintf((float) track->blob.x + dx);
+    predicted->y = (int) lrintf((float) track->blob.y + dy);
+    predicted->cx += dx;
+    predicted->cy += dy;
+}
+
+/**
+ * Intersection over union of two boxes
+ */
+static float box_iou(const struct blob *a, const struct blob *b) {
+    int left = a->x > b->x ? a->x : b->x;
+    int top = a->y > b->y ? a->y : b->y;
+    int right = a->x + a->w < b->x + b->w ? a->x + a->w : b->x + b->w;
+    int bottom = a->y + a->h < b->y + b->h ? a->y + a->h : b->y + b->h;
+    float intersection;
+
+    if (right <= left || bottom <= top) {
+        return 0.0f;
+    }
+
+    intersection = (float) (right - left) * (float) (bottom - top);
+    return intersection / ((float) a->w * a->h + (float) b->w * b->h - intersection);
+}
+
+/**
+ * Moves a pair down a heap of pairs until neither of its children scores lower
+ */
+static void sift_down(struct track_pair *pairs, int root, int count) {
+    struct track_pair pair = pairs[root];
+
+    for (int child = 2 * root + 1; child < count; child = 2 * root + 1) {
+        if (child + 1 < count && pairs[child + 1].score < pairs[child].score) {
+            child++;
+        }
+
+        if (pair.score <= pairs[child].score) {
+            break;
+        }
+
+        pairs[root] = pairs[child];
+        root = child;
+    }
+
+    pairs[root] = pair;
+}
+
+/**
+ * Sorts candidate pairs best score first
+ *
+ * A heap sort in place, qsort may allocate.
+ */
+static void sort_pairs(struct track_pair *pairs, int count) {
+    for (int root = count / 2 - 1; root >= 0; root--) {
+        sift_down(pairs, root, count);
+    }
+
+    // Move the lowest score left in the heap to the end each time
+    for (int end = count - 1; end > 0; end--) {
+        struct track_pair lowest = pairs[0];
+
+        pairs[0] = pairs[end];
+        pairs[end] = lowest;
+        sift_down(pairs, 0, end);
+    }
+}
+
+/**
+ * Scores every track near each blob, leaving the candidate matches in tracker->pairs
+ *
+ * A blob matches a track if their boxes overlap, or if its centroid, which lies within its box, is within matching
+ * distance of the track's. Either way some pixel of the blob's box lies in the track's box grown by the matching
+ * distance, so the cells the blob's box covers hold every track it could match.
+ *
+ * @param tracker tracker
+ * @param blobs blobs of the new frame
+ * @param num_blobs number of blobs
+ * @return number of candidate pairs
+ */
+static int find_candidates(struct tracker *tracker, const struct blob *blobs, int num_blobs) {
+    const struct blob *predicted = tracker->predicted;
+    int num_pairs = 0;
+    int num_entries = 0;
+
+    tracker->dropped_pairs = 0;
+    tracker->dropped_cells = 0;
+
+    for (int c = 0; c < tracker->grid_width * tracker->grid_height; c++) {
+        tracker->cells[c] = -1;
+    }
+
+    // Bucket each track in every cell its grown box covers, one more pixel covering the rounding of the predicted box.
+    // Boxes predicted off the frame are clamped to the nearest cells.
+    for (int t = 0; t < tracker->num_tracks; t++) {
+        int reach = TRACK_MAX_DISTANCE + 1;
+        int first_x = clamp_cell((predicted[t].x - reach) / TRACKER_CELL_SIZE, tracker->grid_width);
+        int last_x = clamp_cell((predicted[t].x + predicted[t].w - 1 + reach) / TRACKER_CELL_SIZE, tracker->grid_width);
+        int first_y = clamp_cell((predicted[t].y - reach) / TRACKER_CELL_SIZE, tracker->grid_height);
+        int last_y = clamp_cell((predicted[t].y + predicted[t].h - 1 + reach) / TRACKER_CELL_SIZE,
+                                tracker->grid_height);
+
+        tracker->scored_blob[t] = -1;
+
+        for (int cell_y = first_y; cell_y <= last_y; cell_y++) {
+            for (int cell_x = first_x; cell_x <= last_x; cell_x++) {
+                int *cell = &tracker->cells[cell_y * tracker->grid_width + cell_x];
+
+                if (num_entries == tracker->max_entries) {
+                    tracker->dropped_cells++;
+                    continue;
+                }
+
+                tracker->entry_track[num_entries] = t;
+                tracker->entry_next[num_entries] = *cell;
+                *cell = num_entries++;
+            }
+        }
+    }
+
+    for (int b = 0; b < num_blobs; b++) {
+        const struct blob *blob = &blobs[b];
+        // Cells the blob's box covers
+        int first_x = clamp_cell(blob->x / TRACKER_CELL_SIZE, tracker->grid_width);
+        int last_x = clamp_cell((blob->x + blob->w - 1) / TRACKER_CELL_SIZE, tracker->grid_width);
+        int first_y = clamp_cell(blob->y / TRACKER_CELL_SIZE, tracker->grid_height);
+        int last_y = clamp_cell((blob->y + blob->h - 1) / TRACKER_CELL_SIZE, tracker->grid_height);
+
+        for (int cell_y = first_y; cell_y <= last_y; cell_y++) {
+            for (int cell_x = first_x; cell_x <= last_x; cell_x++) {
+                for (int e = tracker->cells[cell_y * tracker->grid_width + cell_x]; e >= 0;
+                     e = tracker->entry_next[e]) {
+                    int t = tracker->entry_track[e];
+                    float iou;
+                    float distance;
+
+                    // Tracks covering several of the blob's cells are found in each of them
+                    if (tracker->scored_blob[t] == b) {
+                        continue;
+                    }
+
+                    tracker->scored_blob[t] = b;
+                    iou = box_iou(blob, &predicted[t]);
+                    distance = hypotf(blob->cx - predicted[t].cx, blob->cy - predicted[t].cy);
+
+                    if (iou < TRACK_MIN_IOU && distance >= TRACK_MAX_DISTANCE) {
+                        continue;
+                    }
+
+                    if (num_pairs == MAX_TRACK_PAIRS) {
+                        tracker->dropped_pairs++;
+                        continue;
+                    }
+
+                    tracker->pairs[num_pairs].blob = b;
+                    tracker->pairs[num_pairs].track = t;
+                    tracker->pairs[num_pairs++].score = iou + fmaxf(0.0f, 1.0f - distance / TRACK_MAX_DISTANCE);
+                }
+            }
+        }
+    }
+
+    return num_pairs;
+}
+
+/**
+ * Moves a track to the blob it was matched with
+ *
+ * @param track track
+ * @param blob blob matched to the track
+ * @param timestamp capture time of the blob's frame
+ */
+static void update_track(struct track *track, const struct blob *blob, double timestamp) {
+    float dt = (float) (timestamp - track->last_seen);
+
+    if (dt > 0) {
+        float vx = (blob->cx - track->blob.cx) / dt;
+        float vy = (blob->cy - track->blob.cy) / dt;
+
+        // The first measurement is taken as is, later ones are smoothed
+        if (track->frames == 1) {
+            track->vx = vx;
+            track->vy = vy;
+        } else {
+            track->vx += TRACK_VELOCITY_GAIN * (vx - track->vx);
+            track->vy += TRACK_VELOCITY_GAIN * (vy - track->vy);
+        }
+    }
+
+    track->blob = *blob;
+    track->last_seen = timestamp;
+    track->frames++;
+    track->misses = 0;
+}
+
+/**
+ * Links the blobs of a new frame to the tracks
+ *
+ * Matched tracks move to their blob, tracks unmatched for more than TRACK_MAX_MISSES frames are dropped and every
+ * unmatched blob starts a new track.
+ *
+ * @param tracker tracker
+ * @param blobs blobs of the new frame
+ * @param num_blobs number of blobs, at most MAX_BLOBS
+ * @param timestamp capture time of the frame, in seconds
+ */
+void tracker_update(struct tracker *tracker, const struct blob *blobs, int num_blobs, double timestamp) {
+    int num_pairs;
+    int kept = 0;
+
+    for (int t = 0; t < tracker->num_tracks; t++) {
+        predict_track(&tracker->tracks[t], timestamp, &tracker->predicted[t]);
+        tracker->track_blob[t] = -1;
+    }
+
+    for (int b = 0; b < num_blobs; b++) {
+        tracker->blob_track[b] = -1;
+    }
+
+    num_pairs = find_candidates(tracker, blobs, num_blobs);
+    tracker->total_dropped_pairs += tracker->dropped_pairs;
+    tracker->total_dropped_cells += tracker->dropped_cells;
+    sort_pairs(tracker->pairs, num_pairs);
+
+    for (int p = 0; p < num_pairs; p++) {
+        const struct track_pair *pair = &tracker->pairs[p];
+
+        if (tracker->track_blob[pair->track] < 0 && tracker->blob_track[pair->blob] < 0) {
+            tracker->track_blob[pair->track] = pair->blob;
+            tracker->blob_track[pair->blob] = pair->track;
+        }
+    }
+
+    // Update the matched tracks and drop the ones lost for too long, keeping the others in order
+    for (int t = 0; t < tracker->num_tracks; t++) {
+        struct track *track = &tracker->tracks[t];
+
+        if (tracker->track_blob[t] >= 0) {
+            update_track(track, &blobs[tracker->track_blob[t]], timestamp);
+        } else if (++track->misses > TRACK_MAX_MISSES) {
+            continue;
+        }
+
+        tracker->tracks[kept++] = *track;
+    }
+
+    tracker->num_tracks = kept;
+
+    // Start a track on every blob left over
+    for (int b = 0; b < num_blobs && tracker->num_tracks < MAX_TRACKS; b++) {
+        struct track *track;
+
+        if (tracker->blob_track[b] >= 0) {
+            continue;
+        }
+
+        track = &tracker->tracks[tracker->num_tracks++];
+        track->id = tracker->next_id++;
+        track->blob = blobs[b];
+        track->vx = 0;
+        track->vy = 0;
+        track->first_seen = timestamp;
+        track->last_seen = timestamp;
+        track->frames = 1;
+        track->misses = 0;
+    }
+}
+
+/**
+ * Prints how many candidate matches and grid cells the tracker ran out of room for, does nothing if none
+ *
+ * @param tracker tracker
+ * @param out stream to print to
+ */
+void tracker_print_stats(const struct tracker *tracker, FILE *out) {
+    if (!tracker->total_dropped_pairs && !tracker->total_dropped_cells) {
+        return;
+    }
+
+    fprintf(out, "Tracker: dropped %ld candidate matches past %d per frame and %ld track cells past %d entries\n",
+            tracker->total_dropped_pairs, MAX_TRACK_PAIRS, tracker->total_dropped_cells, tracker->max_entries);
+}
@@ -0,0 +1,102 @@
+/**
+ * Blob tracker
+ *
+ * Links the blobs of consecutive frames into tracks with stable IDs. Each track's box is moved along its velocity to
+ * predict where it is in the new frame, and blobs are matched to the predicted boxes by overlap and centroid distance.
+ * Each track is bucketed in every cell of a grid that its predicted box, grown by the matching distance, covers. A blob
+ * only probes the cells its own box covers, which hold every track it could match and seldom many more.
+ */
+
+#ifndef MOTION_DETECTOR_TRACKER_H
+#define MOTION_DETECTOR_TRACKER_H
+
+#include <stdio.h>
+#include "blobs.h"
+#include "arena.h"
+
+// Most tracks followed at once, blobs that would start further ones are not tracked
+#define MAX_TRACKS MAX_BLOBS
+// Side of the cells tracks are bucketed in, in pixels
+#define TRACKER_CELL_SIZE 32
+// Distance in pixels a blob's centroid has to be under from a track's predicted centroid to match it without overlap
+#define TRACK_MAX_DISTANCE 40
+// Least intersection over union of a blob and a track's predicted box for them to match on overlap alone
+#define TRACK_MIN_IOU 0.1f
+// Consecutive frames a track can go unmatched before it is dropped
+#define TRACK_MAX_MISSES 5
+// Weight of each new velocity measurement in a track's smoothed velocity
+#define TRACK_VELOCITY_GAIN 0.5f
+// Most candidate matches scored per frame, further candidates are counted but dropped
+#define MAX_TRACK_PAIRS (8 * MAX_BLOBS)
+// Grid cell entries per track, on top of a few for each cell, further cells a track covers are counted but left out
+#define TRACK_CELL_ENTRIES 16
+
+/**
+ * A blob followed across frames
+ */
+struct track {
+    // Unique for the lifetime of the tracker, never reused
+    int id;
+    // Blob last matched to the track
+    struct blob blob;
+    // Velocity of the centroid, in pixels per second
+    float vx;
+    float vy;
+    // Capture times of the first and last matched frames, in seconds
+    double first_seen;
+    double last_seen;
+    // Number of frames the track was matched in
+    int frames;
+    // Consecutive frames the track has gone unmatched, 0 if it was matched in the last frame
+    int misses;
+};
+
+/**
+ * Candidate match between a blob and a track
+ */
+struct track_pair {
+    int blob;
+    int track;
+    float score;
+};
+
+/**
+ * Tracks of a video stream
+ */
+struct tracker {
+    int width;
+    int height;
+    struct track *tracks;
+    int num_tracks;
+    int next_id;
+    // Box of each track predicted for the frame being tracked
+    struct blob *predicted;
+    // Grid of cells over the frame, each holding the first of a linked list of entries, one for each track covering it
+    int grid_width;
+    int grid_height;
+    int *cells;
+    // Track of each entry and the next entry of the same cell, -1 at the end of the list
+    int *entry_track;
+    int *entry_next;
+    int max_entries;
+    // Last blob each track was scored against, so a track held in several cells a blob probes is only scored once
+    int *scored_blob;
+    // Candidate matches of the frame being tracked
+    struct track_pair *pairs;
+    // Blob matched to each track and track matched to each blob, -1 if none
+    int *track_blob;
+    int *blob_track;
+    // Candidate matches of the last frame dropped past MAX_TRACK_PAIRS
+    int dropped_pairs;
+    // Cells of the last frame's tracks left out once every entry was used
+    int dropped_cells;
+    // Both of the above summed over every frame tracked
+    long total_dropped_pairs;
+    long total_dropped_cells;
+};
+
+size_t tracker_arena_size(int width, int height);
+void tracker_init(struct tracker *tracker, int width, int height, struct arena *arena);
+void tracker_update(struct tracker *tracker, const struct blob *blobs, int num_blobs, double timestamp);
+void tracker_print_stats(const struct tracker *tracker, FILE *out);
+#endif //MOTION_DETECTOR_TRACKER_H
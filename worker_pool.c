@@ -0,0 +1,177 @@
+/**
+ * Fixed pool of worker threads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "worker_pool.h"
+
+/**
+ * Number of threads to use by default, one per online CPU unless overridden with MOTION_THREADS
+ *
+ * @return thread count, between 1 and MAX_WORKER_THREADS
+ */
+int worker_pool_default_threads(void) {
+    const char *requested = getenv("MOTION_THREADS");
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (requested) {
+        num_threads = strtol(requested, NULL, 10);
+    }
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > MAX_WORKER_THREADS) {
+        num_threads = MAX_WORKER_THREADS;
+    }
+
+    return (int) num_threads;
+}
+
+/**
+ * Runs tasks of the current batch until none are left to claim
+ *
+ * Must be called with the pool locked. The lock is released while each task runs.
+ *
+ * @param pool worker pool
+ */
+static void run_tasks(struct worker_pool *pool) {
+    while (pool->next_task < pool->num_tasks) {
+        int task = pool->next_task++;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->task_fn(pool->context, task);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->unfinished_tasks == 0) {
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+}
+
+/**
+ * Worker thread, waits for batches and helps run them
+ *
+ * @param ptr worker pool
+ * @return NULL
+ */
+static void *worker_main(void *ptr) {
+    struct worker_pool *pool = ptr;
+    unsigned int batch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (1) {
+        while (!pool->exit && pool->batch == batch) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+
+        if (pool->exit) {
+            break;
+        }
+
+        batch = pool->batch;
+        run_tasks(pool);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * Starts the threads of a worker pool
+ *
+ * @param pool pool to initialize
+ * @param num_threads number of threads to run tasks on, including the thread calling worker_pool_run
+ */
+void worker_pool_init(struct worker_pool *pool, int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > MAX_WORKER_THREADS) {
+        num_threads = MAX_WORKER_THREADS;
+    }
+
+    pool->num_threads = num_threads;
+    pool->task_fn = NULL;
+    pool->context = NULL;
+    pool->num_tasks = 0;
+    pool->next_task = 0;
+    pool->unfinished_tasks = 0;
+    pool->batch = 0;
+    pool->exit = 0;
+
+    pthread_mutex_init(&pool->submit_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // The calling thread is the first worker
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool)) {
+            fprintf(stderr, "Unable to start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Stops and joins the threads of a worker pool
+ *
+ * @param pool pool to free
+ */
+void worker_pool_free(struct worker_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->exit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->submit_lock);
+}
+
+/**
+ * Runs a batch of tasks across the pool and waits for all of them to finish
+ *
+ * @param pool worker pool
+ * @param task_fn function run for each task
+ * @param context context passed to every task
+ * @param num_tasks number of tasks in the batch
+ */
+void worker_pool_run(struct worker_pool *pool, worker_task_fn task_fn, void *context, int num_tasks) {
+    // Nothing to hand off, skip waking the workers
+    if (pool->num_threads == 1 || num_tasks == 1) {
+        for (int task = 0; task < num_tasks; task++) {
+            task_fn(context, task);
+        }
+        return;
+    }
+
+    // Only one batch runs at a time
+    pthread_mutex_lock(&pool->submit_lock);
+    pthread_mutex_lock(&pool->lock);
+
+    pool->task_fn = task_fn;
+    pool->context = context;
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->unfinished_tasks = num_tasks;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+
+    run_tasks(pool);
+
+    while (pool->unfinished_tasks > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->submit_lock);
+}
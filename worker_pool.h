@@ -0,0 +1,53 @@
+/**
+ * Fixed pool of worker threads
+ *
+ * Runs a batch of independent tasks across a set of threads started once up front. The calling thread takes part in
+ * every batch, so a pool of one thread runs everything inline. Several threads may share a pool, their batches are
+ * run one after another.
+ */
+
+#ifndef MOTION_DETECTOR_WORKER_POOL_H
+#define MOTION_DETECTOR_WORKER_POOL_H
+
+#include <pthread.h>
+
+// Upper bound on the number of threads in a pool
+#define MAX_WORKER_THREADS 64
+
+/**
+ * Runs one task of a batch
+ *
+ * @param context context shared by every task of the batch
+ * @param task index of the task, from 0 to the number of tasks in the batch
+ */
+typedef void (*worker_task_fn)(void *context, int task);
+
+/**
+ * Worker threads and the batch they are working on
+ */
+struct worker_pool {
+    // Number of threads running tasks, including the caller of worker_pool_run
+    int num_threads;
+    pthread_t threads[MAX_WORKER_THREADS];
+    // Held by the thread whose batch is running
+    pthread_mutex_t submit_lock;
+    pthread_mutex_t lock;
+    // Signalled when a new batch is started or the pool is shutting down
+    pthread_cond_t start;
+    // Signalled when the last task of a batch finishes
+    pthread_cond_t done;
+    worker_task_fn task_fn;
+    void *context;
+    int num_tasks;
+    int next_task;
+    int unfinished_tasks;
+    // Incremented for each batch so workers can tell a new batch from a spurious wakeup
+    unsigned int batch;
+    int exit;
+};
+
+int worker_pool_default_threads(void);
+void worker_pool_init(struct worker_pool *pool, int num_threads);
+void worker_pool_free(struct worker_pool *pool);
+void worker_pool_run(struct worker_pool *pool, worker_task_fn task_fn, void *context, int num_tasks);
+#endif //MOTION_DETECTOR_WORKER_POOL_H